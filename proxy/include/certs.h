@@ -0,0 +1,56 @@
+#ifndef _CERTS_H_
+#define _CERTS_H_
+
+#include "config.h"
+#include "certstore.h"
+#include "keypool.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if RUN_SSL
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+/* Leaf certificate minted for one intercepted host */
+typedef struct CertEntry {
+    struct CertEntry *next;     // Bucket chain
+    struct CertEntry *lru_next; // Recency list, most recently used first
+    struct CertEntry *lru_prev;
+    X509 *cert;
+    EVP_PKEY *key;
+    char host[];                // Lower cased
+} CertEntry;
+
+/* Leaf certificates signed by the root CA, shared by all workers and the
+ * offload pool. A host's leaf is minted in-process on first contact and kept
+ * until CERT_CACHE_SZ others were used more recently. */
+typedef struct CertCache {
+    X509 *ca;                   // Root CA, NULL if it could not be loaded
+    EVP_PKEY *ca_key;
+    CertEntry *buckets[CERT_CACHE_BUCKETS];
+    CertEntry *lru_head;        // Most recently used
+    CertEntry *lru_tail;        // Evicted first
+    size_t count;
+    pthread_mutex_t lock;
+    KeyPool keys;               // Keys for leaves still to be minted
+    CertStore store;            // Leaves minted before, kept across restarts
+} CertCache;
+
+int CertCache_init(CertCache *cache, SSL_CTX *ctx);
+void CertCache_free(CertCache *cache);
+int CertCache_use(CertCache *cache, SSL *ssl, const char *host);
+#endif
+
+#endif /* _CERTS_H_ */
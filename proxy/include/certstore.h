@@ -0,0 +1,64 @@
+#ifndef _CERTSTORE_H_
+#define _CERTSTORE_H_
+
+#include "config.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if RUN_SSL
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#define CERT_STORE_MAGIC   "PXCS"
+#define CERT_STORE_VERSION 1
+
+/* Start of the store file, followed by the slot index and the blobs */
+typedef struct CertStoreHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t reserved;
+} CertStoreHeader;
+
+/* Index slot, hash is 0 while the slot is empty. The blob it points to holds
+ * the hostname, then the DER certificate, then the DER private key. */
+typedef struct CertStoreSlot {
+    uint64_t hash;
+    uint64_t offset;
+    uint32_t host_l;
+    uint32_t cert_l;
+    uint32_t key_l;
+    uint32_t reserved;
+} CertStoreSlot;
+
+/* Leaf certificates kept on disk across restarts. Only the index is mapped
+ * when the store is opened, a blob is read and parsed the first time its
+ * host is asked for. Blobs are appended, the store starts over empty once
+ * it would outgrow CERT_STORE_MAX. */
+typedef struct CertStore {
+    int fd;
+    CertStoreHeader *map;   // Header and index shared with the file, NULL if not open
+    CertStoreSlot *slots;
+    size_t map_l;
+    off_t end;              // Where the next blob is appended, under lock
+    pthread_mutex_t lock;
+} CertStore;
+
+int CertStore_open(CertStore *store, const char *path);
+void CertStore_close(CertStore *store);
+int CertStore_load(CertStore *store, const char *host, X509 **cert, EVP_PKEY **key);
+int CertStore_save(CertStore *store, const char *host, X509 *cert, EVP_PKEY *key);
+#endif
+
+#endif /* _CERTSTORE_H_ */
@@ -4,7 +4,11 @@
 #include "config.h"
 #include "http.h"
 #include "list.h"
+#include "outq.h"
+#include "pool.h"
 #include "query.h"
+#include "timer.h"
+#include "tunnel.h"
 #include "utility.h"
 
 #include <arpa/inet.h>
@@ -28,17 +32,29 @@ typedef struct Client {
     #if RUN_SSL
     SSL *ssl;
     bool isSSL;              // True if client is using SSL
+    bool ssl_want_write;     // Handshake waits for the socket to become writable
+    struct timeval ssl_start; // Time the handshake began, leaf minting included
     #endif 
 
     struct sockaddr_in addr;  // Client address
     struct timeval last_active; // Time of last activity
+    Timer timer;              // Idle/handshake/tunnel timeout, rearmed by Client_timestamp
+    unsigned long relayed;    // Relayed tunnel bytes seen at the last timeout
     socklen_t addr_l;         // Length of client address
     size_t buffer_l;          // Length of buffer
     size_t buffer_sz;         // Size of buffer
     char *buffer;             // Buffer for outgoing messages
+    OutQueue out;             // Bytes waiting for the client socket to become writable
+    TunnelBuf tunnel;         // Origin to client direction of a tunnel
+    struct timeval opened;    // Time the tunnel was established
+    bool upstream_paused;     // Upstream reads paused, out is above the high watermark
+    bool client_paused;       // Client reads paused, the query's out is above the high watermark
+    PoolTask *task;           // Offloaded stage in progress, client reads wait for it
     int socket;               // Client socket
     int state;                // State of client
     bool hasRequest;          // True if client has a request
+    size_t req_l;             // Length of that request at the front of buffer,
+                              // pipelined requests follow it
 } Client;
 
 Client *Client_new();
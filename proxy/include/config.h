@@ -33,6 +33,9 @@
 #define PROXY_EXT    "/workspaces/Development/http-proxy/etc/ext/eregion.proxy.ext"
 #define PROXY_PASSWD "friend"
 
+/* Kernel TLS, OpenSSL moves record encryption to the socket when loaded */
+#define KTLS_MODULE "/sys/module/tls"
+
 /* Client Certificate */
 #define CLIENT_CN     "eregion.client"
 #define CLIENT_CERT   "/workspaces/Development/http-proxy/etc/certs/eregion.client.crt"
@@ -49,6 +52,123 @@
 #define LISTEN_BACKLOG    10
 #define TIMEOUT_THRESHOLD 300 // 5 minutes
 
+/* Event Loop */
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#else
+#define HAVE_EPOLL 0
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#else
+#define HAVE_URING 0
+#endif
+
+#define EV_BACKEND_SELECT 0
+#define EV_BACKEND_EPOLL  1
+#define EV_BACKEND_URING  2
+
+#if HAVE_EPOLL
+#define DEFAULT_EV_BACKEND EV_BACKEND_EPOLL
+#else
+#define DEFAULT_EV_BACKEND EV_BACKEND_SELECT
+#endif
+
+#define EV_MAX_EVENTS 1024 // ready events returned per wait
+#define EV_INIT_FDS   1024 // initial size of per-fd tables, grows on demand
+
+/* Output Queues */
+#define OUTQ_CHUNK_SZ   16384  // minimum chunk allocation, small writes are coalesced
+#define OUTQ_MAX_IOV    64     // chunks handed to one writev
+#define OUTQ_HIGH_WATER 262144 // stop reading the other side above this many queued bytes
+#define OUTQ_LOW_WATER  65536  // resume reading once drained below this
+
+/* Tunnels */
+#ifdef __linux__
+#define HAVE_SPLICE 1
+#else
+#define HAVE_SPLICE 0
+#endif
+
+#define TUNNEL_PIPE_SZ    65536 // capacity asked for each spliced direction's pipe
+#define TUNNEL_RING_SZ    65536 // ring of a direction that is copied instead
+#define TUNNEL_HIGH_WATER 49152 // stop reading a sender with this many bytes pending
+#define TUNNEL_LOW_WATER  16384 // resume reading it once drained below this
+
+/* Accept */
+#define ACCEPT_BUDGET 64 // connections accepted per listener wakeup
+
+/* Workers */
+#define DEFAULT_WORKERS 1   // worker reactors, 0 means one per online CPU
+#define MAX_WORKERS     256
+
+/* io_uring Engine */
+#define URING_ENTRIES    256  // submission queue entries
+#define URING_CQ_ENTRIES 4096 // completion queue entries, multishot ops produce many
+#define URING_BUF_COUNT  256  // provided buffers shared by all tunnels
+#define URING_BUF_SZ     8192 // size of each provided buffer
+#define URING_BGID       1    // provided buffer group id
+
+/* DNS Resolver */
+#define DNS_RESOLV_CONF    "/etc/resolv.conf"
+#define DNS_HOSTS_FILE     "/etc/hosts"
+#define DNS_NAMESERVER_ENV "PROXY_NAMESERVER" // "addr" or "addr:port", overrides resolv.conf
+#define DNS_PORT           53
+#define DNS_PACKET_SZ      512  // largest UDP message without EDNS
+#define DNS_TIMEOUT_MS     2000 // wait before retransmitting a query
+#define DNS_TRIES          3    // transmissions before a lookup fails
+#define DNS_CACHE_BUCKETS  1024
+#define DNS_CACHE_MAX      4096 // cached hostnames, expired entries are purged when full
+#define DNS_MAX_TTL        3600 // cap on positive answers
+#define DNS_NEG_TTL        60   // NXDOMAIN or NODATA without an SOA record
+#define DNS_MAX_NEG_TTL    300  // cap on negative answers, RFC 2308
+#define DNS_FAIL_TTL       5    // SERVFAIL or no answer at all
+
+/* Upstream Connection Pool */
+#define UPSTREAM_MAX_IDLE      32 // idle origin connections kept per worker
+#define UPSTREAM_MAX_PER_HOST  4  // of those, to any one host, port and TLS
+#define UPSTREAM_IDLE_TIMEOUT  15 // seconds before an idle connection is closed
+#define UPSTREAM_KEY_MAX       (MAX_HOST_LENGTH + 16)
+
+/* Upstream TLS Sessions */
+#define SESSION_CACHE_SZ 256 // origins whose session is kept for resumption
+
+/* Origin Certificate Verification */
+#define VERIFY_CACHE_SZ  256  // leaf and hostname pairs whose outcome is kept
+#define VERIFY_CACHE_TTL 3600 // seconds a success is kept at most, before notAfter
+#define VERIFY_NEG_TTL   10   // seconds a failure is kept
+
+/* Intercepted TLS Sessions */
+#define TLS_SESSION_CACHE_SZ 20480 // client sessions resumable by session ID
+#define TLS_SESSION_TIMEOUT  7200  // seconds a client session or ticket is resumable
+#define TICKET_KEY_ROTATE    3600  // seconds a ticket key encrypts before the next
+#define TICKET_KEYS          3     // keys kept to decrypt, covers TLS_SESSION_TIMEOUT
+
+/* Leaf Certificates, minted per intercepted host and signed by the root CA */
+#define CERT_CACHE_SZ      1024    // leaves kept, the least recently used is dropped
+#define CERT_CACHE_BUCKETS 1024
+#define CERT_LEAF_CURVE    "P-256"
+#define CERT_LEAF_RSA      0       // 1 for RSA leaf keys of CERT_LEAF_RSA_BITS instead
+#define CERT_LEAF_RSA_BITS 2048
+#define KEY_POOL_SZ        64      // leaf keys generated ahead of new hosts
+#define CERT_STORE_PATH    "/workspaces/Development/http-proxy/etc/certs/intercept.store"
+#define CERT_STORE_SLOTS   16384   // hosts indexed in the store
+#define CERT_STORE_PROBE   8       // slots probed from a host's own
+#define CERT_STORE_MAX     (64 << 20) // bytes, the store is emptied past it
+#define CERT_LEAF_DAYS     365
+#define CERT_BACKDATE      3600    // seconds notBefore lies in the past
+
+/* Offload Pool */
+#ifdef __linux__
+#define HAVE_EVENTFD 1
+#else
+#define HAVE_EVENTFD 0
+#endif
+
+#define POOL_THREADS    2  // offload threads shared by all workers, 0 means one per online CPU
+#define POOL_DEQUE_INIT 64 // initial slots per thread deque, grows on demand
+
 /* Proxy Halt Signal */
 #define HALT         666 // Halt message
 #define PROXY_HALT   "__halt__"
@@ -62,6 +182,7 @@
 
 /* Proxy Cache */
 #define CACHE_SZ 10
+#define CACHE_OBJ_MAX (1 << 20) // largest response kept, bigger ones are only streamed
 
 /* HTTP ----------------------------------------------------------------------------------------- */
 #define HTTP_VERSION_1_1   "HTTP/1.1"
@@ -157,15 +278,31 @@
 #define CACHECONTROL_L  14
 #define MAXAGE          "max-age="
 #define MAXAGE_L        8
+#define TRANSFERENCODING   "transfer-encoding:"
+#define TRANSFERENCODING_L 18
+#define CHUNKED         "chunked"
+#define CONNECTION      "connection:"
+#define CONNECTION_L    11
+#define PROXY_CONNECTION   "proxy-connection:"
+#define PROXY_CONNECTION_L 17
+#define FRAME_LINE_MAX  256 /* longest status, field or chunk line kept while framing */
 
 /* Size Limits */
 #define MAX_METHOD_LENGTH 20
 #define MAX_PATH_LENGTH 2048
+#define PIPELINE_MAX    (64 * 1024) // pipelined request bytes read ahead of the one in flight
 #define MAX_HOST_LENGTH 255
 
 /* Timeouts */
 #define TUNNEL_TIMEOUT 60  // 60 seconds
 #define SSL_TIMEOUT 30     // 30 seconds
+#define KEEPALIVE_TIMEOUT 15 // idle client connection between requests
+
+/* Timer Wheel */
+#define TIMER_TICK_MS   100 // wheel resolution
+#define TIMER_LEVELS    4   // 64^4 ticks, about 19 days at 100 ms
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)
 
 /* Event Indicators */
 #define SERVER_CLOSE      4
@@ -206,6 +343,7 @@
 #define PARTIAL_MESSAGE     -25
 #define OVERFLOW_MESSAGE    -26
 #define FILTER_LIST_TOO_BIG -27
+#define ERROR_EVENT         -28
 
 /* Limits */
 #ifndef HOST_NAME_MAX
@@ -241,5 +379,8 @@
 #define QRY_RECVD_RESPONSE 2
 #define QRY_DONE           3
 #define QRY_TUNNEL         4
+#define QRY_CONNECTING     5 // non-blocking connect to the origin in progress
+#define QRY_HANDSHAKE      6 // TLS handshake with the origin in progress
+#define QRY_RESOLVING      7 // waiting on the resolver for the origin's address
 
 #endif /* __PROXYCONFIG_H__ */
@@ -0,0 +1,38 @@
+#ifndef _CONN_H_
+#define _CONN_H_
+
+#include "client.h"
+#include "config.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Connection Roles */
+#define CONN_NONE     0 // fd is not owned by the proxy
+#define CONN_LISTEN   1 // listening socket
+#define CONN_CLIENT   2 // client side of a connection
+#define CONN_UPSTREAM 3 // query socket to the origin server
+#define CONN_TUNNEL   4 // origin side of a CONNECT tunnel, the peer is the client
+#define CONN_WAKE     5 // read end of the worker wake-up pipe
+#define CONN_DNS      6 // resolver socket
+#define CONN_POOL     7 // completion queue of the offload pool
+
+typedef struct Conn {
+    Client *client; // Owning client, NULL for the listener
+    int role;       // CONN_* role of the fd
+} Conn;
+
+typedef struct ConnTable {
+    Conn *conns; // Indexed by fd
+    size_t size;
+} ConnTable;
+
+ConnTable *ConnTable_new(size_t size);
+void ConnTable_free(ConnTable **table);
+int ConnTable_set(ConnTable *table, int fd, Client *client, int role);
+Conn *ConnTable_get(ConnTable *table, int fd);
+void ConnTable_clear(ConnTable *table, int fd);
+
+#endif /* _CONN_H_ */
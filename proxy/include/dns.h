@@ -0,0 +1,78 @@
+#ifndef _DNS_H_
+#define _DNS_H_
+
+#include "config.h"
+#include "stats.h"
+#include "timer.h"
+#include "utility.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Resolver_lookup Results */
+#define DNS_FOUND   0 // address returned right away
+#define DNS_PENDING 1 // query in flight, the callback delivers the answer
+
+/* Called once per waiter when its lookup completes, status is DNS_FOUND or
+ * HOST_UNKNOWN. May free the waiter's owner. */
+typedef void (*DnsCallback)(void *data, int status, struct in_addr addr, void *arg);
+
+/* Cached answer, positive or negative */
+typedef struct DnsEntry {
+    struct DnsEntry *next; // Bucket chain
+    struct in_addr addr;
+    bool found;            // false for NXDOMAIN, NODATA and failed lookups
+    time_t expires;        // Monotonic seconds, 0 for /etc/hosts entries
+    char host[];
+} DnsEntry;
+
+typedef struct DnsWaiter {
+    struct DnsWaiter *next;
+    void *data;
+} DnsWaiter;
+
+/* Query in flight, shared by every request for the same hostname */
+typedef struct DnsLookup {
+    struct DnsLookup *next;
+    Timer timer;        // Retransmit timer
+    DnsWaiter *waiters;
+    uint16_t id;
+    int tries;          // Transmissions so far
+    size_t packet_l;
+    unsigned char packet[DNS_PACKET_SZ];
+    char host[];
+} DnsLookup;
+
+/* Non-blocking stub resolver speaking UDP to one nameserver. Each worker
+ * owns one, its socket is watched by the worker's event loop. */
+typedef struct Resolver {
+    int fd;                 // Connected UDP socket, -1 without a nameserver
+    struct sockaddr_in ns;
+    DnsEntry *buckets[DNS_CACHE_BUCKETS];
+    size_t nentries;
+    DnsLookup *lookups;     // In flight
+    TimerWheel timers;
+    DnsCallback done;
+    void *arg;
+} Resolver;
+
+Resolver *Resolver_new(DnsCallback done, void *arg);
+void Resolver_free(Resolver **resolver);
+int Resolver_lookup(Resolver *resolver, const char *host, struct in_addr *addr, void *data);
+void Resolver_cancel(Resolver *resolver, void *data);
+int Resolver_handle(Resolver *resolver);
+void Resolver_tick(Resolver *resolver);
+bool Resolver_nextTimeout(Resolver *resolver, struct timeval *timeout);
+
+#endif /* _DNS_H_ */
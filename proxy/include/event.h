@@ -0,0 +1,111 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include "config.h"
+#include "stats.h"
+#include "uring.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+/* Interest Flags */
+#define EV_READ   0x1
+#define EV_WRITE  0x2
+#define EV_ACCEPT 0x4 // listening socket, the io_uring engine accepts on it with multishot accept
+
+/* Readiness Flags */
+#define EV_CLOSED 0x8 // a relay run by the io_uring engine ended, the connection should be closed
+
+typedef struct Event {
+    int fd;     // Ready file descriptor
+    int events; // EV_READ and/or EV_WRITE
+} Event;
+
+#if HAVE_URING
+typedef struct UringFd {
+    unsigned int gen; // Bumped whenever the fd's in-flight requests are retired
+    int peer;         // Relay peer, -1 when the fd is not relayed by the engine
+    int send_len;     // Length of the relay send in flight from this fd
+    bool armed;       // One-shot poll in flight
+    bool connecting;  // Connect in flight, polls wait for it
+    int connect_err;  // errno of the last completed connect, 0 on success
+    bool accepting;   // Multishot accept in flight
+    bool queued;      // On the rearm list
+    bool starved;     // On the starved list
+    unsigned long relayed; // Bytes relayed from this fd
+} UringFd;
+#endif
+
+typedef struct EventLoop {
+    int backend; // EV_BACKEND_SELECT, EV_BACKEND_EPOLL or EV_BACKEND_URING
+
+    /* select backend */
+    fd_set master_rd;
+    fd_set master_wr;
+    fd_set readfds;
+    fd_set writefds;
+    int fdmax;
+
+    /* epoll backend */
+#if HAVE_EPOLL
+    struct epoll_event *ep_events;
+#endif
+    int epfd;
+
+    /* io_uring backend */
+#if HAVE_URING
+    Uring ring;
+    UringFd *ufds;  // Engine state indexed by fd
+    int *rearm;     // fds whose one-shot poll fired and needs re-arming
+    int nrearm;
+    int *starved;   // relayed fds whose recv ran out of provided buffers
+    int nstarved;
+    int *accepted;  // fds accepted by multishot accept, not yet handed out
+    int naccepted;
+    int accepted_head;
+    int accepted_sz;
+    int accept_err; // errno of a failed accept, reported once the queue is empty
+    int listen_fd;
+    char *bufs;     // Provided buffer pool, URING_BUF_COUNT * URING_BUF_SZ
+#endif
+
+    int *interest;            // Registered events indexed by fd, -1 if unregistered
+    unsigned char *ready_map; // Ready events indexed by fd for the current iteration
+    size_t map_sz;            // Number of fds covered by interest and ready_map
+
+    Event *ready; // Ready events for the current iteration
+    int nready;
+    int max_events;
+} EventLoop;
+
+EventLoop *EventLoop_new(int backend);
+void EventLoop_free(EventLoop **loop);
+int EventLoop_add(EventLoop *loop, int fd, int events);
+int EventLoop_modify(EventLoop *loop, int fd, int events);
+int EventLoop_remove(EventLoop *loop, int fd);
+int EventLoop_wait(EventLoop *loop, struct timeval *timeout);
+bool EventLoop_isReadable(EventLoop *loop, int fd);
+bool EventLoop_isWritable(EventLoop *loop, int fd);
+bool EventLoop_isClosed(EventLoop *loop, int fd);
+int EventLoop_accept(EventLoop *loop, int listen_fd, struct sockaddr *addr, socklen_t *addr_l);
+int EventLoop_connect(EventLoop *loop, int fd, const struct sockaddr *addr, socklen_t addr_l);
+int EventLoop_connectError(EventLoop *loop, int fd);
+int EventLoop_relay(EventLoop *loop, int fd_a, int fd_b);
+unsigned long EventLoop_relayed(EventLoop *loop, int fd);
+int EventLoop_parseBackend(const char *name);
+const char *EventLoop_backendName(int backend);
+
+#endif /* _EVENT_H_ */
@@ -6,10 +6,13 @@
 #include "utility.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/types.h>
 
 
 typedef struct Request {
@@ -29,6 +32,7 @@ typedef struct Request {
     size_t body_l;
     size_t raw_l;
     int type;  // Type of request (GET, POST, etc.)
+    bool keep_alive; // client keeps the connection open for its next request
 
 } Request;
 
@@ -39,6 +43,7 @@ typedef struct Response {
     char *cache_ctrl; /* Cache-Control header field. */
     char *body;       /* body of the response message. */
     char *raw;        /* original "raw" response message. */
+    char *head;       /* header block without Age, set once cacheable. */
 
     long max_age;          /* max-age value from Cache-Control header. */
     size_t content_length; /* Content-Length value from header. */
@@ -49,10 +54,41 @@ typedef struct Response {
     size_t cache_ctrl_l;
     size_t body_l;
     size_t raw_l;
+    size_t head_l;
+    size_t tail_off; /* offset in raw of the blank line ending the header. */
+    int refs;        /* holders, changed with atomics, freed at zero. */
 } Response;
 
+/* Response framing states, RFC 7230 section 3.3.3 */
+#define FRAME_STATUS   0 /* status line */
+#define FRAME_HEADER   1 /* header fields */
+#define FRAME_BODY     2 /* Content-Length body */
+#define FRAME_SIZE     3 /* chunk size line */
+#define FRAME_DATA     4 /* chunk data */
+#define FRAME_DATA_END 5 /* CRLF after the chunk data */
+#define FRAME_TRAILER  6 /* trailer fields after the last chunk */
+#define FRAME_CLOSE    7 /* body ends when the origin closes */
+#define FRAME_DONE     8
+
+/* Tracks where a response ends as its bytes are received, whatever slices
+ * they arrive in, so neither the message nor its header must be buffered. */
+typedef struct ResponseFrame {
+    int state;
+    int status;         /* status code of the response being framed. */
+    bool head;          /* response to HEAD, which never has a body. */
+    bool coded;         /* Transfer-Encoding present. */
+    bool chunked;       /* chunked is the final transfer coding. */
+    bool has_length;    /* Content-Length present. */
+    bool keep_alive;    /* origin keeps the connection open afterwards. */
+    size_t length;      /* Content-Length value. */
+    size_t left;        /* bytes of the body or chunk still expected. */
+    size_t line_l;      /* bytes of the current line, may exceed line. */
+    char line[FRAME_LINE_MAX];
+} ResponseFrame;
+
 /* HTTP Functions */
 bool HTTP_got_header(char *buffer);
+ssize_t HTTP_request_length(char *buffer, size_t buffer_l);
 int HTTP_add_field(char **buffer, size_t *buffer_l, char *field, char *value);
 
 /* HTTP Request Functions */
@@ -67,12 +103,20 @@ int Request_compare(void *req1, void *req2);
 /* HTTP Response Functions */
 Response *Response_new(char *method, size_t method_l, char *uri, size_t uri_l, char *msg, size_t msg_l);
 void Response_free(void *response);
+Response *Response_hold(Response *response);
+int Response_freeze(Response *response);
 unsigned long Response_size(Response *response);
 char *Response_get(Response *response);
 void Response_print(void *response);
 int Response_compare(void *response1, void *response2);
 Response *Response_copy(Response *response);
 
+/* HTTP Response Framing Functions */
+void ResponseFrame_init(ResponseFrame *frame, bool head);
+ssize_t ResponseFrame_feed(ResponseFrame *frame, const char *buf, size_t len);
+bool ResponseFrame_done(ResponseFrame *frame);
+bool ResponseFrame_eof(ResponseFrame *frame);
+
 /* HTTP Raw String Functions */
 char *Raw_request(char *method, char *url, char *host, char *port, char *body, size_t *raw_l);
 
@@ -0,0 +1,36 @@
+#ifndef _KEYPOOL_H_
+#define _KEYPOOL_H_
+
+#include "config.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#if RUN_SSL
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+/* Leaf keys generated ahead of use by a background thread, so minting a
+ * certificate for a new host only costs its signature. The thread sleeps
+ * while KEY_POOL_SZ keys are ready and refills as they are taken. */
+typedef struct KeyPool {
+    EVP_PKEY *keys[KEY_POOL_SZ];
+    size_t count;           // Ready keys, under lock
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    // Signaled when a key is taken or on stop
+    pthread_t thread;
+    bool started;           // Refill thread running, set by KeyPool_init
+    bool stop;
+} KeyPool;
+
+int KeyPool_init(KeyPool *pool);
+void KeyPool_free(KeyPool *pool);
+EVP_PKEY *KeyPool_take(KeyPool *pool);
+#endif
+
+#endif /* _KEYPOOL_H_ */
@@ -0,0 +1,53 @@
+#ifndef _OUTQ_H_
+#define _OUTQ_H_
+
+#include "config.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if RUN_SSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+typedef struct OutChunk {
+    struct OutChunk *next;
+    size_t len;                 // Bytes stored in data
+    size_t off;                 // Bytes of data already sent
+    size_t cap;                 // Size of data
+    const char *ref;            // Bytes queued by reference instead of data
+    void (*release)(void *arg); // Called with arg once ref is sent or dropped
+    void *arg;
+    char data[];
+} OutChunk;
+
+/* Bytes waiting to be written to a non-blocking socket, flushed whenever the
+ * socket is writable. */
+typedef struct OutQueue {
+    OutChunk *head;
+    OutChunk *tail;
+    OutChunk *pinned; // Chunk of an SSL_write to retry, must not grow
+    size_t size;      // Bytes queued and not yet sent
+} OutQueue;
+
+void OutQueue_init(OutQueue *q);
+void OutQueue_clear(OutQueue *q);
+int OutQueue_push(OutQueue *q, const char *buf, size_t len);
+int OutQueue_pushRef(OutQueue *q, const char *buf, size_t len, void (*release)(void *), void *arg);
+ssize_t OutQueue_flush(OutQueue *q, int fd);
+#if RUN_SSL
+ssize_t OutQueue_flushSSL(OutQueue *q, SSL *ssl);
+#endif
+size_t OutQueue_size(OutQueue *q);
+bool OutQueue_isEmpty(OutQueue *q);
+
+#endif /* _OUTQ_H_ */
@@ -0,0 +1,76 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include "config.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+struct PoolQueue;
+
+/* Offloaded job. work runs on a pool thread, then done runs on the reactor
+ * that submitted the task, with cancelled set if the submitter gave up on
+ * it meanwhile. done always runs and owns arg. */
+typedef struct PoolTask {
+    struct PoolTask *next;        // Completion queue link
+    void (*work)(void *arg);
+    void (*done)(void *arg, bool cancelled);
+    void *arg;
+    struct PoolQueue *queue;      // Completion queue of the submitter
+    int cancelled;                // Set with atomics by Pool_cancel
+} PoolTask;
+
+/* Per-thread deque, the owner pops the newest task from the bottom and idle
+ * threads steal the oldest one from the top */
+typedef struct PoolDeque {
+    pthread_mutex_t lock;
+    PoolTask **tasks; // Ring of cap slots
+    size_t top;
+    size_t bottom;
+    size_t cap;
+} PoolDeque;
+
+/* Completion queue of one reactor, its eventfd turns readable when tasks
+ * completed */
+typedef struct PoolQueue {
+    pthread_mutex_t lock;
+    PoolTask *head;
+    PoolTask *tail;
+    int efd;    // eventfd, or the read end of a pipe without eventfd
+    int wr_fd;  // same as efd with eventfd, else the write end of the pipe
+} PoolQueue;
+
+typedef struct Pool {
+    pthread_t *threads;
+    PoolDeque *deques;
+    int nthreads;            // Threads started
+    int ndeques;             // One deque per requested thread
+    unsigned int next;       // Round-robin submission target
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    size_t queued;           // Tasks waiting in the deques, under idle_lock
+    bool stop;
+} Pool;
+
+Pool *Pool_new(int nthreads);
+void Pool_free(Pool **pool);
+PoolTask *Pool_submit(Pool *pool, PoolQueue *queue, void (*work)(void *), void (*done)(void *, bool), void *arg);
+void Pool_cancel(PoolTask *task);
+
+int PoolQueue_init(PoolQueue *queue);
+void PoolQueue_free(PoolQueue *queue);
+int PoolQueue_drain(PoolQueue *queue);
+
+#endif /* _POOL_H_ */
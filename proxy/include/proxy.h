@@ -2,8 +2,18 @@
 #define _PROXY_H_
 
 #include "config.h"
+#include "certs.h"
 #include "client.h"
 #include "colors.h"
+#include "conn.h"
+#include "dns.h"
+#include "event.h"
+#include "pool.h"
+#include "session.h"
+#include "stats.h"
+#include "timer.h"
+#include "upstream.h"
+#include "verify.h"
 
 #include "http.h"
 #include "list.h"
@@ -19,6 +29,8 @@
 #include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -34,31 +46,58 @@
 #include <openssl/err.h>
 #endif 
 
-typedef struct Proxy {
-#if RUN_CACHE 
-        Cache *cache;
-#endif 
+struct Proxy;
+
+/* State shared by all workers. The cache is only touched with its lock held. */
+typedef struct ProxyShared {
+#if RUN_CACHE
+    Cache *cache;
+    pthread_mutex_t cache_lock;
+#endif
 #if RUN_SSL
-        SSL_CTX *ctx;
+    SSL_CTX *ctx;              // Server side, never replaced
+    CertCache certs;           // Leaves set on its connections per host
+    TicketKeys tickets;        // Its session ticket keys, rotated
+    SSL_CTX *upstream_ctx;     // Client side for origins, never replaced
+    SessionCache sessions;     // Sessions to resume per origin host and port
+    VerifyCache verified;      // Outcomes of verifying origin certificates
 #endif
+    Pool *pool;           // Offload threads for CPU-heavy or blocking stages
+    struct Proxy *workers;
+    int nworkers;
+    int halt; // Set once any worker halts, read with atomics
+} ProxyShared;
+
+typedef struct Proxy {
+    ProxyShared *shared;
 #if RUN_FILTER
     char *filters[MAX_FILTERS];
     int num_filters;
 #endif
 
     List *client_list;
+    EventLoop *loop;
+    ConnTable *conns;
+    TimerWheel timers;
+    Resolver *resolver;
+    UpstreamPool upstreams;    // Idle origin connections of this worker
+    PoolQueue completions;     // Offloaded tasks done, their callbacks run on this worker
 
     struct sockaddr_in addr;
-    struct timeval *timeout;
-    fd_set master_set;
-    fd_set readfds;
-    int fdmax;
+    struct timeval *timeout;   // Points at timeout_tv, NULL when no timer is scheduled
+    struct timeval timeout_tv;
+    pthread_t thread;
+    int id;         // Worker index
+    int backend;
     int listen_fd;
+    bool listen_paused; // Out of descriptors, accepting resumes once a client closes
+    int wake_rd;    // Read end of the pipe used to wake the worker on halt
+    int wake_wr;
     short port;
 } Proxy;
 
-int Proxy_run(short port);
-int Proxy_init(Proxy *proxy, short port);
+int Proxy_run(short port, int backend, int workers);
+int Proxy_init(Proxy *proxy, short port, int backend, ProxyShared *shared);
 void Proxy_free(void *proxy);
 void Proxy_print(Proxy *proxy);
 
@@ -68,7 +107,7 @@ ssize_t Proxy_send(int socket, char *buffer, size_t buffer_l);
 ssize_t Proxy_recv(void *sender, int sender_type);
 int Proxy_sendError(Client *client, int msg_code);
 ssize_t Proxy_fetch(Proxy *proxy, Query *request);
-void Proxy_close(int socket, fd_set *master_set, List *client_list, Client *client);
+void Proxy_close(Proxy *proxy, Client *client);
 
 int Proxy_handle(Proxy *proxy);
 int Proxy_handleListener(Proxy *proxy);
@@ -79,7 +118,8 @@ int Proxy_handleEvent(Proxy *proxy, Client *client, int error_code);
 int Proxy_handleGET(Proxy *proxy, Client *client);
 int Proxy_handleCONNECT(Proxy *proxy, Client *client);
 int Proxy_serveFromCache(Proxy *proxy, Client *client, long age, char *key);
-int Proxy_handleTunnel(int sender, int receiver);
+int Proxy_handleTunnel(Proxy *proxy, Client *client, bool from_client);
+int Proxy_write(Proxy *proxy, Client *client, char *buf, size_t len);
 int Proxy_sendServerResp(Proxy *proxy, Client *client);
 
 #if RUN_FILTER
@@ -95,8 +135,6 @@ void Proxy_freeFilters(Proxy *proxy);
     int ProxySSL_write(Proxy *proxy, Client *client, char *buf, int len);
     int ProxySSL_shutdown(Proxy *proxy, Client *client);
     int ProxySSL_read(void *sender, int sender_type);
-    int ProxySSL_updateExtFile(Proxy *proxy, char *hostname);
-    int ProxySSL_updateContext(Proxy *proxy);
 #endif 
 
 #endif /* _PROXY_H_ */
@@ -3,6 +3,8 @@
 
 #include "config.h"
 #include "http.h"
+#include "outq.h"
+#include "tunnel.h"
 #include "utility.h"
 
 #include <arpa/inet.h>
@@ -30,16 +32,24 @@ typedef struct Query {
     #if RUN_SSL
         SSL *ssl;
         SSL_CTX *ctx;
+        bool ssl_want_write; // Read waits for the socket to become writable
     #endif 
 
     struct sockaddr_in server_addr;
-    struct hostent *host_info;
     struct timeval timestamp;
     socklen_t server_addr_l;
     int socket;
+    OutQueue out;   // Bytes waiting for the upstream socket
+    TunnelBuf tunnel; // Client to origin direction of a tunnel
     char *buffer;
     size_t buffer_l;
     size_t buffer_sz;
+    size_t fwd_l;      // Bytes of buffer already queued for the client
+    ResponseFrame frame; // Where the response ends
+    bool cache_skip;   // Response outgrew CACHE_OBJ_MAX, buffer only holds
+                       // bytes in transit
+    bool reused;       // Connection borrowed from the upstream pool
+    bool no_pool;      // Retrying after a pooled connection failed, connect fresh
     int gotHeader;
     int bytes_left;
     int state;
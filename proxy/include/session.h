@@ -0,0 +1,61 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include "config.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if RUN_SSL
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+/* Session to resume with one origin */
+typedef struct SessionSlot {
+    SSL_SESSION *session;       // NULL if the slot is empty
+    char key[UPSTREAM_KEY_MAX]; // "host:port"
+} SessionSlot;
+
+/* TLS sessions of the upstream connections, shared by all workers. Slots
+ * are direct-mapped by the hash of host and port, a session for another
+ * origin hashing to the same slot replaces the one in it. */
+typedef struct SessionCache {
+    SessionSlot slots[SESSION_CACHE_SZ];
+    pthread_mutex_t lock;
+} SessionCache;
+
+/* Session ticket key, names the tickets it protects */
+typedef struct TicketKey {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    time_t created;             // 0 if the key was never generated
+} TicketKey;
+
+/* Ticket keys of the intercepted connections. The server side context is
+ * shared by all workers, a ticket issued by one is accepted by any. The
+ * newest key encrypts, the previous TICKET_KEYS - 1 still decrypt. */
+typedef struct TicketKeys {
+    TicketKey keys[TICKET_KEYS];
+    int current;                // Key encrypting new tickets
+    pthread_mutex_t lock;
+} TicketKeys;
+
+int SessionCache_init(SessionCache *cache, SSL_CTX *ctx);
+void SessionCache_free(SessionCache *cache);
+bool SessionCache_prepare(SessionCache *cache, SSL *ssl, const char *host, const char *port);
+
+int TicketKeys_init(TicketKeys *keys, SSL_CTX *ctx);
+void TicketKeys_free(TicketKeys *keys);
+#endif
+
+#endif /* _SESSION_H_ */
@@ -0,0 +1,59 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "colors.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Process-wide counters, updated with relaxed atomics so any thread may bump
+ * them. Printed when the proxy shuts down and on SIGUSR1. */
+typedef struct Stats {
+    unsigned long loop_syscalls; // waits and registrations made by the event loop
+    unsigned long io_syscalls;   // accept/recv/send calls made by the handlers
+    unsigned long events;        // ready events dispatched
+    unsigned long uring_sqes;    // SQEs submitted by the io_uring engine
+    unsigned long uring_cqes;    // CQEs reaped by the io_uring engine
+    unsigned long tunnel_bytes;  // bytes relayed through CONNECT tunnels
+    unsigned long splice_bytes;  // of those, bytes spliced without a copy to user space
+    unsigned long tunnels;       // tunnels closed
+    unsigned long tunnel_usec;   // summed lifetime of the closed tunnels
+    unsigned long ktls_conns;    // TLS connections whose sends the kernel encrypts
+    unsigned long dns_queries;   // DNS queries sent, retransmits included
+    unsigned long dns_hits;      // lookups answered by the resolver cache
+    unsigned long dns_joined;    // lookups that joined a query already in flight
+    unsigned long pool_tasks;    // tasks submitted to the offload pool
+    unsigned long pool_steals;   // tasks run by a thread that stole them
+    unsigned long cache_skips;   // streamed responses too large to be cached
+    unsigned long upstream_reuses; // requests sent on a pooled origin connection
+    unsigned long upstream_stale;  // pooled connections the origin closed while idle
+    unsigned long client_reuses;   // requests read on an already used client connection
+    unsigned long tls_handshakes;  // TLS handshakes completed with origins
+    unsigned long tls_offered;     // of those attempted, sessions offered for resumption
+    unsigned long tls_resumed;     // handshakes that resumed a session
+    unsigned long verify_hits;     // origin chains trusted from the verification cache
+    unsigned long verify_fails;    // origin chains rejected from it
+    unsigned long client_tls;      // TLS handshakes completed with intercepted clients
+    unsigned long client_resumed;  // of those, resumed from a session or ticket
+    unsigned long client_tls_usec; // summed duration of those handshakes
+    unsigned long client_tls_timeouts; // handshakes cut off by SSL_TIMEOUT
+    unsigned long ticket_rotations; // session ticket keys generated
+    unsigned long certs_minted;    // leaf certificates signed for intercepted hosts
+    unsigned long cert_hits;       // intercepted handshakes served a cached leaf
+    unsigned long cert_loads;      // leaves loaded from the on-disk store
+    unsigned long keys_pooled;     // leaf keys generated by the refill thread
+    unsigned long keygen_usec;     // time it spent generating them
+    unsigned long key_pool_depth;  // keys ready now, a gauge
+    unsigned long key_pool_misses; // leaves minted while the pool was empty
+} Stats;
+
+extern Stats proxy_stats;
+
+#define STATS_ADD(field, n) __atomic_fetch_add(&proxy_stats.field, (n), __ATOMIC_RELAXED)
+#define STATS_SUB(field, n) __atomic_fetch_sub(&proxy_stats.field, (n), __ATOMIC_RELAXED)
+#define STATS_GET(field)    __atomic_load_n(&proxy_stats.field, __ATOMIC_RELAXED)
+
+void Stats_print(FILE *fp);
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,44 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "config.h"
+#include "utility.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+struct TimerWheel;
+
+/* Intrusive timer, embedded in the object it times out. */
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer *prev;
+    struct TimerWheel *wheel; // Wheel the timer is scheduled on, NULL if idle
+    unsigned long expires;    // Deadline in ticks
+    unsigned long timeout;    // Ticks added to the current tick by Timer_touch
+    void *data;               // Owner, passed to the expiry callback
+} Timer;
+
+/* Hierarchical timer wheel: level l has TIMER_SLOTS slots, each covering
+ * TIMER_SLOTS^l ticks. Timers on upper levels cascade down as the wheel turns
+ * and fire from level 0. */
+typedef struct TimerWheel {
+    Timer slots[TIMER_LEVELS][TIMER_SLOTS]; // Sentinel heads of the slot lists
+    unsigned long now;                      // Current tick
+    size_t count;                           // Scheduled timers
+} TimerWheel;
+
+void TimerWheel_init(TimerWheel *wheel);
+int TimerWheel_advance(TimerWheel *wheel, void (*expire)(void *data, void *arg), void *arg);
+bool TimerWheel_nextTimeout(TimerWheel *wheel, struct timeval *timeout);
+
+void Timer_init(Timer *timer, void *data);
+void Timer_schedule(TimerWheel *wheel, Timer *timer, unsigned long timeout_ms);
+void Timer_touch(Timer *timer);
+void Timer_cancel(Timer *timer);
+bool Timer_isScheduled(Timer *timer);
+
+#endif /* _TIMER_H_ */
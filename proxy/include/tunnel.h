@@ -0,0 +1,42 @@
+#ifndef _TUNNEL_H_
+#define _TUNNEL_H_
+
+#include "config.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* One direction of a CONNECT tunnel. Its bytes are spliced through a pipe,
+ * socket to pipe to socket without a copy to user space, or where splice is
+ * unavailable received into and sent from a ring buffer. */
+typedef struct TunnelBuf {
+    int rd;       // Pipe read end, -1 when the direction uses the ring
+    int wr;       // Pipe write end
+    char *ring;   // TUNNEL_RING_SZ bytes, NULL when spliced
+    size_t head;  // Offset of the first pending byte in ring
+    size_t len;   // Bytes pending for the receiver, in the pipe or the ring
+    bool paused;  // Sender not read, set above the high watermark or on a full
+                  // pipe, cleared once drained below the low watermark
+    bool eof;     // Sender reached end of file
+    bool shut;    // Receiver shut down for writing, after eof drained
+} TunnelBuf;
+
+void TunnelBuf_init(TunnelBuf *tb);
+int TunnelBuf_open(TunnelBuf *tb);
+int TunnelBuf_openRing(TunnelBuf *tb);
+void TunnelBuf_close(TunnelBuf *tb);
+bool TunnelBuf_isOpen(TunnelBuf *tb);
+bool TunnelBuf_isSpliced(TunnelBuf *tb);
+ssize_t TunnelBuf_fill(TunnelBuf *tb, int fd);
+ssize_t TunnelBuf_drain(TunnelBuf *tb, int fd);
+
+#endif /* _TUNNEL_H_ */
@@ -0,0 +1,48 @@
+#ifndef _UPSTREAM_H_
+#define _UPSTREAM_H_
+
+#include "config.h"
+#include "query.h"
+#include "stats.h"
+#include "timer.h"
+#include "utility.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/* Idle connection to an origin, kept for the next request to it */
+typedef struct Upstream {
+    struct Upstream *next;       // Pool list, most recently returned first
+    struct Upstream *prev;
+    Timer timer;                 // Idle timeout
+    int socket;
+#if RUN_SSL
+    SSL *ssl;                    // Session with the origin, NULL for plain HTTP
+#endif
+    char key[UPSTREAM_KEY_MAX];  // "host:port", suffixed with "+tls"
+} Upstream;
+
+/* Idle upstream connections of one worker, keyed by host, port and TLS.
+ * They are not watched by the event loop, a health check on reuse finds
+ * those the origin closed meanwhile. */
+typedef struct UpstreamPool {
+    Upstream head;   // Sentinel of the pool list, its tail is the oldest
+    TimerWheel timers;
+    size_t count;
+} UpstreamPool;
+
+void UpstreamPool_init(UpstreamPool *pool);
+void UpstreamPool_free(UpstreamPool *pool);
+int UpstreamPool_borrow(UpstreamPool *pool, Query *query, bool tls);
+int UpstreamPool_return(UpstreamPool *pool, Query *query, bool tls);
+void UpstreamPool_tick(UpstreamPool *pool);
+bool UpstreamPool_nextTimeout(UpstreamPool *pool, struct timeval *timeout);
+
+#endif /* _UPSTREAM_H_ */
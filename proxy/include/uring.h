@@ -0,0 +1,69 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include "config.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if HAVE_URING
+#include <linux/io_uring.h>
+
+/* Minimal io_uring wrapper built directly on the io_uring_setup and
+ * io_uring_enter syscalls, so the proxy does not depend on liburing. */
+typedef struct Uring {
+    int fd;
+
+    /* submission queue */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sqe_tail; // Local tail, published to the kernel on submit
+    unsigned int sq_entries;
+
+    /* completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_map_sz;
+    size_t cq_map_sz;
+    size_t sqes_map_sz;
+    unsigned int features;
+
+    unsigned long enters; // io_uring_enter syscalls made
+    unsigned long sqes_submitted;
+} Uring;
+
+int Uring_init(Uring *ring, unsigned int entries, unsigned int cq_entries);
+void Uring_free(Uring *ring);
+struct io_uring_sqe *Uring_getSqe(Uring *ring);
+int Uring_reserve(Uring *ring, unsigned int n);
+int Uring_submit(Uring *ring);
+int Uring_wait(Uring *ring, struct timeval *timeout);
+struct io_uring_cqe *Uring_peekCqe(Uring *ring);
+void Uring_seenCqe(Uring *ring);
+
+void Uring_prepPollAdd(struct io_uring_sqe *sqe, int fd, unsigned int mask, unsigned long long data);
+void Uring_prepCancel(struct io_uring_sqe *sqe, unsigned long long target, unsigned long long data);
+void Uring_prepAccept(struct io_uring_sqe *sqe, int fd, int flags, unsigned long long data);
+void Uring_prepRecv(struct io_uring_sqe *sqe, int fd, size_t len, int bgid, unsigned long long data);
+void Uring_prepSend(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, unsigned long long data);
+void Uring_prepConnect(struct io_uring_sqe *sqe, int fd, const void *addr, unsigned int addr_l,
+                       unsigned long long data);
+void Uring_prepProvide(struct io_uring_sqe *sqe, void *addr, size_t len, int nbufs, int bgid, int bid,
+                       unsigned long long data);
+#endif /* HAVE_URING */
+
+#endif /* _URING_H_ */
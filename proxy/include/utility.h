@@ -50,6 +50,7 @@ int LoadClientCertificates(SSL_CTX *ctx, char *cert_file, char *key_file); // ,
 int LoadCertificates(SSL_CTX *ctx, char *cert_file, char *key_file); // , char *passwd);
 SSL_CTX *InitServerCTX();
 SSL_CTX *InitCTX();
+void EnableKTLS(SSL_CTX *ctx);
 void ShowCerts(SSL *ssl);
 
 int isRoot();
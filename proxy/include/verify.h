@@ -0,0 +1,43 @@
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include "config.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if RUN_SSL
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+
+/* Verification outcome for one origin certificate and hostname */
+typedef struct VerifySlot {
+    unsigned char fingerprint[32];  // SHA-256 of the leaf
+    char host[MAX_HOST_LENGTH + 1];
+    time_t expires;                 // 0 if the slot is empty
+    int error;                      // X509_V_OK, or why verification failed
+} VerifySlot;
+
+/* Outcomes of verifying origin certificates, shared by all workers. A
+ * success is kept until the first certificate of the chain expires, a
+ * failure for VERIFY_NEG_TTL seconds. Slots are direct-mapped by leaf and
+ * hostname, another pair hashing to the same slot replaces the one in it. */
+typedef struct VerifyCache {
+    VerifySlot slots[VERIFY_CACHE_SZ];
+    pthread_mutex_t lock;
+} VerifyCache;
+
+int VerifyCache_init(VerifyCache *cache, SSL_CTX *ctx);
+void VerifyCache_free(VerifyCache *cache);
+#endif
+
+#endif /* _VERIFY_H_ */
@@ -0,0 +1,409 @@
+#include "certs.h"
+
+#if RUN_SSL
+static int servername(SSL *ssl, int *alert, void *arg);
+static int load_ca(CertCache *cache);
+static bool is_ip(const char *host);
+static bool valid_host(const char *host);
+static CertEntry *stored(CertCache *cache, const char *host);
+static CertEntry *mint(CertCache *cache, const char *host);
+static int add_ext(X509 *cert, X509 *issuer, int nid, const char *value);
+static CertEntry *lookup(CertCache *cache, const char *host, size_t bucket);
+static void lru_unlink(CertCache *cache, CertEntry *e);
+static void lru_push(CertCache *cache, CertEntry *e);
+static void evict(CertCache *cache);
+static CertEntry *entry_new(const char *host);
+static void entry_free(CertEntry *e);
+
+/* CertCache_init
+ *    Purpose: Loads the root CA once and has the server side context pick
+ *             each handshake's leaf by the name the client asks for (SNI).
+ *             Without the root CA the proxy still runs, but intercepted
+ *             handshakes fail.
+ * Parameters: @cache - Pointer to the CertCache
+ *             @ctx - Context the intercepted connections are created from
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE.
+ */
+int CertCache_init(CertCache *cache, SSL_CTX *ctx)
+{
+    if (cache == NULL || ctx == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(cache, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+
+    if (load_ca(cache) != EXIT_SUCCESS) {
+        print_warning("certs: failed to load the root CA, intercepted hosts get no certificate");
+    } else if (KeyPool_init(&cache->keys) != EXIT_SUCCESS) {
+        return ERROR_FAILURE;
+    } else if (CertStore_open(&cache->store, CERT_STORE_PATH) != EXIT_SUCCESS) {
+        print_warning("certs: failed to open the certificate store, leaves are minted again after a restart");
+    }
+
+    SSL_CTX_set_tlsext_servername_callback(ctx, servername);
+    SSL_CTX_set_tlsext_servername_arg(ctx, cache);
+
+    return EXIT_SUCCESS;
+}
+
+/* CertCache_free
+ *    Purpose: Frees the cached leaves and the root CA.
+ */
+void CertCache_free(CertCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    KeyPool_free(&cache->keys);
+    CertStore_close(&cache->store);
+    while (cache->lru_tail != NULL) {
+        evict(cache);
+    }
+    X509_free(cache->ca);
+    EVP_PKEY_free(cache->ca_key);
+    cache->ca     = NULL;
+    cache->ca_key = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/* CertCache_use
+ *    Purpose: Sets the leaf for host on a connection about to handshake,
+ *             minting it on first contact. Minting runs outside the lock, two
+ *             threads minting the same host keep the first leaf inserted.
+ * Parameters: @cache - Pointer to the CertCache
+ *             @ssl - Intercepted connection
+ *             @host - Name the client connects to, a hostname or IP literal
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if host is invalid or its leaf
+ *             could not be minted.
+ */
+int CertCache_use(CertCache *cache, SSL *ssl, const char *host)
+{
+    if (cache == NULL || ssl == NULL || host == NULL || strlen(host) > MAX_HOST_LENGTH) {
+        return ERROR_FAILURE;
+    }
+
+    /* names are case-insensitive, leaves are keyed lower cased */
+    char name[MAX_HOST_LENGTH + 1];
+    size_t i;
+    for (i = 0; host[i] != '\0'; i++) {
+        name[i] = tolower((unsigned char)host[i]);
+    }
+    name[i] = '\0';
+    if (!valid_host(name)) {
+        return ERROR_FAILURE;
+    }
+    size_t bucket = hash_foo((unsigned char *)name) % CERT_CACHE_BUCKETS;
+
+    pthread_mutex_lock(&cache->lock);
+    CertEntry *e = lookup(cache, name, bucket);
+    if (e != NULL) {
+        STATS_ADD(cert_hits, 1);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    CertEntry *minted = NULL;
+    if (e == NULL && (minted = stored(cache, name)) == NULL) {
+        minted = mint(cache, name);
+        if (minted == NULL) {
+            return ERROR_FAILURE;
+        }
+        STATS_ADD(certs_minted, 1);
+        CertStore_save(&cache->store, name, minted->cert, minted->key);
+    }
+
+    /* hold the leaf, it may be evicted once the lock is released */
+    pthread_mutex_lock(&cache->lock);
+    if (minted != NULL) {
+        e = lookup(cache, name, bucket);
+        if (e != NULL) {
+            entry_free(minted);
+        } else {
+            e = minted;
+            e->next = cache->buckets[bucket];
+            cache->buckets[bucket] = e;
+            lru_push(cache, e);
+            if (++cache->count > CERT_CACHE_SZ) {
+                evict(cache);
+            }
+        }
+    }
+    X509 *cert = e->cert;
+    EVP_PKEY *key = e->key;
+    X509_up_ref(cert);
+    EVP_PKEY_up_ref(key);
+    pthread_mutex_unlock(&cache->lock);
+
+    int ret = (SSL_use_certificate(ssl, cert) == 1 && SSL_use_PrivateKey(ssl, key) == 1) ? EXIT_SUCCESS
+                                                                                          : ERROR_FAILURE;
+    X509_free(cert);
+    EVP_PKEY_free(key);
+
+    return ret;
+}
+
+/* servername
+ *    Purpose: SNI callback, switches the handshake to the leaf of the name
+ *             the client asked for. Without SNI the leaf set for the CONNECT
+ *             host stays.
+ */
+static int servername(SSL *ssl, int *alert, void *arg)
+{
+    const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (host == NULL) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    if (CertCache_use((CertCache *)arg, ssl, host) != EXIT_SUCCESS) {
+        *alert = SSL_AD_INTERNAL_ERROR;
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int load_ca(CertCache *cache)
+{
+    FILE *fp = fopen(ROOTCA_CERT, "r");
+    if (fp == NULL) {
+        return ERROR_FAILURE;
+    }
+    cache->ca = PEM_read_X509(fp, NULL, NULL, NULL);
+    fclose(fp);
+
+    fp = fopen(ROOTCA_KEY, "r");
+    if (fp == NULL) {
+        return ERROR_FAILURE;
+    }
+    cache->ca_key = PEM_read_PrivateKey(fp, NULL, NULL, ROOTCA_PASSWD);
+    fclose(fp);
+
+    if (cache->ca == NULL || cache->ca_key == NULL || X509_check_private_key(cache->ca, cache->ca_key) != 1) {
+        ERR_print_errors_fp(stderr);
+        X509_free(cache->ca);
+        EVP_PKEY_free(cache->ca_key);
+        cache->ca     = NULL;
+        cache->ca_key = NULL;
+        return ERROR_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static bool is_ip(const char *host)
+{
+    unsigned char addr[sizeof(struct in6_addr)];
+
+    return inet_pton(AF_INET, host, addr) == 1 || inet_pton(AF_INET6, host, addr) == 1;
+}
+
+/* valid_host
+ *    Purpose: Accepts IP literals and names made of letters, digits, dots,
+ *             hyphens and underscores, anything else could smuggle entries
+ *             into the subjectAltName.
+ */
+static bool valid_host(const char *host)
+{
+    if (host[0] == '\0') {
+        return false;
+    }
+    if (is_ip(host)) {
+        return true;
+    }
+
+    return host[strspn(host, "abcdefghijklmnopqrstuvwxyz0123456789.-_")] == '\0';
+}
+
+/* stored
+ *    Purpose: Loads the leaf minted for host before a restart, if the store
+ *             has one the root CA signed that has not expired.
+ *    Returns: The entry to cache, or NULL if host has to be minted.
+ */
+static CertEntry *stored(CertCache *cache, const char *host)
+{
+    if (cache->ca == NULL) {
+        return NULL;
+    }
+
+    CertEntry *e = entry_new(host);
+    if (e == NULL) {
+        return NULL;
+    }
+    if (CertStore_load(&cache->store, host, &e->cert, &e->key) != EXIT_SUCCESS ||
+        X509_verify(e->cert, X509_get0_pubkey(cache->ca)) != 1 ||
+        X509_cmp_current_time(X509_get0_notAfter(e->cert)) <= 0 || X509_check_private_key(e->cert, e->key) != 1) {
+        ERR_clear_error();
+        entry_free(e);
+        return NULL;
+    }
+    STATS_ADD(cert_loads, 1);
+
+    return e;
+}
+
+/* mint
+ *    Purpose: Creates a leaf for host with a key from the pool, valid for
+ *             CERT_LEAF_DAYS and signed by the root CA.
+ *    Returns: The entry to cache, or NULL on failure.
+ */
+static CertEntry *mint(CertCache *cache, const char *host)
+{
+    if (cache->ca == NULL) {
+        return NULL;
+    }
+
+    size_t host_l = strlen(host);
+    CertEntry *e = entry_new(host);
+    if (e == NULL) {
+        return NULL;
+    }
+
+    e->key  = KeyPool_take(&cache->keys);
+    e->cert = X509_new();
+    if (e->key == NULL || e->cert == NULL) {
+        entry_free(e);
+        return NULL;
+    }
+
+    /* random positive serial, clients reject a reused issuer and serial */
+    unsigned char serial[16];
+    BIGNUM *bn = NULL;
+    if (RAND_bytes(serial, sizeof(serial)) != 1) {
+        entry_free(e);
+        return NULL;
+    }
+    serial[0] &= 0x7f;
+    bn = BN_bin2bn(serial, sizeof(serial), NULL);
+    if (bn == NULL || BN_to_ASN1_INTEGER(bn, X509_get_serialNumber(e->cert)) == NULL) {
+        BN_free(bn);
+        entry_free(e);
+        return NULL;
+    }
+    BN_free(bn);
+
+    /* backdated by CERT_BACKDATE for clients whose clock runs behind, the
+     * common name only fits names up to 64 bytes, clients match the SAN */
+    char san[MAX_HOST_LENGTH + 4];
+    snprintf(san, sizeof(san), "%s:%s", is_ip(host) ? "IP" : "DNS", host);
+    X509_NAME *subject = X509_get_subject_name(e->cert);
+    if (X509_set_version(e->cert, X509_VERSION_3) != 1 ||
+        X509_gmtime_adj(X509_getm_notBefore(e->cert), -CERT_BACKDATE) == NULL ||
+        X509_gmtime_adj(X509_getm_notAfter(e->cert), (long)CERT_LEAF_DAYS * 24 * 60 * 60) == NULL ||
+        X509_set_pubkey(e->cert, e->key) != 1 ||
+        (host_l <= 64 && X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC, (unsigned char *)host, -1, -1, 0) != 1) ||
+        X509_set_issuer_name(e->cert, X509_get_subject_name(cache->ca)) != 1 ||
+        add_ext(e->cert, cache->ca, NID_basic_constraints, "critical,CA:FALSE") < 0 ||
+        add_ext(e->cert, cache->ca, NID_key_usage, "critical,digitalSignature") < 0 ||
+        add_ext(e->cert, cache->ca, NID_ext_key_usage, "serverAuth") < 0 ||
+        add_ext(e->cert, cache->ca, NID_subject_alt_name, san) < 0 ||
+        add_ext(e->cert, cache->ca, NID_subject_key_identifier, "hash") < 0 ||
+        add_ext(e->cert, cache->ca, NID_authority_key_identifier, "keyid") < 0 ||
+        X509_sign(e->cert, cache->ca_key, EVP_sha256()) <= 0) {
+        ERR_print_errors_fp(stderr);
+        entry_free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+static int add_ext(X509 *cert, X509 *issuer, int nid, const char *value)
+{
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, issuer, cert, NULL, NULL, 0);
+
+    X509_EXTENSION *ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, value);
+    if (ext == NULL) {
+        return ERROR_FAILURE;
+    }
+    int ret = X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+
+    return (ret == 1) ? EXIT_SUCCESS : ERROR_FAILURE;
+}
+
+/* lookup
+ *    Purpose: Finds the leaf for host and marks it most recently used.
+ *             Caller holds the lock.
+ */
+static CertEntry *lookup(CertCache *cache, const char *host, size_t bucket)
+{
+    for (CertEntry *e = cache->buckets[bucket]; e != NULL; e = e->next) {
+        if (strcmp(e->host, host) == 0) {
+            lru_unlink(cache, e);
+            lru_push(cache, e);
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void lru_unlink(CertCache *cache, CertEntry *e)
+{
+    if (e->lru_prev != NULL) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        cache->lru_head = e->lru_next;
+    }
+    if (e->lru_next != NULL) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        cache->lru_tail = e->lru_prev;
+    }
+    e->lru_next = NULL;
+    e->lru_prev = NULL;
+}
+
+static void lru_push(CertCache *cache, CertEntry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = e;
+    } else {
+        cache->lru_tail = e;
+    }
+    cache->lru_head = e;
+}
+
+/* evict
+ *    Purpose: Drops the least recently used leaf, connections holding it
+ *             keep their own reference. Caller holds the lock.
+ */
+static void evict(CertCache *cache)
+{
+    CertEntry *e = cache->lru_tail;
+    size_t bucket = hash_foo((unsigned char *)e->host) % CERT_CACHE_BUCKETS;
+
+    CertEntry **link = &cache->buckets[bucket];
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+
+    lru_unlink(cache, e);
+    cache->count--;
+    entry_free(e);
+}
+
+static CertEntry *entry_new(const char *host)
+{
+    size_t host_l = strlen(host);
+    CertEntry *e = calloc(1, sizeof(CertEntry) + host_l + 1);
+    if (e != NULL) {
+        memcpy(e->host, host, host_l);
+    }
+
+    return e;
+}
+
+static void entry_free(CertEntry *e)
+{
+    X509_free(e->cert);
+    EVP_PKEY_free(e->key);
+    free(e);
+}
+#endif
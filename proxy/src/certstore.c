@@ -0,0 +1,273 @@
+#include "certstore.h"
+
+#if RUN_SSL
+static bool valid_map(CertStore *store, struct stat *st);
+static void clear_store(CertStore *store);
+static uint64_t host_hash(const char *host);
+static CertStoreSlot *find_slot(CertStore *store, uint64_t hash, const char *host, bool for_write);
+static bool same_host(CertStore *store, CertStoreSlot *slot, const char *host);
+
+/* CertStore_open
+ *    Purpose: Opens the store at path, creating it if missing, and maps its
+ *             index. Nothing else is read, a store with another layout is
+ *             emptied.
+ * Parameters: @store - Pointer to the CertStore
+ *             @path - Store file, holds private keys and is created 0600
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE and the store stays closed.
+ */
+int CertStore_open(CertStore *store, const char *path)
+{
+    if (store == NULL || path == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(store, sizeof(*store));
+    store->map_l = sizeof(CertStoreHeader) + CERT_STORE_SLOTS * sizeof(CertStoreSlot);
+    store->fd    = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (store->fd < 0) {
+        return ERROR_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(store->fd, &st) < 0 || (st.st_size < (off_t)store->map_l && ftruncate(store->fd, store->map_l) < 0)) {
+        close(store->fd);
+        return ERROR_FAILURE;
+    }
+
+    store->map = mmap(NULL, store->map_l, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (store->map == MAP_FAILED) {
+        store->map = NULL;
+        close(store->fd);
+        return ERROR_FAILURE;
+    }
+    store->slots = (CertStoreSlot *)(store->map + 1);
+    store->end   = st.st_size;
+    pthread_mutex_init(&store->lock, NULL);
+
+    if (!valid_map(store, &st)) {
+        clear_store(store);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* CertStore_close
+ *    Purpose: Unmaps the index and closes the store, if it is open.
+ */
+void CertStore_close(CertStore *store)
+{
+    if (store == NULL || store->map == NULL) {
+        return;
+    }
+
+    munmap(store->map, store->map_l);
+    store->map   = NULL;
+    store->slots = NULL;
+    close(store->fd);
+    pthread_mutex_destroy(&store->lock);
+}
+
+/* CertStore_load
+ *    Purpose: Reads and parses the certificate and key stored for host.
+ *             Whether they are still fit to be used is up to the caller.
+ * Parameters: @store - Pointer to the CertStore
+ *             @host - Hostname as stored, lower cased
+ *             @cert - Set to the certificate, owned by the caller
+ *             @key - Set to the private key, owned by the caller
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if host is not stored or its
+ *             blob could not be read.
+ */
+int CertStore_load(CertStore *store, const char *host, X509 **cert, EVP_PKEY **key)
+{
+    if (store == NULL || store->map == NULL || host == NULL || cert == NULL || key == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    uint64_t hash = host_hash(host);
+    pthread_mutex_lock(&store->lock);
+    CertStoreSlot *slot = find_slot(store, hash, host, false);
+    CertStoreSlot copy;
+    if (slot != NULL) {
+        copy = *slot;
+    }
+    pthread_mutex_unlock(&store->lock);
+    if (slot == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    /* clearing the store meanwhile truncates the blob, the read then comes up short */
+    size_t blob_l = (size_t)copy.host_l + copy.cert_l + copy.key_l;
+    unsigned char *blob = malloc(blob_l);
+    if (blob == NULL) {
+        return ERROR_FAILURE;
+    }
+    if (pread(store->fd, blob, blob_l, (off_t)copy.offset) != (ssize_t)blob_l ||
+        copy.host_l != strlen(host) || memcmp(blob, host, copy.host_l) != 0) {
+        free(blob);
+        return ERROR_FAILURE;
+    }
+
+    const unsigned char *p = blob + copy.host_l;
+    *cert = d2i_X509(NULL, &p, copy.cert_l);
+    /* the key is of the certificate's type, which spares OpenSSL trying
+     * every decoder it has as d2i_AutoPrivateKey would */
+    p = blob + copy.host_l + copy.cert_l;
+    EVP_PKEY *pub = (*cert != NULL) ? X509_get0_pubkey(*cert) : NULL;
+    *key = (pub != NULL) ? d2i_PrivateKey(EVP_PKEY_get_base_id(pub), NULL, &p, copy.key_l) : NULL;
+    OPENSSL_cleanse(blob, blob_l);
+    free(blob);
+
+    if (*cert == NULL || *key == NULL) {
+        X509_free(*cert);
+        EVP_PKEY_free(*key);
+        *cert = NULL;
+        *key  = NULL;
+        return ERROR_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* CertStore_save
+ *    Purpose: Appends the certificate and key for host and points its slot
+ *             at them. The blob is written before the slot, a crash in
+ *             between leaves the previous entry in place.
+ * Parameters: @store - Pointer to the CertStore
+ *             @host - Hostname, lower cased
+ *             @cert - Certificate to store
+ *             @key - Its private key
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE.
+ */
+int CertStore_save(CertStore *store, const char *host, X509 *cert, EVP_PKEY *key)
+{
+    if (store == NULL || store->map == NULL || host == NULL || cert == NULL || key == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    unsigned char *cert_der = NULL;
+    unsigned char *key_der  = NULL;
+    int cert_l = i2d_X509(cert, &cert_der);
+    int key_l  = i2d_PrivateKey(key, &key_der);
+    size_t host_l = strlen(host);
+    size_t blob_l = host_l + (size_t)cert_l + (size_t)key_l;
+    unsigned char *blob = (cert_l > 0 && key_l > 0) ? malloc(blob_l) : NULL;
+    if (blob == NULL) {
+        OPENSSL_free(cert_der);
+        OPENSSL_clear_free(key_der, key_l > 0 ? key_l : 0);
+        return ERROR_FAILURE;
+    }
+    memcpy(blob, host, host_l);
+    memcpy(blob + host_l, cert_der, cert_l);
+    memcpy(blob + host_l + cert_l, key_der, key_l);
+    OPENSSL_free(cert_der);
+    OPENSSL_clear_free(key_der, key_l);
+
+    int ret = ERROR_FAILURE;
+    uint64_t hash = host_hash(host);
+    pthread_mutex_lock(&store->lock);
+    if (store->end + (off_t)blob_l > CERT_STORE_MAX) {
+        clear_store(store);
+    }
+    if (pwrite(store->fd, blob, blob_l, store->end) == (ssize_t)blob_l) {
+        CertStoreSlot *slot = find_slot(store, hash, host, true);
+        slot->hash   = 0;
+        slot->offset = (uint64_t)store->end;
+        slot->host_l = host_l;
+        slot->cert_l = cert_l;
+        slot->key_l  = key_l;
+        slot->hash   = hash;
+        store->end += blob_l;
+        ret = EXIT_SUCCESS;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    OPENSSL_cleanse(blob, blob_l);
+    free(blob);
+
+    return ret;
+}
+
+/* valid_map
+ *    Purpose: Checks the header matches this build, and that no slot points
+ *             past the end of the file.
+ */
+static bool valid_map(CertStore *store, struct stat *st)
+{
+    CertStoreHeader *h = store->map;
+    if (st->st_size < (off_t)store->map_l || memcmp(h->magic, CERT_STORE_MAGIC, sizeof(h->magic)) != 0 || h->version != CERT_STORE_VERSION ||
+        h->nslots != CERT_STORE_SLOTS) {
+        return false;
+    }
+
+    for (size_t i = 0; i < CERT_STORE_SLOTS; i++) {
+        CertStoreSlot *slot = &store->slots[i];
+        if (slot->hash != 0 && slot->offset + slot->host_l + slot->cert_l + slot->key_l > (uint64_t)st->st_size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* clear_store
+ *    Purpose: Empties the store, dropping every blob and slot.
+ */
+static void clear_store(CertStore *store)
+{
+    zero(store->map, store->map_l);
+    if (ftruncate(store->fd, store->map_l) < 0) {
+        print_warning("certstore: failed to truncate the store");
+    }
+    memcpy(store->map->magic, CERT_STORE_MAGIC, sizeof(store->map->magic));
+    store->map->version = CERT_STORE_VERSION;
+    store->map->nslots  = CERT_STORE_SLOTS;
+    store->end = store->map_l;
+}
+
+/* host_hash
+ *    Purpose: Hash of host, never 0 as that marks an empty slot.
+ */
+static uint64_t host_hash(const char *host)
+{
+    return (uint64_t)hash_foo((unsigned char *)host) | 1;
+}
+
+/* find_slot
+ *    Purpose: Probes up to CERT_STORE_PROBE slots from the hash's own for
+ *             host. Writers take an empty slot on the way, or the first one
+ *             probed if all are taken. Caller holds the lock.
+ */
+static CertStoreSlot *find_slot(CertStore *store, uint64_t hash, const char *host, bool for_write)
+{
+    CertStoreSlot *empty = NULL;
+
+    for (size_t i = 0; i < CERT_STORE_PROBE; i++) {
+        CertStoreSlot *slot = &store->slots[(hash + i) % CERT_STORE_SLOTS];
+        if (slot->hash == hash && same_host(store, slot, host)) {
+            return slot;
+        }
+        if (slot->hash == 0 && empty == NULL) {
+            empty = slot;
+        }
+    }
+
+    if (!for_write) {
+        return NULL;
+    }
+
+    return (empty != NULL) ? empty : &store->slots[hash % CERT_STORE_SLOTS];
+}
+
+/* same_host
+ *    Purpose: Tells a slot of host from one of another host with its hash,
+ *             by the hostname at the start of the blob.
+ */
+static bool same_host(CertStore *store, CertStoreSlot *slot, const char *host)
+{
+    char name[MAX_HOST_LENGTH];
+    size_t host_l = strlen(host);
+
+    return slot->host_l == host_l && host_l <= sizeof(name) &&
+           pread(store->fd, name, host_l, (off_t)slot->offset) == (ssize_t)host_l && memcmp(name, host, host_l) == 0;
+}
+#endif
@@ -16,6 +16,7 @@ Client *Client_new()
 
     client->state             = CLI_INIT;
     client->query             = NULL;
+    client->task              = NULL;
 
     #if RUN_SSL
     client->ssl               = NULL;
@@ -29,6 +30,9 @@ Client *Client_new()
     client->socket            = -1;
     client->last_active.tv_sec  = 0;
     client->last_active.tv_usec = 0;
+    Timer_init(&client->timer, client);
+    OutQueue_init(&client->out);
+    TunnelBuf_init(&client->tunnel);
 
     return client;
 }
@@ -48,7 +52,7 @@ Client *Client_create(int socket)
     }
 
     if (Client_init(client, socket) != 0) {
-        Client_free(&client);
+        Client_free(client);
         return NULL;
     }
 
@@ -79,13 +83,12 @@ int Client_init(Client *client, int socket)
         client->ssl               = NULL;
     #endif 
 
-    client->buffer            = NULL;
     client->buffer_l          = 0;
-    client->socket            = -1;
     client->last_active.tv_sec  = 0;
     client->last_active.tv_usec = 0;
     #if RUN_SSL
         client->isSSL             = false;
+        client->ssl_want_write    = false;
     #endif
 
     return 0;
@@ -104,6 +107,10 @@ void Client_free(void *client)
 
     Client *c = (Client *)client;
 
+    Timer_cancel(&c->timer);
+    Pool_cancel(c->task); // its completion must not touch the freed client
+    OutQueue_clear(&c->out);
+    TunnelBuf_close(&c->tunnel);
     Client_clearQuery(c);
 
     #if RUN_SSL
@@ -167,7 +174,7 @@ int Client_compare(void *client1, void *client2)
 
 /* Client_timestamp
  *    Purpose: Gets the timestamp of the last time a message was received from
- *             the client.
+ *             the client, and pushes back the client's timeout.
  * Parameters: @client - Pointer to a Client to timestamp
  *    Returns: 0 on success, -1 on failure.
  */
@@ -177,6 +184,7 @@ int Client_timestamp(Client *client)
         return -1;
     }
 
+    Timer_touch(&client->timer);
     return gettimeofday(&client->last_active, NULL);
 }
 
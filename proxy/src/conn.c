@@ -0,0 +1,107 @@
+#include "conn.h"
+
+/* ConnTable_new
+ *    Purpose: Creates a table mapping file descriptors to the Client that
+ *             owns them and the role the descriptor plays for that client.
+ *             The table grows on demand, size is only the initial capacity.
+ * Parameters: @size - Initial number of descriptors covered
+ *    Returns: Pointer to a new ConnTable, or NULL if memory allocation fails.
+ */
+ConnTable *ConnTable_new(size_t size)
+{
+    ConnTable *table = calloc(1, sizeof(struct ConnTable));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->size  = (size == 0) ? EV_INIT_FDS : size;
+    table->conns = calloc(table->size, sizeof(Conn));
+    if (table->conns == NULL) {
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/* ConnTable_free
+ *    Purpose: Frees a ConnTable. The clients it points to are not freed, they
+ *             are owned by the proxy's client list.
+ * Parameters: @table - Pointer to a pointer to the ConnTable to free
+ *    Returns: None
+ */
+void ConnTable_free(ConnTable **table)
+{
+    if (table == NULL || *table == NULL) {
+        return;
+    }
+
+    free((*table)->conns);
+    free(*table);
+    *table = NULL;
+}
+
+/* ConnTable_set
+ *    Purpose: Records the owner and role of a descriptor, replacing whatever
+ *             was recorded for it before.
+ * Parameters: @table - Pointer to the ConnTable
+ *             @fd - Descriptor to record
+ *             @client - Owning client, NULL for the listener
+ *             @role - CONN_* role of the descriptor
+ *    Returns: 0 on success, -1 on failure.
+ */
+int ConnTable_set(ConnTable *table, int fd, Client *client, int role)
+{
+    if (table == NULL || fd < 0) {
+        return -1;
+    }
+
+    if ((size_t)fd >= table->size) {
+        size_t new_sz = table->size;
+        while (new_sz <= (size_t)fd) {
+            new_sz *= 2;
+        }
+
+        Conn *conns = realloc(table->conns, new_sz * sizeof(Conn));
+        if (conns == NULL) {
+            return -1;
+        }
+        zero(conns + table->size, (new_sz - table->size) * sizeof(Conn));
+        table->conns = conns;
+        table->size  = new_sz;
+    }
+
+    table->conns[fd].client = client;
+    table->conns[fd].role   = role;
+
+    return 0;
+}
+
+/* ConnTable_get
+ *    Purpose: Looks up the owner and role of a descriptor in O(1).
+ * Parameters: @table - Pointer to the ConnTable
+ *             @fd - Descriptor to look up
+ *    Returns: Pointer to the Conn for fd, or NULL if fd is not recorded.
+ */
+Conn *ConnTable_get(ConnTable *table, int fd)
+{
+    if (table == NULL || fd < 0 || (size_t)fd >= table->size) {
+        return NULL;
+    }
+
+    if (table->conns[fd].role == CONN_NONE) {
+        return NULL;
+    }
+
+    return &table->conns[fd];
+}
+
+void ConnTable_clear(ConnTable *table, int fd)
+{
+    if (table == NULL || fd < 0 || (size_t)fd >= table->size) {
+        return;
+    }
+
+    table->conns[fd].client = NULL;
+    table->conns[fd].role   = CONN_NONE;
+}
@@ -0,0 +1,733 @@
+#include "dns.h"
+
+#include <sys/random.h>
+
+/* Message Layout */
+#define DNS_HEADER_SZ 12
+#define DNS_TYPE_A    1
+#define DNS_TYPE_SOA  6
+#define DNS_CLASS_IN  1
+#define DNS_FLAG_QR   0x8000
+#define DNS_FLAG_RD   0x0100
+#define DNS_FLAG_TC   0x0200
+#define DNS_RCODE(f)  ((f) & 0x000F)
+#define DNS_NXDOMAIN  3
+#define DNS_MAX_NAME  253
+
+/* Datagrams read per readiness event */
+#define DNS_RECV_BUDGET 64
+
+static time_t now_secs(void);
+static unsigned int hash_host(const char *host);
+static int normalize(const char *host, char *key);
+static DnsEntry *cache_get(Resolver *resolver, const char *key);
+static void cache_put(Resolver *resolver, const char *key, bool found, struct in_addr addr, long ttl);
+static void cache_purge(Resolver *resolver);
+static void load_hosts(Resolver *resolver);
+static int load_nameserver(struct sockaddr_in *ns);
+static int build_query(DnsLookup *lookup);
+static int transmit(Resolver *resolver, DnsLookup *lookup);
+static void complete(Resolver *resolver, DnsLookup *lookup, bool found, struct in_addr addr, long ttl);
+static void expire_lookup(void *data, void *arg);
+static void handle_answer(Resolver *resolver, unsigned char *msg, size_t len);
+static int read_name(unsigned char *msg, size_t len, size_t *off, char *out);
+static uint16_t get16(unsigned char *p);
+static uint32_t get32(unsigned char *p);
+
+/* Resolver_new
+ *    Purpose: Creates a resolver for the nameserver named by the
+ *             PROXY_NAMESERVER environment variable, or else the first IPv4
+ *             nameserver in /etc/resolv.conf. /etc/hosts is loaded into the
+ *             cache as permanent entries.
+ * Parameters: @done - Called when a pending lookup completes
+ *             @arg - Passed through to done
+ *    Returns: Pointer to the Resolver, or NULL on failure.
+ */
+Resolver *Resolver_new(DnsCallback done, void *arg)
+{
+    Resolver *resolver = calloc(1, sizeof(Resolver));
+    if (resolver == NULL) {
+        return NULL;
+    }
+
+    resolver->done = done;
+    resolver->arg  = arg;
+    resolver->fd   = -1;
+    TimerWheel_init(&resolver->timers);
+    load_hosts(resolver);
+
+    if (load_nameserver(&resolver->ns) != EXIT_SUCCESS) {
+        print_warning("dns: no nameserver configured, only /etc/hosts resolves");
+        return resolver;
+    }
+
+    /* a connected socket only receives datagrams from the nameserver */
+    resolver->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (resolver->fd < 0) {
+        Resolver_free(&resolver);
+        return NULL;
+    }
+    if (connect(resolver->fd, (struct sockaddr *)&resolver->ns, sizeof(resolver->ns)) < 0) {
+        Resolver_free(&resolver);
+        return NULL;
+    }
+
+    return resolver;
+}
+
+/* Resolver_free
+ *    Purpose: Frees the resolver, its cache and the lookups in flight. Their
+ *             waiters are dropped without a callback.
+ * Parameters: @resolver - Address of the Resolver pointer, set to NULL
+ *    Returns: None
+ */
+void Resolver_free(Resolver **resolver)
+{
+    if (resolver == NULL || *resolver == NULL) {
+        return;
+    }
+
+    Resolver *r = *resolver;
+    while (r->lookups != NULL) {
+        DnsLookup *lookup = r->lookups;
+        r->lookups        = lookup->next;
+        while (lookup->waiters != NULL) {
+            DnsWaiter *waiter = lookup->waiters;
+            lookup->waiters   = waiter->next;
+            free(waiter);
+        }
+        Timer_cancel(&lookup->timer);
+        free(lookup);
+    }
+
+    for (int b = 0; b < DNS_CACHE_BUCKETS; b++) {
+        while (r->buckets[b] != NULL) {
+            DnsEntry *entry = r->buckets[b];
+            r->buckets[b]   = entry->next;
+            free(entry);
+        }
+    }
+
+    if (r->fd != -1) {
+        close(r->fd);
+    }
+
+    free(r);
+    *resolver = NULL;
+}
+
+/* Resolver_lookup
+ *    Purpose: Resolves host to an IPv4 address. Numeric addresses and cached
+ *             answers return right away. Otherwise data is added to the
+ *             waiters of the query in flight for host, a query is only sent
+ *             when none is, so concurrent requests for one host share it.
+ * Parameters: @resolver - Pointer to the Resolver
+ *             @host - Hostname to resolve
+ *             @addr - Set to the address when DNS_FOUND is returned
+ *             @data - Waiter handed to the callback, e.g. the client
+ *    Returns: DNS_FOUND, DNS_PENDING, HOST_UNKNOWN if the name does not
+ *             resolve, or ERROR_FAILURE.
+ */
+int Resolver_lookup(Resolver *resolver, const char *host, struct in_addr *addr, void *data)
+{
+    if (resolver == NULL || host == NULL || addr == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    if (inet_pton(AF_INET, host, addr) == 1) {
+        return DNS_FOUND;
+    }
+
+    char key[DNS_MAX_NAME + 1];
+    if (normalize(host, key) != EXIT_SUCCESS) {
+        return HOST_UNKNOWN;
+    }
+
+    /* Cache */
+    DnsEntry *entry = cache_get(resolver, key);
+    if (entry != NULL) {
+        STATS_ADD(dns_hits, 1);
+        if (!entry->found) {
+            return HOST_UNKNOWN;
+        }
+        *addr = entry->addr;
+        return DNS_FOUND;
+    }
+
+    DnsWaiter *waiter = calloc(1, sizeof(DnsWaiter));
+    if (waiter == NULL) {
+        return ERROR_FAILURE;
+    }
+    waiter->data = data;
+
+    /* Join the query in flight */
+    for (DnsLookup *lookup = resolver->lookups; lookup != NULL; lookup = lookup->next) {
+        if (strcmp(lookup->host, key) == 0) {
+            waiter->next    = lookup->waiters;
+            lookup->waiters = waiter;
+            STATS_ADD(dns_joined, 1);
+            return DNS_PENDING;
+        }
+    }
+
+    if (resolver->fd == -1) {
+        free(waiter);
+        return HOST_UNKNOWN;
+    }
+
+    /* Send a new query */
+    size_t host_l     = strlen(key);
+    DnsLookup *lookup = calloc(1, sizeof(DnsLookup) + host_l + 1);
+    if (lookup == NULL) {
+        free(waiter);
+        return ERROR_FAILURE;
+    }
+    memcpy(lookup->host, key, host_l + 1);
+    Timer_init(&lookup->timer, lookup);
+    if (build_query(lookup) != EXIT_SUCCESS || transmit(resolver, lookup) != EXIT_SUCCESS) {
+        free(lookup);
+        free(waiter);
+        return HOST_UNKNOWN;
+    }
+
+    lookup->waiters   = waiter;
+    lookup->next      = resolver->lookups;
+    resolver->lookups = lookup;
+
+    return DNS_PENDING;
+}
+
+/* Resolver_cancel
+ *    Purpose: Removes data from the waiters of every lookup in flight, e.g.
+ *             when its client closes first. The lookup carries on so its
+ *             answer is still cached.
+ * Parameters: @resolver - Pointer to the Resolver
+ *             @data - Waiter to remove
+ *    Returns: None
+ */
+void Resolver_cancel(Resolver *resolver, void *data)
+{
+    if (resolver == NULL) {
+        return;
+    }
+
+    for (DnsLookup *lookup = resolver->lookups; lookup != NULL; lookup = lookup->next) {
+        DnsWaiter **link = &lookup->waiters;
+        while (*link != NULL) {
+            DnsWaiter *waiter = *link;
+            if (waiter->data == data) {
+                *link = waiter->next;
+                free(waiter);
+            } else {
+                link = &waiter->next;
+            }
+        }
+    }
+}
+
+/* Resolver_handle
+ *    Purpose: Reads the answers waiting on the resolver socket, caches them
+ *             and calls back the waiters of the lookups they complete.
+ * Parameters: @resolver - Pointer to the Resolver
+ *    Returns: Number of datagrams read, or ERROR_FAILURE.
+ */
+int Resolver_handle(Resolver *resolver)
+{
+    if (resolver == NULL || resolver->fd == -1) {
+        return ERROR_FAILURE;
+    }
+
+    unsigned char msg[DNS_PACKET_SZ];
+    int n = 0;
+    for (; n < DNS_RECV_BUDGET; n++) {
+        STATS_ADD(io_syscalls, 1);
+        ssize_t len = recv(resolver->fd, msg, sizeof(msg), 0);
+        if (len < 0) {
+            /* ECONNREFUSED reports an ICMP error for an earlier query, the
+             * retransmit timer deals with it */
+            if (errno == EINTR || errno == ECONNREFUSED) {
+                continue;
+            }
+            break;
+        }
+        handle_answer(resolver, msg, len);
+    }
+
+    return n;
+}
+
+/* Resolver_tick
+ *    Purpose: Retransmits the queries that went unanswered for
+ *             DNS_TIMEOUT_MS, and fails those out of tries.
+ * Parameters: @resolver - Pointer to the Resolver
+ *    Returns: None
+ */
+void Resolver_tick(Resolver *resolver)
+{
+    if (resolver == NULL) {
+        return;
+    }
+
+    TimerWheel_advance(&resolver->timers, expire_lookup, resolver);
+}
+
+/* Resolver_nextTimeout
+ *    Purpose: Time until the next retransmit is due, see
+ *             TimerWheel_nextTimeout.
+ */
+bool Resolver_nextTimeout(Resolver *resolver, struct timeval *timeout)
+{
+    if (resolver == NULL) {
+        return false;
+    }
+
+    return TimerWheel_nextTimeout(&resolver->timers, timeout);
+}
+
+static time_t now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* hash_host
+ *    Purpose: FNV-1a over the normalized hostname.
+ */
+static unsigned int hash_host(const char *host)
+{
+    unsigned int h = 2166136261u;
+    for (const char *c = host; *c != '\0'; c++) {
+        h ^= (unsigned char)*c;
+        h *= 16777619u;
+    }
+    return h % DNS_CACHE_BUCKETS;
+}
+
+/* normalize
+ *    Purpose: Lower-cases host into key and drops a trailing dot, DNS names
+ *             compare case-insensitively.
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if host is not a valid name.
+ */
+static int normalize(const char *host, char *key)
+{
+    size_t len = strlen(host);
+    if (len > 0 && host[len - 1] == '.') {
+        len--;
+    }
+    if (len == 0 || len > DNS_MAX_NAME) {
+        return ERROR_FAILURE;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        key[i] = tolower((unsigned char)host[i]);
+    }
+    key[len] = '\0';
+
+    return EXIT_SUCCESS;
+}
+
+/* cache_get
+ *    Purpose: Finds the live entry for key, an expired one is dropped.
+ */
+static DnsEntry *cache_get(Resolver *resolver, const char *key)
+{
+    DnsEntry **link = &resolver->buckets[hash_host(key)];
+    while (*link != NULL) {
+        DnsEntry *entry = *link;
+        if (strcmp(entry->host, key) == 0) {
+            if (entry->expires != 0 && entry->expires <= now_secs()) {
+                *link = entry->next;
+                free(entry);
+                resolver->nentries--;
+                return NULL;
+            }
+            return entry;
+        }
+        link = &entry->next;
+    }
+
+    return NULL;
+}
+
+/* cache_put
+ *    Purpose: Caches an answer for ttl seconds, replacing any entry for key.
+ *             A ttl of 0 caches the entry permanently. Nothing is cached if
+ *             the cache stays full after purging expired entries.
+ */
+static void cache_put(Resolver *resolver, const char *key, bool found, struct in_addr addr, long ttl)
+{
+    DnsEntry *entry = cache_get(resolver, key);
+    if (entry == NULL) {
+        if (resolver->nentries >= DNS_CACHE_MAX) {
+            cache_purge(resolver);
+            if (resolver->nentries >= DNS_CACHE_MAX) {
+                return;
+            }
+        }
+
+        size_t key_l = strlen(key);
+        entry        = calloc(1, sizeof(DnsEntry) + key_l + 1);
+        if (entry == NULL) {
+            return;
+        }
+        memcpy(entry->host, key, key_l + 1);
+
+        unsigned int b       = hash_host(key);
+        entry->next          = resolver->buckets[b];
+        resolver->buckets[b] = entry;
+        resolver->nentries++;
+    } else if (entry->expires == 0) {
+        return; // /etc/hosts wins
+    }
+
+    entry->found   = found;
+    entry->addr    = addr;
+    entry->expires = (ttl > 0) ? now_secs() + ttl : 0;
+}
+
+static void cache_purge(Resolver *resolver)
+{
+    time_t now = now_secs();
+    for (int b = 0; b < DNS_CACHE_BUCKETS; b++) {
+        DnsEntry **link = &resolver->buckets[b];
+        while (*link != NULL) {
+            DnsEntry *entry = *link;
+            if (entry->expires != 0 && entry->expires <= now) {
+                *link = entry->next;
+                free(entry);
+                resolver->nentries--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+/* load_hosts
+ *    Purpose: Caches the IPv4 entries of /etc/hosts permanently, the first
+ *             address listed for a name wins.
+ */
+static void load_hosts(Resolver *resolver)
+{
+    FILE *fp = fopen(DNS_HOSTS_FILE, "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    char line[BUFFER_SZ];
+    char key[DNS_MAX_NAME + 1];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char *save = NULL;
+        char *tok  = strtok_r(line, " \t\r\n", &save);
+        struct in_addr addr;
+        if (tok == NULL || inet_pton(AF_INET, tok, &addr) != 1) {
+            continue;
+        }
+        while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if (normalize(tok, key) == EXIT_SUCCESS && cache_get(resolver, key) == NULL) {
+                cache_put(resolver, key, true, addr, 0);
+            }
+        }
+    }
+
+    fclose(fp);
+}
+
+/* load_nameserver
+ *    Purpose: Reads the nameserver address from DNS_NAMESERVER_ENV, or the
+ *             first IPv4 nameserver line of /etc/resolv.conf.
+ */
+static int load_nameserver(struct sockaddr_in *ns)
+{
+    char addr[BUFFER_SZ] = {0};
+    int port = DNS_PORT;
+
+    char *env = getenv(DNS_NAMESERVER_ENV);
+    if (env != NULL && *env != '\0') {
+        snprintf(addr, sizeof(addr), "%s", env);
+        char *colon = strchr(addr, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            port   = atoi(colon + 1);
+        }
+    } else {
+        FILE *fp = fopen(DNS_RESOLV_CONF, "r");
+        if (fp == NULL) {
+            return ERROR_FAILURE;
+        }
+        char line[BUFFER_SZ];
+        char value[BUFFER_SZ];
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            struct in_addr probe;
+            if (sscanf(line, " nameserver %1023s", value) == 1 && inet_pton(AF_INET, value, &probe) == 1) {
+                snprintf(addr, sizeof(addr), "%s", value);
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    zero(ns, sizeof(*ns));
+    ns->sin_family = AF_INET;
+    ns->sin_port   = htons(port);
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, addr, &ns->sin_addr) != 1) {
+        return ERROR_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* build_query
+ *    Purpose: Encodes a recursive A query for lookup->host with a random id.
+ */
+static int build_query(DnsLookup *lookup)
+{
+    unsigned char *p = lookup->packet;
+
+    if (getrandom(&lookup->id, sizeof(lookup->id), GRND_NONBLOCK) != sizeof(lookup->id)) {
+        lookup->id = (uint16_t)random();
+    }
+
+    zero(p, DNS_HEADER_SZ);
+    p[0] = lookup->id >> 8;
+    p[1] = lookup->id & 0xFF;
+    p[2] = DNS_FLAG_RD >> 8;
+    p[5] = 1; // QDCOUNT
+
+    /* QNAME, one length-prefixed label per dot */
+    size_t off       = DNS_HEADER_SZ;
+    const char *label = lookup->host;
+    while (*label != '\0') {
+        const char *dot = strchr(label, '.');
+        size_t label_l  = (dot != NULL) ? (size_t)(dot - label) : strlen(label);
+        if (label_l == 0 || label_l > 63 || off + label_l + 1 + 5 > DNS_PACKET_SZ) {
+            return ERROR_FAILURE;
+        }
+        p[off++] = label_l;
+        memcpy(p + off, label, label_l);
+        off += label_l;
+        label += label_l + (dot != NULL);
+    }
+    p[off++] = 0;
+
+    p[off++] = 0;
+    p[off++] = DNS_TYPE_A;
+    p[off++] = 0;
+    p[off++] = DNS_CLASS_IN;
+
+    lookup->packet_l = off;
+    return EXIT_SUCCESS;
+}
+
+/* transmit
+ *    Purpose: Sends the lookup's query and arms its retransmit timer.
+ */
+static int transmit(Resolver *resolver, DnsLookup *lookup)
+{
+    STATS_ADD(io_syscalls, 1);
+    ssize_t n = send(resolver->fd, lookup->packet, lookup->packet_l, 0);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+        return ERROR_FAILURE;
+    }
+
+    STATS_ADD(dns_queries, 1);
+    lookup->tries++;
+    Timer_schedule(&resolver->timers, &lookup->timer, DNS_TIMEOUT_MS);
+    return EXIT_SUCCESS;
+}
+
+/* complete
+ *    Purpose: Caches the outcome of a lookup, takes it off the in-flight
+ *             list and calls back its waiters. Callbacks may free their
+ *             owners, the lookup is gone before the first one runs.
+ */
+static void complete(Resolver *resolver, DnsLookup *lookup, bool found, struct in_addr addr, long ttl)
+{
+    DnsLookup **link = &resolver->lookups;
+    while (*link != lookup) {
+        link = &(*link)->next;
+    }
+    *link = lookup->next;
+    Timer_cancel(&lookup->timer);
+
+    cache_put(resolver, lookup->host, found, addr, ttl);
+
+    DnsWaiter *waiters = lookup->waiters;
+    free(lookup);
+
+    while (waiters != NULL) {
+        DnsWaiter *waiter = waiters;
+        waiters           = waiter->next;
+        void *data        = waiter->data;
+        free(waiter);
+        resolver->done(data, found ? DNS_FOUND : HOST_UNKNOWN, addr, resolver->arg);
+    }
+}
+
+static void expire_lookup(void *data, void *arg)
+{
+    DnsLookup *lookup  = (DnsLookup *)data;
+    Resolver *resolver = (Resolver *)arg;
+    struct in_addr none = {0};
+
+    if (lookup->tries < DNS_TRIES && transmit(resolver, lookup) == EXIT_SUCCESS) {
+        return;
+    }
+
+    complete(resolver, lookup, false, none, DNS_FAIL_TTL);
+}
+
+/* handle_answer
+ *    Purpose: Matches a response to its lookup by id and question, then
+ *             completes the lookup. The TTL of a positive answer is the
+ *             lowest of its A records, a negative answer is cached for the
+ *             SOA's negative TTL (RFC 2308). Truncated answers and server
+ *             failures are cached briefly as failures, there is no TCP
+ *             fallback.
+ */
+static void handle_answer(Resolver *resolver, unsigned char *msg, size_t len)
+{
+    if (len < DNS_HEADER_SZ) {
+        return;
+    }
+
+    uint16_t id      = get16(msg);
+    uint16_t flags   = get16(msg + 2);
+    uint16_t qdcount = get16(msg + 4);
+    uint16_t ancount = get16(msg + 6);
+    uint16_t nscount = get16(msg + 8);
+    if (!(flags & DNS_FLAG_QR) || qdcount != 1) {
+        return;
+    }
+
+    /* Question, must name the lookup */
+    char name[DNS_MAX_NAME + 2];
+    size_t off = DNS_HEADER_SZ;
+    if (read_name(msg, len, &off, name) != EXIT_SUCCESS || off + 4 > len) {
+        return;
+    }
+    off += 4;
+
+    DnsLookup *lookup = resolver->lookups;
+    while (lookup != NULL && (lookup->id != id || strcasecmp(lookup->host, name) != 0)) {
+        lookup = lookup->next;
+    }
+    if (lookup == NULL) {
+        return;
+    }
+
+    struct in_addr addr = {0};
+    int rcode = DNS_RCODE(flags);
+    if ((flags & DNS_FLAG_TC) || (rcode != 0 && rcode != DNS_NXDOMAIN)) {
+        complete(resolver, lookup, false, addr, DNS_FAIL_TTL);
+        return;
+    }
+
+    /* Answer and authority records */
+    bool found   = false;
+    long ttl     = DNS_MAX_TTL;
+    long neg_ttl = DNS_NEG_TTL;
+    for (int i = 0; i < ancount + nscount; i++) {
+        if (read_name(msg, len, &off, NULL) != EXIT_SUCCESS || off + 10 > len) {
+            complete(resolver, lookup, false, addr, DNS_FAIL_TTL);
+            return;
+        }
+        uint16_t type   = get16(msg + off);
+        uint16_t class  = get16(msg + off + 2);
+        long rr_ttl     = get32(msg + off + 4) & 0x7FFFFFFF;
+        uint16_t rdlen  = get16(msg + off + 8);
+        off += 10;
+        if (off + rdlen > len) {
+            complete(resolver, lookup, false, addr, DNS_FAIL_TTL);
+            return;
+        }
+
+        if (i < ancount && type == DNS_TYPE_A && class == DNS_CLASS_IN && rdlen == 4) {
+            if (!found) {
+                memcpy(&addr, msg + off, 4);
+            }
+            found = true;
+            ttl   = (rr_ttl < ttl) ? rr_ttl : ttl;
+        } else if (i >= ancount && type == DNS_TYPE_SOA && rdlen >= 20) {
+            long minimum = get32(msg + off + rdlen - 4) & 0x7FFFFFFF;
+            neg_ttl      = (rr_ttl < minimum) ? rr_ttl : minimum;
+        }
+        off += rdlen;
+    }
+
+    if (found) {
+        complete(resolver, lookup, true, addr, (ttl > 0) ? ttl : 1);
+    } else {
+        neg_ttl = (neg_ttl > DNS_MAX_NEG_TTL) ? DNS_MAX_NEG_TTL : neg_ttl;
+        complete(resolver, lookup, false, addr, (neg_ttl > 0) ? neg_ttl : 1);
+    }
+}
+
+/* read_name
+ *    Purpose: Decodes the possibly compressed name at *off into out, or
+ *             skips it when out is NULL. *off is left after the name.
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE on a malformed name.
+ */
+static int read_name(unsigned char *msg, size_t len, size_t *off, char *out)
+{
+    size_t pos    = *off;
+    size_t out_l  = 0;
+    bool jumped   = false;
+    int hops      = 0;
+
+    while (pos < len) {
+        unsigned char label_l = msg[pos];
+        if (label_l == 0) {
+            if (!jumped) {
+                *off = pos + 1;
+            }
+            if (out != NULL) {
+                out[out_l] = '\0';
+            }
+            return EXIT_SUCCESS;
+        }
+
+        /* compression pointer */
+        if ((label_l & 0xC0) == 0xC0) {
+            if (pos + 1 >= len || ++hops > 16) {
+                return ERROR_FAILURE;
+            }
+            if (!jumped) {
+                *off = pos + 2;
+            }
+            jumped = true;
+            pos    = ((label_l & 0x3F) << 8) | msg[pos + 1];
+            continue;
+        }
+
+        if (label_l > 63 || pos + 1 + label_l > len || out_l + label_l + 1 > DNS_MAX_NAME + 1) {
+            return ERROR_FAILURE;
+        }
+        if (out != NULL) {
+            if (out_l > 0) {
+                out[out_l++] = '.';
+            }
+            memcpy(out + out_l, msg + pos + 1, label_l);
+            out_l += label_l;
+        }
+        pos += 1 + label_l;
+    }
+
+    return ERROR_FAILURE;
+}
+
+static uint16_t get16(unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
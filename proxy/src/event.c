@@ -0,0 +1,1172 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // accept4
+#endif
+#include "event.h"
+
+#if HAVE_URING
+#include <poll.h>
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+
+/* io_uring user_data layout: op in bits 56-63, the fd's generation in bits
+ * 32-55 and the fd (or buffer id) in bits 0-31. Completions whose generation
+ * no longer matches belong to a retired fd and are discarded. */
+#define UOP_POLL    1
+#define UOP_ACCEPT  2
+#define UOP_RECV    3
+#define UOP_SEND    4
+#define UOP_PROVIDE 5
+#define UOP_CANCEL  6
+#define UOP_CONNECT 7
+
+#define UD_GEN_MASK 0xffffffU
+#define UD(op, gen, fd)                                                                                         \
+    (((unsigned long long)(op) << 56) | ((unsigned long long)((gen) & UD_GEN_MASK) << 32) |                      \
+     (unsigned long long)(unsigned int)(fd))
+#endif
+
+static int grow_maps(EventLoop *loop, int fd);
+static void clear_ready(EventLoop *loop);
+static int wait_select(EventLoop *loop, struct timeval *timeout);
+#if HAVE_EPOLL
+static int wait_epoll(EventLoop *loop, struct timeval *timeout);
+static unsigned int to_epoll(int events);
+#endif
+#if HAVE_URING
+static int uring_init(EventLoop *loop);
+static int wait_uring(EventLoop *loop, struct timeval *timeout);
+static void uring_arm(EventLoop *loop, int fd);
+static void uring_retire(EventLoop *loop, int fd);
+static void uring_recv(EventLoop *loop, int fd);
+static void uring_provide(EventLoop *loop, int bid, int nbufs);
+static void uring_complete(EventLoop *loop, struct io_uring_cqe *cqe);
+static void uring_relayed(EventLoop *loop, int src, unsigned int gen, int res, unsigned int flags);
+static bool uring_live(EventLoop *loop, int fd, unsigned int gen);
+static void relay_end(EventLoop *loop, int fd);
+static void mark_ready(EventLoop *loop, int fd, int events);
+#endif
+
+/* EventLoop_new
+ *    Purpose: Creates a new EventLoop using the given backend. The select
+ *             backend is limited to FD_SETSIZE descriptors and scans every
+ *             descriptor up to fdmax on each wakeup. The epoll backend has no
+ *             descriptor ceiling and only reports the descriptors that are
+ *             ready. The io_uring backend additionally accepts with
+ *             multishot accept and relays tunnels inside the kernel through
+ *             EventLoop_relay, so a relayed byte costs no syscall of its own.
+ * Parameters: @backend - EV_BACKEND_SELECT, EV_BACKEND_EPOLL or
+ *                        EV_BACKEND_URING
+ *    Returns: Pointer to a new EventLoop, or NULL on failure.
+ */
+EventLoop *EventLoop_new(int backend)
+{
+    EventLoop *loop = calloc(1, sizeof(struct EventLoop));
+    if (loop == NULL) {
+        return NULL;
+    }
+
+    loop->backend = backend;
+    loop->epfd    = -1;
+    loop->fdmax   = -1;
+    FD_ZERO(&loop->master_rd);
+    FD_ZERO(&loop->master_wr);
+    FD_ZERO(&loop->readfds);
+    FD_ZERO(&loop->writefds);
+
+    switch (backend) {
+    case EV_BACKEND_SELECT:
+        loop->max_events = FD_SETSIZE;
+        break;
+#if HAVE_EPOLL
+    case EV_BACKEND_EPOLL:
+        loop->max_events = EV_MAX_EVENTS;
+        loop->epfd       = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd == -1) {
+            print_error("event: epoll_create1 failed");
+            free(loop);
+            return NULL;
+        }
+        loop->ep_events = calloc(loop->max_events, sizeof(struct epoll_event));
+        if (loop->ep_events == NULL) {
+            EventLoop_free(&loop);
+            return NULL;
+        }
+        break;
+#endif
+#if HAVE_URING
+    case EV_BACKEND_URING:
+        loop->max_events = EV_MAX_EVENTS;
+        loop->listen_fd  = -1;
+        if (Uring_init(&loop->ring, URING_ENTRIES, URING_CQ_ENTRIES) != 0) {
+            free(loop);
+            return NULL;
+        }
+        break;
+#endif
+    default:
+        print_error("event: unsupported backend");
+        free(loop);
+        return NULL;
+    }
+
+    loop->ready = calloc(loop->max_events, sizeof(Event));
+    if (loop->ready == NULL || grow_maps(loop, EV_INIT_FDS - 1) != 0) {
+        EventLoop_free(&loop);
+        return NULL;
+    }
+
+#if HAVE_URING
+    if (backend == EV_BACKEND_URING && uring_init(loop) != 0) {
+        EventLoop_free(&loop);
+        return NULL;
+    }
+#endif
+
+    return loop;
+}
+
+/* EventLoop_free
+ *    Purpose: Frees an EventLoop and closes the backend descriptor. Registered
+ *             descriptors are not closed, they belong to the caller.
+ * Parameters: @loop - Pointer to a pointer to the EventLoop to free
+ *    Returns: None
+ */
+void EventLoop_free(EventLoop **loop)
+{
+    if (loop == NULL || *loop == NULL) {
+        return;
+    }
+
+    EventLoop *l = *loop;
+    if (l->epfd != -1) {
+        close(l->epfd);
+    }
+#if HAVE_EPOLL
+    free(l->ep_events);
+#endif
+#if HAVE_URING
+    if (l->backend == EV_BACKEND_URING) {
+        Uring_free(&l->ring);
+        while (l->accepted_head < l->naccepted) {
+            close(l->accepted[l->accepted_head++]);
+        }
+    }
+    free(l->ufds);
+    free(l->rearm);
+    free(l->starved);
+    free(l->accepted);
+    free(l->bufs);
+#endif
+    free(l->interest);
+    free(l->ready_map);
+    free(l->ready);
+    free(l);
+    *loop = NULL;
+}
+
+/* EventLoop_add
+ *    Purpose: Registers a descriptor with the loop. The descriptor is
+ *             registered once and stays registered until EventLoop_remove.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd - Descriptor to watch
+ *             @events - EV_READ and/or EV_WRITE, 0 registers without interest.
+ *                       EV_ACCEPT marks a listening socket.
+ *    Returns: 0 on success, ERROR_EVENT on failure.
+ */
+int EventLoop_add(EventLoop *loop, int fd, int events)
+{
+    if (loop == NULL || fd < 0) {
+        return ERROR_EVENT;
+    }
+
+    if (loop->backend == EV_BACKEND_SELECT && fd >= FD_SETSIZE) {
+        print_error("event: descriptor exceeds FD_SETSIZE");
+        return ERROR_EVENT;
+    }
+
+    if (grow_maps(loop, fd) != 0) {
+        return ERROR_EVENT;
+    }
+
+    if (loop->interest[fd] != -1) {
+        return EventLoop_modify(loop, fd, events);
+    }
+
+#if HAVE_EPOLL
+    if (loop->backend == EV_BACKEND_EPOLL) {
+        struct epoll_event ev;
+        zero(&ev, sizeof(ev));
+        ev.events  = to_epoll(events);
+        ev.data.fd = fd;
+        STATS_ADD(loop_syscalls, 1);
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            print_error("event: epoll_ctl add failed");
+            return ERROR_EVENT;
+        }
+    }
+#endif
+
+    if (loop->backend == EV_BACKEND_SELECT) {
+        if (events & EV_READ) {
+            FD_SET(fd, &loop->master_rd);
+        }
+        if (events & EV_WRITE) {
+            FD_SET(fd, &loop->master_wr);
+        }
+        if (fd > loop->fdmax) {
+            loop->fdmax = fd;
+        }
+    }
+
+    loop->interest[fd] = events;
+
+#if HAVE_URING
+    if (loop->backend == EV_BACKEND_URING) {
+        if (events & EV_ACCEPT) {
+            loop->listen_fd = fd;
+        }
+        uring_arm(loop, fd);
+    }
+#endif
+
+    return 0;
+}
+
+/* EventLoop_modify
+ *    Purpose: Changes the events a registered descriptor is watched for.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd - Registered descriptor
+ *             @events - EV_READ and/or EV_WRITE
+ *    Returns: 0 on success, ERROR_EVENT on failure.
+ */
+int EventLoop_modify(EventLoop *loop, int fd, int events)
+{
+    if (loop == NULL || fd < 0 || (size_t)fd >= loop->map_sz || loop->interest[fd] == -1) {
+        return ERROR_EVENT;
+    }
+
+    if (loop->interest[fd] == events) {
+        return 0;
+    }
+
+#if HAVE_EPOLL
+    if (loop->backend == EV_BACKEND_EPOLL) {
+        struct epoll_event ev;
+        zero(&ev, sizeof(ev));
+        ev.events  = to_epoll(events);
+        ev.data.fd = fd;
+        STATS_ADD(loop_syscalls, 1);
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+            print_error("event: epoll_ctl mod failed");
+            return ERROR_EVENT;
+        }
+    }
+#endif
+
+    if (loop->backend == EV_BACKEND_SELECT) {
+        FD_CLR(fd, &loop->master_rd);
+        FD_CLR(fd, &loop->master_wr);
+        if (events & EV_READ) {
+            FD_SET(fd, &loop->master_rd);
+        }
+        if (events & EV_WRITE) {
+            FD_SET(fd, &loop->master_wr);
+        }
+    }
+
+    loop->interest[fd] = events;
+
+#if HAVE_URING
+    /* a poll cannot be changed in place, replace it */
+    if (loop->backend == EV_BACKEND_URING && loop->ufds[fd].peer == -1) {
+        if (loop->ufds[fd].armed || loop->ufds[fd].accepting) {
+            uring_retire(loop, fd);
+        }
+        uring_arm(loop, fd);
+    }
+#endif
+
+    return 0;
+}
+
+/* EventLoop_remove
+ *    Purpose: Unregisters a descriptor. Must be called before the descriptor
+ *             is closed so that a reused descriptor number starts clean.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd - Registered descriptor
+ *    Returns: 0 on success, ERROR_EVENT if the descriptor was not registered.
+ */
+int EventLoop_remove(EventLoop *loop, int fd)
+{
+    if (loop == NULL || fd < 0 || (size_t)fd >= loop->map_sz || loop->interest[fd] == -1) {
+        return ERROR_EVENT;
+    }
+
+#if HAVE_EPOLL
+    if (loop->backend == EV_BACKEND_EPOLL) {
+        STATS_ADD(loop_syscalls, 1);
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+#endif
+
+#if HAVE_URING
+    if (loop->backend == EV_BACKEND_URING) {
+        uring_retire(loop, fd);
+        if (fd == loop->listen_fd) {
+            loop->listen_fd = -1;
+        }
+    }
+#endif
+
+    loop->interest[fd]  = -1;
+    loop->ready_map[fd] = 0;
+
+    if (loop->backend == EV_BACKEND_SELECT) {
+        FD_CLR(fd, &loop->master_rd);
+        FD_CLR(fd, &loop->master_wr);
+        while (loop->fdmax >= 0 && loop->interest[loop->fdmax] == -1) {
+            loop->fdmax--;
+        }
+    }
+
+    return 0;
+}
+
+/* EventLoop_wait
+ *    Purpose: Waits for activity on the registered descriptors. On return
+ *             loop->ready holds loop->nready events, and EventLoop_isReadable
+ *             and EventLoop_isWritable answer for this iteration.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @timeout - Maximum time to wait, NULL waits indefinitely
+ *    Returns: Number of ready descriptors, 0 on timeout or interrupt, or
+ *             ERROR_EVENT on failure.
+ */
+int EventLoop_wait(EventLoop *loop, struct timeval *timeout)
+{
+    if (loop == NULL) {
+        return ERROR_EVENT;
+    }
+
+    clear_ready(loop);
+
+    switch (loop->backend) {
+    case EV_BACKEND_SELECT:
+        return wait_select(loop, timeout);
+#if HAVE_EPOLL
+    case EV_BACKEND_EPOLL:
+        return wait_epoll(loop, timeout);
+#endif
+#if HAVE_URING
+    case EV_BACKEND_URING:
+        return wait_uring(loop, timeout);
+#endif
+    default:
+        return ERROR_EVENT;
+    }
+}
+
+bool EventLoop_isReadable(EventLoop *loop, int fd)
+{
+    if (loop == NULL || fd < 0 || (size_t)fd >= loop->map_sz) {
+        return false;
+    }
+
+    return (loop->ready_map[fd] & EV_READ) != 0;
+}
+
+bool EventLoop_isWritable(EventLoop *loop, int fd)
+{
+    if (loop == NULL || fd < 0 || (size_t)fd >= loop->map_sz) {
+        return false;
+    }
+
+    return (loop->ready_map[fd] & EV_WRITE) != 0;
+}
+
+bool EventLoop_isClosed(EventLoop *loop, int fd)
+{
+    if (loop == NULL || fd < 0 || (size_t)fd >= loop->map_sz) {
+        return false;
+    }
+
+    return (loop->ready_map[fd] & EV_CLOSED) != 0;
+}
+
+/* EventLoop_accept
+ *    Purpose: Accepts a connection on a listening socket. The io_uring engine
+ *             hands out a descriptor its multishot accept already produced,
+ *             the other backends call accept4. Either way the descriptor is
+ *             non-blocking and close-on-exec.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @listen_fd - Listening socket registered with EV_ACCEPT
+ *             @addr - Filled with the peer address, zeroed by io_uring
+ *             @addr_l - Size of addr
+ *    Returns: The accepted descriptor, or -1 with errno set. EAGAIN means no
+ *             connection is pending.
+ */
+int EventLoop_accept(EventLoop *loop, int listen_fd, struct sockaddr *addr, socklen_t *addr_l)
+{
+    if (loop == NULL || listen_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if HAVE_URING
+    if (loop->backend == EV_BACKEND_URING) {
+        if (loop->accepted_head == loop->naccepted) {
+            errno            = (loop->accept_err != 0) ? loop->accept_err : EAGAIN;
+            loop->accept_err = 0;
+            return -1;
+        }
+
+        int fd = loop->accepted[loop->accepted_head++];
+        if (loop->accepted_head == loop->naccepted) {
+            loop->accepted_head = 0;
+            loop->naccepted     = 0;
+        }
+        if (addr != NULL && addr_l != NULL) {
+            zero(addr, *addr_l);
+        }
+        return fd;
+    }
+#endif
+
+    STATS_ADD(io_syscalls, 1);
+#ifdef __linux__
+    return accept4(listen_fd, addr, addr_l, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int fd = accept(listen_fd, addr, addr_l);
+    if (fd != -1) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+#endif
+}
+
+/* EventLoop_connect
+ *    Purpose: Starts a non-blocking connect on a registered socket. The
+ *             io_uring engine submits it to the ring and reports the socket
+ *             writable once it completed, the other backends call connect.
+ *             Either way the outcome is read with EventLoop_connectError once
+ *             the socket is writable.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd - Registered, non-blocking socket
+ *             @addr - Address to connect to
+ *             @addr_l - Size of addr
+ *    Returns: 0 if connected at once, or -1 with errno set. EINPROGRESS means
+ *             the connect completes later.
+ */
+int EventLoop_connect(EventLoop *loop, int fd, const struct sockaddr *addr, socklen_t addr_l)
+{
+    if (loop == NULL || fd < 0 || addr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if HAVE_URING
+    if (loop->backend == EV_BACKEND_URING) {
+        if ((size_t)fd >= loop->map_sz || loop->interest[fd] == -1) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        UringFd *u = &loop->ufds[fd];
+        if (u->armed) {
+            uring_retire(loop, fd);
+        }
+        struct io_uring_sqe *sqe = Uring_getSqe(&loop->ring);
+        if (sqe == NULL) {
+            errno = EAGAIN;
+            return -1;
+        }
+        /* submitted at once, addr belongs to the caller */
+        Uring_prepConnect(sqe, fd, addr, addr_l, UD(UOP_CONNECT, u->gen, fd));
+        STATS_ADD(io_syscalls, 1);
+        if (Uring_submit(&loop->ring) < 0) {
+            return -1;
+        }
+        u->connecting  = true;
+        u->connect_err = 0;
+        errno = EINPROGRESS;
+        return -1;
+    }
+#endif
+
+    STATS_ADD(io_syscalls, 1);
+    return connect(fd, addr, addr_l);
+}
+
+/* EventLoop_connectError
+ *    Purpose: Collects the outcome of a connect started with EventLoop_connect
+ *             once the socket reported writable.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd - Connecting socket
+ *    Returns: 0 if connected, else the errno the connect failed with.
+ */
+int EventLoop_connectError(EventLoop *loop, int fd)
+{
+    if (loop == NULL || fd < 0) {
+        return EINVAL;
+    }
+
+#if HAVE_URING
+    if (loop->backend == EV_BACKEND_URING && (size_t)fd < loop->map_sz) {
+        UringFd *u = &loop->ufds[fd];
+        return u->connecting ? EINPROGRESS : u->connect_err;
+    }
+#endif
+
+    int err = 0;
+    socklen_t err_l = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_l) < 0) {
+        return errno;
+    }
+
+    return err;
+}
+
+/* EventLoop_relay
+ *    Purpose: Hands a pair of connected sockets to the io_uring engine, which
+ *             copies bytes between them with linked recv/send requests until
+ *             either side closes. The descriptors stay registered, but are
+ *             only reported again once the relay ends, as readable with
+ *             EV_CLOSED set.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd_a, @fd_b - Registered descriptors to relay between
+ *    Returns: 0 on success, ERROR_EVENT if the backend cannot relay, in which
+ *             case the caller relays as before.
+ */
+int EventLoop_relay(EventLoop *loop, int fd_a, int fd_b)
+{
+#if HAVE_URING
+    if (loop == NULL || loop->backend != EV_BACKEND_URING || fd_a < 0 || fd_b < 0 ||
+        (size_t)fd_a >= loop->map_sz || (size_t)fd_b >= loop->map_sz || loop->interest[fd_a] == -1 ||
+        loop->interest[fd_b] == -1)
+    {
+        return ERROR_EVENT;
+    }
+
+    uring_retire(loop, fd_a);
+    uring_retire(loop, fd_b);
+    loop->ufds[fd_a].peer    = fd_b;
+    loop->ufds[fd_b].peer    = fd_a;
+    loop->ufds[fd_a].relayed = 0;
+    loop->ufds[fd_b].relayed = 0;
+    uring_recv(loop, fd_a);
+    uring_recv(loop, fd_b);
+
+    return 0;
+#else
+    (void)loop;
+    (void)fd_a;
+    (void)fd_b;
+    return ERROR_EVENT;
+#endif
+}
+
+/* EventLoop_relayed
+ *    Purpose: Reports how many bytes the engine relayed from fd, so the owner
+ *             can tell an idle relayed tunnel from a busy one.
+ * Parameters: @loop - Pointer to the EventLoop
+ *             @fd - Relayed descriptor
+ *    Returns: Bytes relayed from fd, 0 if the backend does not relay.
+ */
+unsigned long EventLoop_relayed(EventLoop *loop, int fd)
+{
+#if HAVE_URING
+    if (loop != NULL && loop->backend == EV_BACKEND_URING && fd >= 0 && (size_t)fd < loop->map_sz) {
+        return loop->ufds[fd].relayed;
+    }
+#else
+    (void)loop;
+    (void)fd;
+#endif
+    return 0;
+}
+
+/* EventLoop_parseBackend
+ *    Purpose: Maps a backend name given on the command line to its id.
+ * Parameters: @name - "select", "epoll" or "uring"
+ *    Returns: Backend id, or ERROR_EVENT if the name is unknown or the backend
+ *             is not available on this platform.
+ */
+int EventLoop_parseBackend(const char *name)
+{
+    if (name == NULL) {
+        return ERROR_EVENT;
+    }
+
+    if (strcmp(name, "select") == 0) {
+        return EV_BACKEND_SELECT;
+    }
+#if HAVE_EPOLL
+    if (strcmp(name, "epoll") == 0) {
+        return EV_BACKEND_EPOLL;
+    }
+#endif
+#if HAVE_URING
+    if (strcmp(name, "uring") == 0) {
+        return EV_BACKEND_URING;
+    }
+#endif
+
+    return ERROR_EVENT;
+}
+
+const char *EventLoop_backendName(int backend)
+{
+    switch (backend) {
+    case EV_BACKEND_SELECT:
+        return "select";
+    case EV_BACKEND_EPOLL:
+        return "epoll";
+    case EV_BACKEND_URING:
+        return "uring";
+    default:
+        return "unknown";
+    }
+}
+
+/* Static Functions --------------------------------------------------------- */
+
+/* grow_maps
+ *    Purpose: Makes sure the per-fd tables can be indexed by fd. Tables grow
+ *             geometrically, new slots are marked unregistered.
+ */
+static int grow_maps(EventLoop *loop, int fd)
+{
+    if ((size_t)fd < loop->map_sz) {
+        return 0;
+    }
+
+    size_t new_sz = (loop->map_sz == 0) ? EV_INIT_FDS : loop->map_sz;
+    while (new_sz <= (size_t)fd) {
+        new_sz *= 2;
+    }
+
+    int *interest = realloc(loop->interest, new_sz * sizeof(int));
+    if (interest == NULL) {
+        return -1;
+    }
+    loop->interest = interest;
+
+    unsigned char *ready_map = realloc(loop->ready_map, new_sz);
+    if (ready_map == NULL) {
+        return -1;
+    }
+    loop->ready_map = ready_map;
+
+#if HAVE_URING
+    if (loop->backend == EV_BACKEND_URING) {
+        UringFd *ufds = realloc(loop->ufds, new_sz * sizeof(UringFd));
+        if (ufds == NULL) {
+            return -1;
+        }
+        loop->ufds = ufds;
+
+        int *rearm = realloc(loop->rearm, new_sz * sizeof(int));
+        if (rearm == NULL) {
+            return -1;
+        }
+        loop->rearm = rearm;
+
+        int *starved = realloc(loop->starved, new_sz * sizeof(int));
+        if (starved == NULL) {
+            return -1;
+        }
+        loop->starved = starved;
+
+        for (size_t i = loop->map_sz; i < new_sz; i++) {
+            zero(&loop->ufds[i], sizeof(UringFd));
+            loop->ufds[i].peer = -1;
+        }
+    }
+#endif
+
+    for (size_t i = loop->map_sz; i < new_sz; i++) {
+        loop->interest[i]  = -1;
+        loop->ready_map[i] = 0;
+    }
+    loop->map_sz = new_sz;
+
+    return 0;
+}
+
+/* clear_ready
+ *    Purpose: Resets the readiness of the previous iteration, touching only
+ *             the descriptors that were reported.
+ */
+static void clear_ready(EventLoop *loop)
+{
+    for (int i = 0; i < loop->nready; i++) {
+        int fd = loop->ready[i].fd;
+        if ((size_t)fd < loop->map_sz) {
+            loop->ready_map[fd] = 0;
+        }
+    }
+    loop->nready = 0;
+}
+
+static int wait_select(EventLoop *loop, struct timeval *timeout)
+{
+    loop->readfds  = loop->master_rd;
+    loop->writefds = loop->master_wr;
+
+    STATS_ADD(loop_syscalls, 1);
+    int n = select(loop->fdmax + 1, &loop->readfds, &loop->writefds, NULL, timeout);
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        print_error("event: select failed");
+        return ERROR_EVENT;
+    }
+
+    for (int fd = 0; fd <= loop->fdmax && loop->nready < n; fd++) {
+        int events = 0;
+        if (FD_ISSET(fd, &loop->readfds)) {
+            events |= EV_READ;
+        }
+        if (FD_ISSET(fd, &loop->writefds)) {
+            events |= EV_WRITE;
+        }
+        if (events != 0) {
+            loop->ready[loop->nready].fd     = fd;
+            loop->ready[loop->nready].events = events;
+            loop->ready_map[fd]              = events;
+            loop->nready++;
+        }
+    }
+
+    STATS_ADD(events, loop->nready);
+    return loop->nready;
+}
+
+#if HAVE_EPOLL
+static int wait_epoll(EventLoop *loop, struct timeval *timeout)
+{
+    int timeout_ms = -1;
+    if (timeout != NULL) {
+        /* round up so a sub-millisecond timeout does not turn into a spin */
+        timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    }
+
+    STATS_ADD(loop_syscalls, 1);
+    int n = epoll_wait(loop->epfd, loop->ep_events, loop->max_events, timeout_ms);
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        print_error("event: epoll_wait failed");
+        return ERROR_EVENT;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int fd              = loop->ep_events[i].data.fd;
+        unsigned int revent = loop->ep_events[i].events;
+        int events          = 0;
+
+        /* hangups and errors are surfaced as readable so recv reports them */
+        if (revent & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+            events |= EV_READ;
+        }
+        if (revent & (EPOLLOUT | EPOLLERR)) {
+            events |= EV_WRITE;
+        }
+
+        loop->ready[loop->nready].fd     = fd;
+        loop->ready[loop->nready].events = events;
+        loop->ready_map[fd]              = events;
+        loop->nready++;
+    }
+
+    STATS_ADD(events, loop->nready);
+    return loop->nready;
+}
+
+static unsigned int to_epoll(int events)
+{
+    unsigned int ev = 0;
+    if (events & EV_READ) {
+        ev |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & EV_WRITE) {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+#endif
+
+#if HAVE_URING
+/* uring_init
+ *    Purpose: Hands the tunnel buffer pool to the kernel as one provided buffer
+ *             group. Buffers are picked by recv at completion time and given
+ *             back once the linked send has finished with them.
+ */
+static int uring_init(EventLoop *loop)
+{
+    loop->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SZ);
+    if (loop->bufs == NULL) {
+        return -1;
+    }
+
+    uring_provide(loop, 0, URING_BUF_COUNT);
+
+    return (Uring_submit(&loop->ring) < 0) ? -1 : 0;
+}
+
+static int wait_uring(EventLoop *loop, struct timeval *timeout)
+{
+    for (int i = 0; i < loop->nrearm; i++) {
+        int fd                  = loop->rearm[i];
+        loop->ufds[fd].queued = false;
+        uring_arm(loop, fd);
+    }
+    loop->nrearm = 0;
+
+    /* connections accepted but not handed out yet, do not block */
+    struct timeval poll_tv = {0, 0};
+    if (loop->accepted_head < loop->naccepted) {
+        timeout = &poll_tv;
+    }
+
+    unsigned long enters = loop->ring.enters;
+    unsigned long sqes   = loop->ring.sqes_submitted;
+
+    int ret = Uring_wait(&loop->ring, timeout);
+    STATS_ADD(loop_syscalls, loop->ring.enters - enters);
+    STATS_ADD(uring_sqes, loop->ring.sqes_submitted - sqes);
+    if (ret < 0) {
+        print_error("event: io_uring_enter failed");
+        return ERROR_EVENT;
+    }
+
+    /* one slot is kept for the listener below */
+    struct io_uring_cqe *cqe;
+    unsigned long ncqes = 0;
+    while (loop->nready < loop->max_events - 1 && (cqe = Uring_peekCqe(&loop->ring)) != NULL) {
+        struct io_uring_cqe c = *cqe;
+        Uring_seenCqe(&loop->ring);
+        uring_complete(loop, &c);
+        ncqes++;
+    }
+    STATS_ADD(uring_cqes, ncqes);
+
+    if ((loop->accepted_head < loop->naccepted || loop->accept_err != 0) && loop->listen_fd != -1) {
+        mark_ready(loop, loop->listen_fd, EV_READ);
+    }
+
+    STATS_ADD(events, loop->nready);
+    return loop->nready;
+}
+
+/* uring_arm
+ *    Purpose: Starts watching a registered fd according to its interest, a
+ *             multishot accept for listeners and a one-shot poll otherwise.
+ *             Does nothing if a request is already in flight or the fd is
+ *             being relayed.
+ */
+static void uring_arm(EventLoop *loop, int fd)
+{
+    UringFd *u   = &loop->ufds[fd];
+    int interest = loop->interest[fd];
+    if (interest <= 0 || u->armed || u->accepting || u->connecting || u->peer != -1) {
+        return;
+    }
+
+    struct io_uring_sqe *sqe = Uring_getSqe(&loop->ring);
+    if (sqe == NULL) {
+        print_error("event: submission queue full");
+        return;
+    }
+
+    if (interest & EV_ACCEPT) {
+        Uring_prepAccept(sqe, fd, SOCK_NONBLOCK | SOCK_CLOEXEC, UD(UOP_ACCEPT, u->gen, fd));
+        u->accepting = true;
+        return;
+    }
+
+    unsigned int mask = 0;
+    if (interest & EV_READ) {
+        mask |= POLLIN | POLLRDHUP;
+    }
+    if (interest & EV_WRITE) {
+        mask |= POLLOUT;
+    }
+    Uring_prepPollAdd(sqe, fd, mask, UD(UOP_POLL, u->gen, fd));
+    u->armed = true;
+}
+
+/* uring_retire
+ *    Purpose: Cancels everything in flight for an fd and bumps its generation
+ *             so completions that still arrive for it are discarded.
+ */
+static void uring_retire(EventLoop *loop, int fd)
+{
+    UringFd *u = &loop->ufds[fd];
+
+    unsigned long long targets[4];
+    int ntargets = 0;
+    if (u->armed) {
+        targets[ntargets++] = UD(UOP_POLL, u->gen, fd);
+    }
+    if (u->connecting) {
+        targets[ntargets++] = UD(UOP_CONNECT, u->gen, fd);
+    }
+    if (u->accepting) {
+        targets[ntargets++] = UD(UOP_ACCEPT, u->gen, fd);
+    }
+    if (u->peer != -1) {
+        /* a send heads the chain, the recv is either linked behind it or alone */
+        targets[ntargets++] = UD(UOP_SEND, u->gen, fd);
+        targets[ntargets++] = UD(UOP_RECV, u->gen, fd);
+    }
+
+    for (int i = 0; i < ntargets; i++) {
+        struct io_uring_sqe *sqe = Uring_getSqe(&loop->ring);
+        if (sqe != NULL) {
+            Uring_prepCancel(sqe, targets[i], UD(UOP_CANCEL, 0, fd));
+        }
+    }
+
+    u->armed      = false;
+    u->accepting  = false;
+    u->connecting = false;
+    u->peer       = -1;
+    u->gen++;
+}
+
+static void uring_recv(EventLoop *loop, int fd)
+{
+    struct io_uring_sqe *sqe = Uring_getSqe(&loop->ring);
+    if (sqe == NULL) {
+        relay_end(loop, fd);
+        return;
+    }
+
+    Uring_prepRecv(sqe, fd, URING_BUF_SZ, URING_BGID, UD(UOP_RECV, loop->ufds[fd].gen, fd));
+}
+
+/* uring_provide
+ *    Purpose: Returns nbufs buffers starting at bid to the buffer group. The
+ *             count travels in the generation bits so a cancelled provide can
+ *             be resubmitted as is.
+ */
+static void uring_provide(EventLoop *loop, int bid, int nbufs)
+{
+    struct io_uring_sqe *sqe = Uring_getSqe(&loop->ring);
+    if (sqe == NULL) {
+        print_error("event: could not return a provided buffer");
+        return;
+    }
+
+    Uring_prepProvide(sqe, loop->bufs + (size_t)bid * URING_BUF_SZ, URING_BUF_SZ, nbufs, URING_BGID, bid,
+                      UD(UOP_PROVIDE, nbufs, bid));
+}
+
+static void uring_complete(EventLoop *loop, struct io_uring_cqe *cqe)
+{
+    int op           = (int)(cqe->user_data >> 56);
+    unsigned int gen = (unsigned int)(cqe->user_data >> 32) & UD_GEN_MASK;
+    int fd           = (int)(cqe->user_data & 0xffffffffU);
+    int res          = cqe->res;
+
+    switch (op) {
+    case UOP_POLL: {
+        if (!uring_live(loop, fd, gen) || !loop->ufds[fd].armed) {
+            return;
+        }
+
+        UringFd *u = &loop->ufds[fd];
+        u->armed   = false;
+        if (!u->queued) {
+            u->queued                   = true;
+            loop->rearm[loop->nrearm++] = fd;
+        }
+
+        /* hangups and errors are surfaced as readable so recv reports them */
+        int events = 0;
+        if (res < 0 || (res & (POLLIN | POLLHUP | POLLERR | POLLRDHUP))) {
+            events |= EV_READ;
+        }
+        if (res > 0 && (res & (POLLOUT | POLLERR))) {
+            events |= EV_WRITE;
+        }
+        mark_ready(loop, fd, events);
+        break;
+    }
+    case UOP_ACCEPT: {
+        bool live = uring_live(loop, fd, gen) && loop->ufds[fd].accepting;
+        if (res >= 0) {
+            if (!live) {
+                close(res);
+            } else {
+                if (loop->naccepted == loop->accepted_sz) {
+                    int sz      = (loop->accepted_sz == 0) ? 64 : loop->accepted_sz * 2;
+                    int *queued = realloc(loop->accepted, sz * sizeof(int));
+                    if (queued == NULL) {
+                        close(res);
+                        break;
+                    }
+                    loop->accepted    = queued;
+                    loop->accepted_sz = sz;
+                }
+                loop->accepted[loop->naccepted++] = res;
+            }
+        } else if (live && res != -EAGAIN && res != -ECONNABORTED && res != -EINTR) {
+            /* surfaced to the owner like a failed accept(), out of
+             * descriptors it can pause the listener */
+            loop->accept_err = -res;
+        }
+
+        /* the multishot accept ended, arm a new one on the next wait */
+        if (live && !(cqe->flags & IORING_CQE_F_MORE)) {
+            UringFd *u   = &loop->ufds[fd];
+            u->accepting = false;
+            if (!u->queued) {
+                u->queued                   = true;
+                loop->rearm[loop->nrearm++] = fd;
+            }
+        }
+        break;
+    }
+    case UOP_CONNECT: {
+        if (!uring_live(loop, fd, gen) || !loop->ufds[fd].connecting) {
+            return;
+        }
+
+        /* reported like the writable poll that ends a connect elsewhere,
+         * polls resume on the next wait */
+        UringFd *u      = &loop->ufds[fd];
+        u->connecting   = false;
+        u->connect_err  = (res < 0) ? -res : 0;
+        if (!u->queued) {
+            u->queued                   = true;
+            loop->rearm[loop->nrearm++] = fd;
+        }
+        mark_ready(loop, fd, EV_WRITE);
+        break;
+    }
+    case UOP_RECV:
+        uring_relayed(loop, fd, gen, res, cqe->flags);
+        break;
+    case UOP_SEND:
+        if (uring_live(loop, fd, gen) && loop->ufds[fd].peer != -1 && res < loop->ufds[fd].send_len) {
+            relay_end(loop, fd);
+        }
+        break;
+    case UOP_PROVIDE:
+        if (res < 0) {
+            /* cut off by a failed send in its chain, the buffer is still ours */
+            if (res == -ECANCELED) {
+                uring_provide(loop, fd, (int)gen);
+            } else {
+                print_error("event: provide buffers failed");
+            }
+            return;
+        }
+
+        for (int i = 0; i < loop->nstarved; i++) {
+            int s                  = loop->starved[i];
+            loop->ufds[s].starved = false;
+            if (loop->ufds[s].peer != -1) {
+                uring_recv(loop, s);
+            }
+        }
+        loop->nstarved = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+/* uring_relayed
+ *    Purpose: Forwards the bytes a relay recv picked up. The send to the peer,
+ *             the return of the buffer and the next recv are submitted as one
+ *             linked chain, so the next recv cannot overtake the send and each
+ *             relayed buffer costs no syscall beyond the shared ring enter.
+ */
+static void uring_relayed(EventLoop *loop, int src, unsigned int gen, int res, unsigned int flags)
+{
+    int bid = (flags & IORING_CQE_F_BUFFER) ? (int)(flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    if (!uring_live(loop, src, gen) || loop->ufds[src].peer == -1) {
+        if (bid >= 0) {
+            uring_provide(loop, bid, 1);
+        }
+        return;
+    }
+
+    UringFd *u = &loop->ufds[src];
+    if (res == -ENOBUFS) {
+        /* every buffer is in flight, retried when one is returned */
+        if (!u->starved) {
+            u->starved                      = true;
+            loop->starved[loop->nstarved++] = src;
+        }
+        return;
+    }
+
+    if (res <= 0 || bid < 0) {
+        if (bid >= 0) {
+            uring_provide(loop, bid, 1);
+        }
+        relay_end(loop, src);
+        return;
+    }
+
+    if (Uring_reserve(&loop->ring, 3) != 0) {
+        uring_provide(loop, bid, 1);
+        relay_end(loop, src);
+        return;
+    }
+
+    char *buf                 = loop->bufs + (size_t)bid * URING_BUF_SZ;
+    struct io_uring_sqe *send = Uring_getSqe(&loop->ring);
+    Uring_prepSend(send, u->peer, buf, res, UD(UOP_SEND, u->gen, src));
+    send->flags |= IOSQE_IO_LINK;
+
+    struct io_uring_sqe *provide = Uring_getSqe(&loop->ring);
+    Uring_prepProvide(provide, buf, URING_BUF_SZ, 1, URING_BGID, bid, UD(UOP_PROVIDE, 1, bid));
+    provide->flags |= IOSQE_IO_LINK;
+
+    struct io_uring_sqe *recv = Uring_getSqe(&loop->ring);
+    Uring_prepRecv(recv, src, URING_BUF_SZ, URING_BGID, UD(UOP_RECV, u->gen, src));
+
+    u->send_len = res;
+    u->relayed += res;
+    STATS_ADD(tunnel_bytes, res);
+}
+
+static bool uring_live(EventLoop *loop, int fd, unsigned int gen)
+{
+    return fd >= 0 && (size_t)fd < loop->map_sz && (loop->ufds[fd].gen & UD_GEN_MASK) == gen;
+}
+
+/* relay_end
+ *    Purpose: Stops relaying from fd and reports it to the owner as closed.
+ *             The other direction keeps running until the owner removes both.
+ */
+static void relay_end(EventLoop *loop, int fd)
+{
+    loop->ufds[fd].peer = -1;
+    mark_ready(loop, fd, EV_READ | EV_CLOSED);
+}
+
+static void mark_ready(EventLoop *loop, int fd, int events)
+{
+    if (events == 0 || (size_t)fd >= loop->map_sz || loop->interest[fd] == -1) {
+        return;
+    }
+
+    if (loop->ready_map[fd] == 0) {
+        loop->ready[loop->nready].fd     = fd;
+        loop->ready[loop->nready].events = events;
+        loop->nready++;
+    }
+    loop->ready_map[fd] |= events;
+}
+#endif /* HAVE_URING */
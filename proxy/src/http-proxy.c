@@ -7,8 +7,8 @@
 
 int main(int argc, char **argv)
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <port> [select|epoll|uring] [workers]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -18,7 +18,27 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    Proxy_run(port);
+    int backend = DEFAULT_EV_BACKEND;
+    if (argc >= 3) {
+        backend = EventLoop_parseBackend(argv[2]);
+        if (backend < 0) {
+            fprintf(stderr, "Invalid event backend: %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int workers = DEFAULT_WORKERS;
+    if (argc == 4) {
+        workers = atoi(argv[3]);
+        if (workers < 0 || workers > MAX_WORKERS || (workers == 0 && strcmp(argv[3], "0") != 0)) {
+            fprintf(stderr, "Invalid worker count: %s\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (workers == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (ncpu < 1) ? 1 : (ncpu > MAX_WORKERS) ? MAX_WORKERS : (int)ncpu;
+    }
 
-    return EXIT_SUCCESS;
+    return (Proxy_run(port, backend, workers) == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
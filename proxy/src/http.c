@@ -17,7 +17,12 @@ static char *parse_port(char **host, size_t *host_l, char *path, size_t *port_l)
 static char *parse_version_req(char *header, size_t *version_l, char **saveptr);
 static char *parse_body(char *buffer, size_t buffer_l, size_t *body_l);
 static char *parse_version_res(char *header, size_t *version_l, char **saveptr);
+static bool parse_keepalive(Request *req, char *request);
 static void set_field(char **f, size_t *f_l, char *v, size_t v_l);
+static int frame_line(ResponseFrame *frame, char *line, size_t line_l);
+static int frame_field(ResponseFrame *frame, char *line);
+static void frame_body(ResponseFrame *frame);
+
 /* HTTP Functions ----------------------------------------------------------- */
 
 /* HTTP_add_field
@@ -58,15 +63,15 @@ int HTTP_add_field(char **buffer, size_t *buffer_l, char *field, char *value)
     // Critical security check: Prevent integer overflow in buffer size calculations
     // Each addition is checked separately to ensure no intermediate calculation can overflow
     // Without these checks, an attacker could cause buffer overflow through integer wraparound
-    if (header_l > SIZE_MAX - field_l || 
-        header_l + field_l > SIZE_MAX - value_l ||
-        header_l + field_l + value_l > SIZE_MAX - FIELD_SEP_L ||
-        header_l + field_l + value_l + FIELD_SEP_L > SIZE_MAX - CRLF_L) {
+    if (*buffer_l > SIZE_MAX - field_l || 
+        *buffer_l + field_l > SIZE_MAX - value_l ||
+        *buffer_l + field_l + value_l > SIZE_MAX - FIELD_SEP_L ||
+        *buffer_l + field_l + value_l + FIELD_SEP_L > SIZE_MAX - CRLF_L) {
         print_error("[http-add-field] buffer size overflow");
         return ERROR_FAILURE;
     }
 
-    new_buffer_l = header_l + field_l + value_l + FIELD_SEP_L + CRLF_L;
+    new_buffer_l = *buffer_l + field_l + value_l + FIELD_SEP_L + CRLF_L;
     char *new_buffer = calloc(new_buffer_l + 1, sizeof(char));
     // Check allocation success before proceeding to prevent memory errors
     if (new_buffer == NULL) {
@@ -126,6 +131,52 @@ bool HTTP_got_header(char *buffer)
     return true;
 }
 
+/* HTTP_request_length
+ *    Purpose: Finds where the first request in a buffer ends, its header and
+ *             a body of Content-Length bytes, so requests pipelined behind it
+ *             are left in place.
+ * Parameters: @buffer - buffer holding the request, must be null terminated
+ *             @buffer_l - length of the buffer
+ *    Returns: Length of the request, 0 if it has not arrived whole yet, or -1
+ *             if its length is invalid or it has a chunked body, which is not
+ *             supported.
+ */
+ssize_t HTTP_request_length(char *buffer, size_t buffer_l)
+{
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    char *end = strstr(buffer, HEADER_END);
+    if (end == NULL) {
+        return 0;
+    }
+
+    size_t header_l = end - buffer + HEADER_END_L;
+    size_t body_l   = 0;
+    for (char *line = strstr(buffer, CRLF); line != NULL && line < end; line = strstr(line, CRLF)) {
+        line += CRLF_L;
+        if (strncasecmp(line, CONTENTLENGTH, CONTENTLENGTH_L) == 0) {
+            char *value = line + CONTENTLENGTH_L;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+
+            char *value_end;
+            errno = 0;
+            unsigned long long n = strtoull(value, &value_end, 10);
+            if (!isdigit(*value) || errno == ERANGE || n > SSIZE_MAX - header_l) {
+                return -1;
+            }
+            body_l = (size_t)n;
+        } else if (strncasecmp(line, TRANSFERENCODING, TRANSFERENCODING_L) == 0) {
+            return -1;
+        }
+    }
+
+    return (header_l + body_l <= buffer_l) ? (ssize_t)(header_l + body_l) : 0;
+}
+
 int HTTP_validate_request(Request *req)
 {
     // Basic null checks to prevent segmentation faults
@@ -381,6 +432,7 @@ Response *Response_new(char *method, size_t method_l, char *uri, size_t uri_l, c
     if (response == NULL) {
         return NULL;
     }
+    response->refs = 1;
 
     response->uri_l = uri_l;
     response->uri   = calloc(uri_l + 1, sizeof(char));
@@ -409,7 +461,7 @@ Response *Response_new(char *method, size_t method_l, char *uri, size_t uri_l, c
 }
 
 /* Response_free
- *    Purpose: Frees the memory allocated to a Response.
+ *    Purpose: Drops a hold on a Response, the last one frees it.
  * Parameters: @response - Pointer to the Response to free
  *    Returns: None
  */
@@ -420,15 +472,85 @@ void Response_free(void *response)
     }
 
     Response *r = (Response *)response;
+    if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
     free(r->uri);
     free(r->version);
     free(r->status);
     free(r->cache_ctrl);
     free(r->body);
     free(r->raw);
+    free(r->head);
     free(r);
 }
 
+/* Response_hold
+ *    Purpose: Takes another hold on a Response, so it outlives its other
+ *             holders, e.g. a cached response evicted while a hit still
+ *             writes it. Each hold is dropped with Response_free.
+ * Parameters: @response - Pointer to the Response
+ *    Returns: The Response
+ */
+Response *Response_hold(Response *response)
+{
+    if (response != NULL) {
+        __atomic_add_fetch(&response->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    return response;
+}
+
+/* Response_freeze
+ *    Purpose: Prepares a Response for the cache, which shares it read-only
+ *             between hits. Its header block is kept without any Age field,
+ *             so a hit sends head, a fresh Age line, then raw from tail_off,
+ *             the blank line and body, without rebuilding the message.
+ * Parameters: @response - Pointer to the Response
+ *    Returns: 0 on success, -1 if the header is incomplete or memory
+ *             allocation fails.
+ */
+int Response_freeze(Response *response)
+{
+    if (response == NULL || response->raw == NULL) {
+        return -1;
+    }
+    if (response->head != NULL) {
+        return 0;
+    }
+
+    char *header_end = strstr(response->raw, HEADER_END);
+    if (header_end == NULL) {
+        return -1;
+    }
+    size_t tail_off = header_end - response->raw + CRLF_L;
+
+    char *head = malloc(tail_off + 1);
+    if (head == NULL) {
+        return -1;
+    }
+
+    /* copy the header a line at a time, dropping Age */
+    size_t head_l = 0;
+    char *line = response->raw;
+    while (line < response->raw + tail_off) {
+        char *eol = strstr(line, CRLF) + CRLF_L;
+        if (strncasecmp(line, "Age:", 4) != 0) {
+            memcpy(head + head_l, line, eol - line);
+            head_l += eol - line;
+        }
+        line = eol;
+    }
+    head[head_l] = '\0';
+
+    response->head     = head;
+    response->head_l   = head_l;
+    response->tail_off = tail_off;
+
+    return 0;
+}
+
 /* Response_copy
  *    Purpose: Creates a copy of a Response.
  * Parameters: @response - Pointer to the Response to copy
@@ -444,6 +566,7 @@ Response *Response_copy(Response *response)
     if (r == NULL) {
         return NULL;
     }
+    r->refs = 1;
 
     set_field(&r->uri, &r->uri_l, response->uri, response->uri_l);
     set_field(&r->version, &r->version_l, response->version, response->version_l);
@@ -451,6 +574,8 @@ Response *Response_copy(Response *response)
     set_field(&r->cache_ctrl, &r->cache_ctrl_l, response->cache_ctrl, response->cache_ctrl_l);
     set_field(&r->body, &r->body_l, response->body, response->body_l);
     set_field(&r->raw, &r->raw_l, response->raw, response->raw_l);
+    set_field(&r->head, &r->head_l, response->head, response->head_l);
+    r->tail_off = response->tail_off;
 
     r->max_age        = response->max_age;
     r->content_length = response->content_length;
@@ -526,6 +651,105 @@ int Response_compare(void *response1, void *response2)
     return (memcmp(r1->uri, r2->raw, r1->uri_l) == 0);
 }
 
+/* Framing Functions -------------------------------------------------------- */
+
+/* ResponseFrame_init
+ *    Purpose: Starts framing a response.
+ * Parameters: @frame - Pointer to the ResponseFrame
+ *             @head - Whether the request was HEAD
+ *    Returns: None
+ */
+void ResponseFrame_init(ResponseFrame *frame, bool head)
+{
+    if (frame == NULL) {
+        return;
+    }
+
+    zero(frame, sizeof(*frame));
+    frame->state = FRAME_STATUS;
+    frame->head  = head;
+}
+
+/* ResponseFrame_feed
+ *    Purpose: Advances the framing over the next bytes of the response. The
+ *             body is delimited, in order of precedence, by the request or
+ *             status (HEAD, 1xx, 204 and 304 have none), by the chunked
+ *             coding, by Content-Length, or else by the origin closing.
+ *             Interim 1xx responses are framed through to the final one.
+ * Parameters: @frame - Pointer to the ResponseFrame
+ *             @buf - Bytes received
+ *             @len - Number of bytes
+ *    Returns: Number of bytes that belong to the response, less than len
+ *             once it ended within buf, or -1 if the framing is invalid.
+ */
+ssize_t ResponseFrame_feed(ResponseFrame *frame, const char *buf, size_t len)
+{
+    if (frame == NULL || (buf == NULL && len > 0)) {
+        return -1;
+    }
+
+    size_t i = 0;
+    while (i < len && frame->state != FRAME_DONE) {
+        if (frame->state == FRAME_CLOSE) {
+            return len;
+        }
+
+        /* body bytes are counted, not looked at */
+        if (frame->state == FRAME_BODY || frame->state == FRAME_DATA) {
+            size_t n = (len - i < frame->left) ? len - i : frame->left;
+            i += n;
+            frame->left -= n;
+            if (frame->left == 0) {
+                frame->state = (frame->state == FRAME_BODY) ? FRAME_DONE : FRAME_DATA_END;
+            }
+            continue;
+        }
+
+        /* the other states are line based, only the start of a long line
+         * is kept as nothing of interest lies past it */
+        char c = buf[i++];
+        if (c != '\n') {
+            if (frame->line_l < FRAME_LINE_MAX - 1) {
+                frame->line[frame->line_l] = c;
+            }
+            frame->line_l++;
+            continue;
+        }
+
+        size_t line_l = frame->line_l;
+        if (line_l > FRAME_LINE_MAX - 1) {
+            line_l = FRAME_LINE_MAX - 1;
+        } else if (line_l > 0 && frame->line[line_l - 1] == '\r') {
+            line_l--;
+        }
+        frame->line[line_l] = '\0';
+        frame->line_l = 0;
+
+        if (frame_line(frame, frame->line, line_l) < 0) {
+            return -1;
+        }
+    }
+
+    return i;
+}
+
+/* ResponseFrame_done
+ *    Purpose: Checks if the response is complete.
+ */
+bool ResponseFrame_done(ResponseFrame *frame)
+{
+    return frame != NULL && frame->state == FRAME_DONE;
+}
+
+/* ResponseFrame_eof
+ *    Purpose: Checks if the origin closing now completes the response, and
+ *             does not truncate it.
+ */
+bool ResponseFrame_eof(ResponseFrame *frame)
+{
+    return frame != NULL && (frame->state == FRAME_CLOSE || frame->state == FRAME_DONE);
+}
+
 /* Raw Functions ------------------------------------------------------------ */
 
 /* Raw_request
@@ -713,6 +937,46 @@ static int parse_request(Request *req, char *buffer, size_t buffer_l)
     return 0;
 }
 
+/* parse_keepalive
+ *    Purpose: Decides whether the client keeps its connection open after the
+ *             response. HTTP/1.1 does unless Connection, or Proxy-Connection
+ *             which clients send proxies instead, has the close option, and
+ *             HTTP/1.0 only with the keep-alive option.
+ * Parameters: @req - Request whose start line was parsed
+ *             @request - The request header, lower cased and null terminated
+ *    Returns: true if the connection persists, false otherwise.
+ */
+static bool parse_keepalive(Request *req, char *request)
+{
+    bool keep_alive = (req->version != NULL && strcmp(req->version, "http/1.0") != 0);
+
+    char *end = strstr(request, HEADER_END);
+    for (char *line = strstr(request, CRLF); line != NULL && line < end; line = strstr(line, CRLF)) {
+        line += CRLF_L;
+        char *option;
+        if (strncmp(line, CONNECTION, CONNECTION_L) == 0) {
+            option = line + CONNECTION_L;
+        } else if (strncmp(line, PROXY_CONNECTION, PROXY_CONNECTION_L) == 0) {
+            option = line + PROXY_CONNECTION_L;
+        } else {
+            continue;
+        }
+
+        while (*option != '\r' && *option != '\0') {
+            option += strspn(option, " \t,");
+            size_t option_l = strcspn(option, " \t,\r");
+            if (option_l == 5 && strncmp(option, "close", 5) == 0) {
+                keep_alive = false;
+            } else if (option_l == 10 && strncmp(option, "keep-alive", 10) == 0) {
+                keep_alive = true;
+            }
+            option += option_l;
+        }
+    }
+
+    return keep_alive;
+}
+
 /* parse_response
  *    Purpose: Initializes a Response with a buffer containing an HTTP response
  * Parameters: @res - Pointer to a Response to initialize
@@ -884,6 +1148,7 @@ static int parse_request_fields(Request *req, char *buffer, size_t buffer_l)
     }
     req->port = parse_port(&req->host, &req->host_l, req->path, &req->port_l);
     req->body = parse_body(buffer, buffer_l, &req->body_l);
+    req->keep_alive = parse_keepalive(req, buffer);
 
     return EXIT_SUCCESS;
 }
@@ -1515,6 +1780,145 @@ static void set_field(char **f, size_t *f_l, char *v, size_t v_l)
     memcpy(*f, v, v_l);
 }
 
+/* frame_line
+ *    Purpose: Handles one complete line of a response being framed.
+ * Parameters: @frame - Pointer to the ResponseFrame
+ *             @line - The line without its CRLF, null terminated
+ *             @line_l - Length of the line
+ *    Returns: 0 on success, -1 if the line breaks the framing.
+ */
+static int frame_line(ResponseFrame *frame, char *line, size_t line_l)
+{
+    char *end;
+    unsigned long long n;
+
+    switch (frame->state) {
+    case FRAME_STATUS:
+        /* "HTTP/x.y NNN reason", the fields of an interim response reset */
+        end = strchr(line, ' ');
+        if (strncmp(line, "HTTP/", 5) != 0 || end == NULL || !isdigit(end[1]) ||
+            !isdigit(end[2]) || !isdigit(end[3]) || isdigit(end[4])) {
+            return -1;
+        }
+        frame->status     = (end[1] - '0') * 100 + (end[2] - '0') * 10 + (end[3] - '0');
+        frame->keep_alive = (strncmp(line, "HTTP/1.0", 8) != 0); // persistent from HTTP/1.1 on
+        frame->coded      = false;
+        frame->chunked    = false;
+        frame->has_length = false;
+        frame->state      = FRAME_HEADER;
+        return 0;
+
+    case FRAME_HEADER:
+        if (line_l == 0) {
+            frame_body(frame);
+            return 0;
+        }
+        return frame_field(frame, line);
+
+    case FRAME_SIZE:
+        /* hex size, then optional extensions after ';' */
+        errno = 0;
+        n = strtoull(line, &end, 16);
+        if (end == line || errno == ERANGE || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t')) {
+            return -1;
+        }
+        frame->left  = (size_t)n;
+        frame->state = (n == 0) ? FRAME_TRAILER : FRAME_DATA;
+        return 0;
+
+    case FRAME_DATA_END:
+        if (line_l != 0) {
+            return -1;
+        }
+        frame->state = FRAME_SIZE;
+        return 0;
+
+    case FRAME_TRAILER:
+        if (line_l == 0) {
+            frame->state = FRAME_DONE;
+        }
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+/* frame_field
+ *    Purpose: Picks up the header fields that frame the body, Content-Length
+ *             and Transfer-Encoding, and the close or keep-alive options of
+ *             Connection.
+ *    Returns: 0 on success, -1 if Content-Length is invalid or repeated with
+ *             a different value.
+ */
+static int frame_field(ResponseFrame *frame, char *line)
+{
+    if (strncasecmp(line, CONTENTLENGTH, CONTENTLENGTH_L) == 0) {
+        char *value = line + CONTENTLENGTH_L;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+
+        char *end;
+        errno = 0;
+        unsigned long long n = strtoull(value, &end, 10);
+        while (*end == ' ' || *end == '\t') {
+            end++;
+        }
+        if (!isdigit(*value) || errno == ERANGE || *end != '\0' ||
+            (frame->has_length && frame->length != (size_t)n)) {
+            return -1;
+        }
+        frame->has_length = true;
+        frame->length     = (size_t)n;
+    } else if (strncasecmp(line, TRANSFERENCODING, TRANSFERENCODING_L) == 0) {
+        /* only the final coding decides, a later field adds to the list */
+        char *coding = strrchr(line, ',');
+        coding = (coding != NULL) ? coding + 1 : line + TRANSFERENCODING_L;
+        while (*coding == ' ' || *coding == '\t') {
+            coding++;
+        }
+        size_t coding_l = strcspn(coding, " \t");
+        frame->coded   = true;
+        frame->chunked = (coding_l == strlen(CHUNKED) && strncasecmp(coding, CHUNKED, coding_l) == 0);
+    } else if (strncasecmp(line, CONNECTION, CONNECTION_L) == 0) {
+        char *option = line + CONNECTION_L;
+        while (*option != '\0') {
+            option += strspn(option, " \t,");
+            size_t option_l = strcspn(option, " \t,");
+            if (option_l == 5 && strncasecmp(option, "close", 5) == 0) {
+                frame->keep_alive = false;
+            } else if (option_l == 10 && strncasecmp(option, "keep-alive", 10) == 0) {
+                frame->keep_alive = true;
+            }
+            option += option_l;
+        }
+    }
+
+    return 0;
+}
+
+/* frame_body
+ *    Purpose: Decides how the body is delimited once the header ended.
+ *             Transfer-Encoding overrides Content-Length, and a coding other
+ *             than chunked is read until the origin closes.
+ */
+static void frame_body(ResponseFrame *frame)
+{
+    if (frame->status >= 100 && frame->status < 200 && frame->status != 101) {
+        frame->state = FRAME_STATUS; // the final response follows
+    } else if (frame->head || frame->status == 204 || frame->status == 304) {
+        frame->state = FRAME_DONE;
+    } else if (frame->coded) {
+        frame->state = frame->chunked ? FRAME_SIZE : FRAME_CLOSE;
+    } else if (frame->has_length) {
+        frame->left  = frame->length;
+        frame->state = (frame->length > 0) ? FRAME_BODY : FRAME_DONE;
+    } else {
+        frame->state = FRAME_CLOSE;
+    }
+}
+
 /* takes a (response) buffer of size buffer_l, and edits it to include 
    a style.color attribute for links (html anchor tags). Should instert style attribute BEFORE href attribute. 
    
@@ -0,0 +1,136 @@
+#include "keypool.h"
+
+#if RUN_SSL
+static void *refill_main(void *arg);
+static EVP_PKEY *generate(void);
+
+/* KeyPool_init
+ *    Purpose: Starts the refill thread, which fills the pool right away.
+ * Parameters: @pool - Pointer to the KeyPool
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if the thread did not start.
+ */
+int KeyPool_init(KeyPool *pool)
+{
+    if (pool == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(pool, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if (pthread_create(&pool->thread, NULL, refill_main, pool) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->cond);
+        return ERROR_FAILURE;
+    }
+    pool->started = true;
+
+    return EXIT_SUCCESS;
+}
+
+/* KeyPool_free
+ *    Purpose: Stops the refill thread and frees the keys still pooled. A pool
+ *             never started is left alone.
+ */
+void KeyPool_free(KeyPool *pool)
+{
+    if (pool == NULL || !pool->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(pool->thread, NULL);
+    pool->started = false;
+
+    STATS_SUB(key_pool_depth, pool->count);
+    while (pool->count > 0) {
+        EVP_PKEY_free(pool->keys[--pool->count]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+}
+
+/* KeyPool_take
+ *    Purpose: Hands out a ready key and wakes the refill thread. An empty
+ *             pool, under a burst of new hosts, falls back to generating the
+ *             key on the caller's thread.
+ * Parameters: @pool - Pointer to the KeyPool
+ *    Returns: A key owned by the caller, or NULL on failure.
+ */
+EVP_PKEY *KeyPool_take(KeyPool *pool)
+{
+    EVP_PKEY *key = NULL;
+
+    if (pool != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->count > 0) {
+            key = pool->keys[--pool->count];
+            STATS_SUB(key_pool_depth, 1);
+            pthread_cond_signal(&pool->cond);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (key == NULL) {
+        STATS_ADD(key_pool_misses, 1);
+        key = generate();
+    }
+
+    return key;
+}
+
+/* refill_main
+ *    Purpose: Refill thread, generates keys outside the lock until the pool
+ *             is full, then waits for one to be taken.
+ */
+static void *refill_main(void *arg)
+{
+    KeyPool *pool = (KeyPool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        if (pool->count == KEY_POOL_SZ) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        EVP_PKEY *key = generate();
+        gettimeofday(&end, NULL);
+        long usec = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+
+        pthread_mutex_lock(&pool->lock);
+        if (key == NULL) {
+            /* out of entropy or memory, callers generate their own meanwhile */
+            print_warning("keypool: key generation failed");
+            break;
+        }
+        STATS_ADD(keys_pooled, 1);
+        STATS_ADD(keygen_usec, (usec > 0) ? (unsigned long)usec : 0);
+        if (pool->stop || pool->count == KEY_POOL_SZ) {
+            EVP_PKEY_free(key);
+        } else {
+            pool->keys[pool->count++] = key;
+            STATS_ADD(key_pool_depth, 1);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static EVP_PKEY *generate(void)
+{
+#if CERT_LEAF_RSA
+    return EVP_RSA_gen(CERT_LEAF_RSA_BITS);
+#else
+    return EVP_EC_gen(CERT_LEAF_CURVE);
+#endif
+}
+#endif
@@ -0,0 +1,258 @@
+#include "outq.h"
+
+static void consume(OutQueue *q, size_t n);
+static void append(OutQueue *q, OutChunk *chunk);
+static void chunk_free(OutChunk *chunk);
+static const char *chunk_bytes(OutChunk *chunk);
+
+void OutQueue_init(OutQueue *q)
+{
+    if (q == NULL) {
+        return;
+    }
+
+    q->head   = NULL;
+    q->tail   = NULL;
+    q->pinned = NULL;
+    q->size   = 0;
+}
+
+/* OutQueue_clear
+ *    Purpose: Drops everything still queued.
+ * Parameters: @q - Pointer to the OutQueue
+ *    Returns: None
+ */
+void OutQueue_clear(OutQueue *q)
+{
+    if (q == NULL) {
+        return;
+    }
+
+    OutChunk *chunk = q->head;
+    while (chunk != NULL) {
+        OutChunk *next = chunk->next;
+        chunk_free(chunk);
+        chunk = next;
+    }
+    OutQueue_init(q);
+}
+
+/* OutQueue_push
+ *    Purpose: Copies len bytes to the end of the queue. Small writes are
+ *             appended to the last chunk while it has room.
+ * Parameters: @q - Pointer to the OutQueue
+ *             @buf - Bytes to queue
+ *             @len - Number of bytes
+ *    Returns: 0 on success, ERROR_FAILURE if memory allocation fails.
+ */
+int OutQueue_push(OutQueue *q, const char *buf, size_t len)
+{
+    if (q == NULL || (buf == NULL && len > 0)) {
+        return ERROR_FAILURE;
+    }
+
+    OutChunk *tail = q->tail;
+    if (tail != NULL && tail != q->pinned && tail->ref == NULL && tail->cap - tail->len >= len) {
+        memcpy(tail->data + tail->len, buf, len);
+        tail->len += len;
+        q->size += len;
+        return 0;
+    }
+
+    size_t cap      = (len > OUTQ_CHUNK_SZ) ? len : OUTQ_CHUNK_SZ;
+    OutChunk *chunk = malloc(sizeof(OutChunk) + cap);
+    if (chunk == NULL) {
+        return ERROR_FAILURE;
+    }
+    memcpy(chunk->data, buf, len);
+    chunk->len     = len;
+    chunk->cap     = cap;
+    chunk->ref     = NULL;
+    chunk->release = NULL;
+    append(q, chunk);
+
+    return 0;
+}
+
+/* OutQueue_pushRef
+ *    Purpose: Queues len bytes without copying them. They must stay valid
+ *             and unchanged until release(arg) is called, once they are
+ *             sent or the queue is cleared.
+ * Parameters: @q - Pointer to the OutQueue
+ *             @buf - Bytes to queue
+ *             @len - Number of bytes
+ *             @release - Called with arg when the queue is done with buf,
+ *                        may be NULL
+ *             @arg - Passed to release
+ *    Returns: 0 on success, ERROR_FAILURE if memory allocation fails, in
+ *             which case release is not called.
+ */
+int OutQueue_pushRef(OutQueue *q, const char *buf, size_t len, void (*release)(void *), void *arg)
+{
+    if (q == NULL || (buf == NULL && len > 0)) {
+        return ERROR_FAILURE;
+    }
+
+    OutChunk *chunk = malloc(sizeof(OutChunk));
+    if (chunk == NULL) {
+        return ERROR_FAILURE;
+    }
+    chunk->len     = len;
+    chunk->cap     = len;
+    chunk->ref     = buf;
+    chunk->release = release;
+    chunk->arg     = arg;
+    append(q, chunk);
+
+    return 0;
+}
+
+/* OutQueue_flush
+ *    Purpose: Writes as much of the queue as the socket accepts, up to
+ *             OUTQ_MAX_IOV chunks per writev, stopping at EAGAIN.
+ * Parameters: @q - Pointer to the OutQueue
+ *             @fd - Non-blocking socket to write to
+ *    Returns: Bytes written, or -1 with errno set on a write error.
+ */
+ssize_t OutQueue_flush(OutQueue *q, int fd)
+{
+    if (q == NULL || fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t total = 0;
+    while (q->head != NULL) {
+        struct iovec iov[OUTQ_MAX_IOV];
+        int iovcnt = 0;
+        for (OutChunk *c = q->head; c != NULL && iovcnt < OUTQ_MAX_IOV; c = c->next) {
+            iov[iovcnt].iov_base = (char *)chunk_bytes(c) + c->off;
+            iov[iovcnt].iov_len  = c->len - c->off;
+            iovcnt++;
+        }
+
+        STATS_ADD(io_syscalls, 1);
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+
+        consume(q, n);
+        total += n;
+    }
+
+    return total;
+}
+
+#if RUN_SSL
+/* OutQueue_flushSSL
+ *    Purpose: Same as OutQueue_flush over a TLS connection. A write that
+ *             wants to read or write is retried later with the same chunk,
+ *             which stays in place as OpenSSL requires.
+ * Parameters: @q - Pointer to the OutQueue
+ *             @ssl - TLS connection over a non-blocking socket
+ *    Returns: Bytes written, or -1 on a TLS or write error.
+ */
+ssize_t OutQueue_flushSSL(OutQueue *q, SSL *ssl)
+{
+    if (q == NULL || ssl == NULL) {
+        return -1;
+    }
+
+    /* a kernel TLS socket encrypts what is written to it, so the chunks go
+     * out with one writev and no copy through OpenSSL, unless a retried
+     * SSL_write still owns the head chunk */
+    if (q->pinned == NULL && BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+        return OutQueue_flush(q, SSL_get_fd(ssl));
+    }
+
+    ssize_t total = 0;
+    while (q->head != NULL) {
+        OutChunk *c = q->head;
+        STATS_ADD(io_syscalls, 1);
+        int n = SSL_write(ssl, chunk_bytes(c) + c->off, (int)(c->len - c->off));
+        if (n <= 0) {
+            int err = SSL_get_error(ssl, n);
+            if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+                q->pinned = c;
+                break;
+            }
+            return -1;
+        }
+
+        q->pinned = NULL;
+        consume(q, n);
+        total += n;
+    }
+
+    return total;
+}
+#endif
+
+size_t OutQueue_size(OutQueue *q)
+{
+    return (q == NULL) ? 0 : q->size;
+}
+
+bool OutQueue_isEmpty(OutQueue *q)
+{
+    return q == NULL || q->head == NULL;
+}
+
+/* Static Functions --------------------------------------------------------- */
+
+/* consume
+ *    Purpose: Drops n sent bytes from the front of the queue.
+ */
+static void consume(OutQueue *q, size_t n)
+{
+    q->size -= n;
+    while (n > 0 && q->head != NULL) {
+        OutChunk *c    = q->head;
+        size_t pending = c->len - c->off;
+        if (n < pending) {
+            c->off += n;
+            return;
+        }
+
+        n -= pending;
+        q->head = c->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        chunk_free(c);
+    }
+}
+
+static void append(OutQueue *q, OutChunk *chunk)
+{
+    chunk->next = NULL;
+    chunk->off  = 0;
+
+    if (q->tail == NULL) {
+        q->head = chunk;
+    } else {
+        q->tail->next = chunk;
+    }
+    q->tail = chunk;
+    q->size += chunk->len;
+}
+
+static void chunk_free(OutChunk *chunk)
+{
+    if (chunk->ref != NULL && chunk->release != NULL) {
+        chunk->release(chunk->arg);
+    }
+    free(chunk);
+}
+
+static const char *chunk_bytes(OutChunk *chunk)
+{
+    return (chunk->ref != NULL) ? chunk->ref : chunk->data;
+}
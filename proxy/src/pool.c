@@ -0,0 +1,399 @@
+#include "pool.h"
+
+/* Pool thread argument */
+typedef struct PoolThread {
+    Pool *pool;
+    int id;
+} PoolThread;
+
+static void *pool_main(void *arg);
+static PoolTask *pop_bottom(PoolDeque *deque);
+static PoolTask *steal_top(PoolDeque *deque);
+static int push_bottom(PoolDeque *deque, PoolTask *task);
+static void complete(PoolTask *task);
+
+/* Pool_new
+ *    Purpose: Starts a pool of nthreads offload threads. Each thread runs
+ *             tasks from its own deque and steals from the others when it
+ *             runs dry, so a burst submitted to one deque spreads out.
+ * Parameters: @nthreads - Number of threads, at least 1
+ *    Returns: Pointer to the Pool, or NULL on failure.
+ */
+Pool *Pool_new(int nthreads)
+{
+    if (nthreads < 1) {
+        return NULL;
+    }
+
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    pool->deques  = calloc(nthreads, sizeof(PoolDeque));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+
+    /* each thread frees its own argument */
+    pool->ndeques = nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        PoolThread *thread = malloc(sizeof(PoolThread));
+        if (thread == NULL) {
+            break;
+        }
+        thread->pool = pool;
+        thread->id   = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_main, thread) != 0) {
+            free(thread);
+            break;
+        }
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads == 0) {
+        Pool_free(&pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/* Pool_free
+ *    Purpose: Stops the pool once the tasks already submitted have run, then
+ *             frees it. Their completions stay on the completion queues.
+ * Parameters: @pool - Address of the Pool pointer, set to NULL
+ *    Returns: None
+ */
+void Pool_free(Pool **pool)
+{
+    if (pool == NULL || *pool == NULL) {
+        return;
+    }
+
+    Pool *p = *pool;
+    pthread_mutex_lock(&p->idle_lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->idle_cond);
+    pthread_mutex_unlock(&p->idle_lock);
+
+    for (int i = 0; i < p->nthreads; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+
+    for (int i = 0; i < p->ndeques; i++) {
+        pthread_mutex_destroy(&p->deques[i].lock);
+        free(p->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&p->idle_lock);
+    pthread_cond_destroy(&p->idle_cond);
+
+    free(p->threads);
+    free(p->deques);
+    free(p);
+    *pool = NULL;
+}
+
+/* Pool_submit
+ *    Purpose: Queues work(arg) on a pool thread. When it has run, the task
+ *             goes onto queue and done(arg, cancelled) runs on the reactor
+ *             draining that queue.
+ * Parameters: @pool - Pointer to the Pool
+ *             @queue - Completion queue of the calling reactor
+ *             @work - Runs on a pool thread, must not touch reactor state
+ *             @done - Runs on the reactor, always, and frees arg
+ *             @arg - Passed to work and done
+ *    Returns: The task, a handle for Pool_cancel, or NULL on failure in
+ *             which case neither callback runs.
+ */
+PoolTask *Pool_submit(Pool *pool, PoolQueue *queue, void (*work)(void *), void (*done)(void *, bool), void *arg)
+{
+    if (pool == NULL || queue == NULL || work == NULL || done == NULL) {
+        return NULL;
+    }
+
+    PoolTask *task = calloc(1, sizeof(PoolTask));
+    if (task == NULL) {
+        return NULL;
+    }
+    task->work  = work;
+    task->done  = done;
+    task->arg   = arg;
+    task->queue = queue;
+
+    unsigned int next = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    if (push_bottom(&pool->deques[next % pool->ndeques], task) != EXIT_SUCCESS) {
+        free(task);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    STATS_ADD(pool_tasks, 1);
+    return task;
+}
+
+/* Pool_cancel
+ *    Purpose: Marks a task cancelled, its done callback then only releases
+ *             arg. Called on the submitting reactor, e.g. when the client
+ *             waiting on the task closes.
+ */
+void Pool_cancel(PoolTask *task)
+{
+    if (task == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&task->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/* PoolQueue_init
+ *    Purpose: Initializes an empty completion queue and its wake-up fd.
+ * Parameters: @queue - Pointer to the PoolQueue
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if the fd could not be created.
+ */
+int PoolQueue_init(PoolQueue *queue)
+{
+    if (queue == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(queue, sizeof(*queue));
+    pthread_mutex_init(&queue->lock, NULL);
+
+#if HAVE_EVENTFD
+    queue->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    queue->wr_fd = queue->efd;
+    if (queue->efd < 0) {
+        return ERROR_FAILURE;
+    }
+#else
+    int fds[2];
+    if (pipe(fds) < 0) {
+        queue->efd = queue->wr_fd = -1;
+        return ERROR_FAILURE;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    queue->efd   = fds[0];
+    queue->wr_fd = fds[1];
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+/* PoolQueue_free
+ *    Purpose: Runs the done callbacks of the completions left on the queue
+ *             as cancelled, then closes the queue. The pool must be stopped.
+ */
+void PoolQueue_free(PoolQueue *queue)
+{
+    if (queue == NULL) {
+        return;
+    }
+
+    while (queue->head != NULL) {
+        PoolTask *task = queue->head;
+        queue->head    = task->next;
+        task->done(task->arg, true);
+        free(task);
+    }
+    queue->tail = NULL;
+
+    if (queue->wr_fd != queue->efd && queue->wr_fd >= 0) {
+        close(queue->wr_fd);
+    }
+    if (queue->efd >= 0) {
+        close(queue->efd);
+    }
+    queue->efd = queue->wr_fd = -1;
+    pthread_mutex_destroy(&queue->lock);
+}
+
+/* PoolQueue_drain
+ *    Purpose: Runs the done callbacks of the completed tasks, called by the
+ *             reactor when the queue's fd is readable.
+ * Parameters: @queue - Pointer to the PoolQueue
+ *    Returns: Number of completions handled.
+ */
+int PoolQueue_drain(PoolQueue *queue)
+{
+    if (queue == NULL) {
+        return 0;
+    }
+
+    /* reset the fd before taking the list, a completion pushed after the
+     * list was taken then always wakes the reactor again */
+#if HAVE_EVENTFD
+    uint64_t count;
+    STATS_ADD(io_syscalls, 1);
+    if (read(queue->efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        print_error("pool: failed to read completion eventfd");
+    }
+#else
+    char drain[64];
+    while (read(queue->efd, drain, sizeof(drain)) > 0) {
+    }
+#endif
+
+    pthread_mutex_lock(&queue->lock);
+    PoolTask *head = queue->head;
+    queue->head = queue->tail = NULL;
+    pthread_mutex_unlock(&queue->lock);
+
+    int n = 0;
+    while (head != NULL) {
+        PoolTask *task = head;
+        head           = task->next;
+        task->done(task->arg, __atomic_load_n(&task->cancelled, __ATOMIC_RELAXED));
+        free(task);
+        n++;
+    }
+
+    return n;
+}
+
+static void *pool_main(void *arg)
+{
+    PoolThread *self = (PoolThread *)arg;
+    Pool *pool       = self->pool;
+    int id           = self->id;
+    free(self);
+
+    while (true) {
+        /* own deque first, newest task while its data is still warm */
+        PoolTask *task = pop_bottom(&pool->deques[id]);
+        for (int i = 1; task == NULL && i < pool->ndeques; i++) {
+            task = steal_top(&pool->deques[(id + i) % pool->ndeques]);
+            if (task != NULL) {
+                STATS_ADD(pool_steals, 1);
+            }
+        }
+
+        if (task != NULL) {
+            pthread_mutex_lock(&pool->idle_lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->idle_lock);
+
+            task->work(task->arg);
+            complete(task);
+            continue;
+        }
+
+        /* sleep until a task is queued anywhere, leave once stopped and
+         * every queued task ran */
+        pthread_mutex_lock(&pool->idle_lock);
+        while (pool->queued == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        bool leave = (pool->queued == 0 && pool->stop);
+        pthread_mutex_unlock(&pool->idle_lock);
+        if (leave) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static PoolTask *pop_bottom(PoolDeque *deque)
+{
+    PoolTask *task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        deque->bottom--;
+        task = deque->tasks[deque->bottom % deque->cap];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+static PoolTask *steal_top(PoolDeque *deque)
+{
+    PoolTask *task = NULL;
+
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return NULL; // busy, try the next victim
+    }
+    if (deque->bottom != deque->top) {
+        task = deque->tasks[deque->top % deque->cap];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+static int push_bottom(PoolDeque *deque, PoolTask *task)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    /* grow the ring, keeping the tasks in order */
+    if (deque->bottom - deque->top == deque->cap) {
+        size_t cap       = (deque->cap == 0) ? POOL_DEQUE_INIT : deque->cap * 2;
+        PoolTask **tasks = calloc(cap, sizeof(PoolTask *));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return ERROR_FAILURE;
+        }
+        size_t n = deque->bottom - deque->top;
+        for (size_t i = 0; i < n; i++) {
+            tasks[i] = deque->tasks[(deque->top + i) % deque->cap];
+        }
+        free(deque->tasks);
+        deque->tasks  = tasks;
+        deque->cap    = cap;
+        deque->top    = 0;
+        deque->bottom = n;
+    }
+
+    deque->tasks[deque->bottom % deque->cap] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+
+    return EXIT_SUCCESS;
+}
+
+/* complete
+ *    Purpose: Hands a finished task to its reactor, the fd is only written
+ *             when the queue was empty as the reactor drains it whole.
+ */
+static void complete(PoolTask *task)
+{
+    PoolQueue *queue = task->queue;
+
+    pthread_mutex_lock(&queue->lock);
+    bool was_empty = (queue->head == NULL);
+    if (queue->tail != NULL) {
+        queue->tail->next = task;
+    } else {
+        queue->head = task;
+    }
+    queue->tail = task;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (was_empty) {
+#if HAVE_EVENTFD
+        uint64_t one = 1;
+        ssize_t n = write(queue->wr_fd, &one, sizeof(one));
+#else
+        ssize_t n = write(queue->wr_fd, "", 1);
+#endif
+        (void)n;
+    }
+}
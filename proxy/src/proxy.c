@@ -10,12 +10,95 @@
 
 /* Forward declarations */
 static char *get_key(Request *req);
-static Node *List_add(List *list, void *data);
-static int Query_connect(Query *query);
+static int Query_connect(EventLoop *loop, Query *query);
+static int watch_fd(Proxy *proxy, int fd, int events, Client *client, int role);
+static void unwatch_fd(Proxy *proxy, int fd);
+static void handle_sigusr1(int sig);
+static void arm_timeout(Proxy *proxy, Client *client);
+static int shared_init(ProxyShared *shared, int workers);
+static void shared_free(ProxyShared *shared);
+static void *worker_main(void *arg);
+static void halt_workers(ProxyShared *shared);
+static int wait_writable(int fd);
+static int flush_client(Proxy *proxy, Client *client);
+static int flush_query(Proxy *proxy, Client *client);
+static int drain_tunnel(Proxy *proxy, Client *client, bool to_client);
+static void update_interest(Proxy *proxy, Client *client);
+static int connect_upstream(Proxy *proxy, Client *client, int role, bool tls);
+static int retry_fresh(Proxy *proxy, Client *client);
+static bool is_connecting(Query *query);
+static bool query_ready(Proxy *proxy, Query *query);
+static int start_request(Proxy *proxy, Client *client);
+static int next_request(Proxy *proxy, Client *client);
+static void resolved(void *data, int status, struct in_addr addr, void *arg);
+static void expire_client(void *data, void *arg);
+static int offload(Proxy *proxy, Client *client, void (*work)(void *), void (*done)(void *, bool), void *arg);
+static void release_response(void *arg);
+static int take_response(Query *q, size_t n);
+static int end_response(Query *q);
+#if !RUN_COLOR
+static int stream_response(Proxy *proxy, Client *client);
+#endif
+#if RUN_CACHE
+static void cache_work(void *arg);
+static void cache_done(void *arg, bool cancelled);
+#endif
+#if RUN_COLOR
+static void color_work(void *arg);
+static void color_done(void *arg, bool cancelled);
+#endif
+#if RUN_SSL
+static void cert_work(void *arg);
+static void cert_done(void *arg, bool cancelled);
+#endif
+
+/* Set by SIGUSR1, the event loop prints the stats on its next iteration */
+static volatile sig_atomic_t dump_stats = 0;
 
 /* Buffer size */
 #define BUFFER_SIZE 8192
 
+/* Longest a send waits for a full non-blocking socket to drain */
+#define SEND_WAIT_MS 5000
+
+/* Proxy_accept result when the backlog is empty */
+#define ACCEPT_DRAINED 1
+
+/* Upstream connect in progress, the readiness or answer it waits for */
+#define CONNECT_WANT_WRITE 1
+#define CONNECT_WANT_READ  2
+#define CONNECT_WANT_DNS   3
+
+/* Stages run on the offload pool, work fills in the job off the worker and
+ * done hands the result back to it */
+#if RUN_CACHE
+typedef struct CacheJob {
+    ProxyShared *shared;
+    char *key;
+    Response *res; // Moved from the query, NULL once the cache owns it
+} CacheJob;
+#endif
+
+#if RUN_COLOR
+typedef struct ColorJob {
+    Proxy *proxy;
+    Client *client;
+    char *buf;     // Copy of the response, colored in place
+    size_t len;
+    int ret;
+} ColorJob;
+#endif
+
+#if RUN_SSL
+typedef struct CertJob {
+    Proxy *proxy;
+    Client *client;
+    char *hostname;
+    SSL *ssl;      // Created with the host's leaf certificate set
+    int ret;
+} CertJob;
+#endif
+
 /* Error codes */
 #define SELECT_ERROR -1
 #define SELECT_TIMEOUT 0
@@ -41,6 +124,7 @@ static int Query_connect(Query *query);
 #define PROXY_ERROR_FETCH -39
 #define PROXY_ERROR_BAD_GATEWAY -40
 #define PROXY_ERROR_BAD_METHOD -41
+#define PROXY_CACHE_MISS -42
 
 /* Types */
 #define CLIENT_TYPE 1
@@ -72,70 +156,61 @@ int ProxySSL_shutdown(Proxy *proxy, Client *client)
     return EXIT_SUCCESS;
 }
 
+/* ProxySSL_connect
+ *    Purpose: Runs the TLS handshake with the origin over the connected
+ *             non-blocking query socket. Called again on the readiness it
+ *             asked for until the handshake completes.
+ *    Returns: EXIT_SUCCESS once the server certificate is verified,
+ *             CONNECT_WANT_READ or CONNECT_WANT_WRITE while in progress, or
+ *             PROXY_ERROR_SSL.
+ */
 int ProxySSL_connect(Proxy *proxy, Query *query)
 {
-    if (proxy == NULL || query == NULL || query->req == NULL) {
+    if (proxy == NULL || query == NULL || query->req == NULL || query->socket < 0) {
         print_error("[proxy-ssl] invalid arguments");
         return PROXY_ERROR_SSL;
     }
 
-    query->socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (query->socket < 0) {
-        print_error("[proxy-ssl] socket creation failed");
-        return ERROR_SOCKET;
-    }
-
-    int flags = fcntl(query->socket, F_GETFL, 0);
-    if (flags < 0) {
-        print_error("[proxy-ssl] failed to get socket flags");
-        return ERROR_SOCKET_OPTION;
-    }
-
-    if (fcntl(query->socket, F_SETFL, flags | O_NONBLOCK) < 0) {
-        print_error("[proxy-ssl] failed to set non-blocking mode");
-        return ERROR_SOCKET_OPTION;
-    }
-
-    if (connect(query->socket, (struct sockaddr *)&query->server_addr, sizeof(query->server_addr)) < 0) {
-        print_error("[proxy-ssl] connect failed");
-        return ERROR_CONNECT;
-    }
-
-    // Create new SSL object for client
-    query->ssl = SSL_new(proxy->ctx);
     if (query->ssl == NULL) {
-        print_error("[proxy-ssl] SSL_new failed");
-        ERR_print_errors_fp(stderr);
-        return PROXY_ERROR_SSL;
-    }
+        // Create new SSL object for the origin from the client side context
+        query->ssl = SSL_new(proxy->shared->upstream_ctx);
+        if (query->ssl == NULL) {
+            print_error("[proxy-ssl] SSL_new failed");
+            ERR_print_errors_fp(stderr);
+            return PROXY_ERROR_SSL;
+        }
 
-    // Set up SSL connection
-    SSL_set_fd(query->ssl, query->socket);
-    // Enable hostname verification
-    X509_VERIFY_PARAM *param = SSL_get0_param(query->ssl);
-    X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_WILDCARDS);
-    if (!X509_VERIFY_PARAM_set1_host(param, query->req->host, query->req->host_l)) {
-        print_error("[proxy-ssl] failed to set verification hostname");
-        return PROXY_ERROR_SSL;
-    }
+        // Set up SSL connection, named for SNI, resuming an earlier session
+        SSL_set_fd(query->ssl, query->socket);
+        if (!SSL_set_tlsext_host_name(query->ssl, query->req->host)) {
+            print_error("[proxy-ssl] failed to set server name");
+            return PROXY_ERROR_SSL;
+        }
+        SessionCache_prepare(&proxy->shared->sessions, query->ssl, query->req->host, query->req->port);
+        // Enable hostname verification
+        X509_VERIFY_PARAM *param = SSL_get0_param(query->ssl);
+        X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_WILDCARDS);
+        if (!X509_VERIFY_PARAM_set1_host(param, query->req->host, query->req->host_l)) {
+            print_error("[proxy-ssl] failed to set verification hostname");
+            return PROXY_ERROR_SSL;
+        }
 
-    // Set SSL verification mode
-    SSL_set_verify(query->ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+        // Set SSL verification mode
+        SSL_set_verify(query->ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    }
 
-    // Perform SSL handshake
+    // Perform SSL handshake, a step at a time
+    STATS_ADD(io_syscalls, 1);
     int ret = SSL_connect(query->ssl);
     if (ret <= 0) {
         int ssl_error = SSL_get_error(query->ssl, ret);
-        print_error("[proxy-ssl] SSL_connect failed");
-        ERR_print_errors_fp(stderr);
-        
         switch (ssl_error) {
-            case SSL_ERROR_ZERO_RETURN:
-                print_error("[proxy-ssl] SSL connection closed cleanly");
-                break;
             case SSL_ERROR_WANT_READ:
+                return CONNECT_WANT_READ;
             case SSL_ERROR_WANT_WRITE:
-                print_error("[proxy-ssl] SSL operation needs to be retried");
+                return CONNECT_WANT_WRITE;
+            case SSL_ERROR_ZERO_RETURN:
+                print_error("[proxy-ssl] SSL connection closed cleanly");
                 break;
             case SSL_ERROR_SYSCALL:
                 print_error("[proxy-ssl] I/O error occurred");
@@ -143,25 +218,31 @@ int ProxySSL_connect(Proxy *proxy, Query *query)
             default:
                 print_error("[proxy-ssl] SSL error occurred");
         }
-        
+
+        print_error("[proxy-ssl] SSL_connect failed");
+        ERR_print_errors_fp(stderr);
         return PROXY_ERROR_SSL;
     }
 
-    // Verify the certificate
-    X509 *cert = SSL_get_peer_certificate(query->ssl);
-    if (cert == NULL) {
+    // Verify the certificate, the outcome may come from the verification cache
+    if (SSL_get0_peer_certificate(query->ssl) == NULL) {
         print_error("[proxy-ssl] server did not present a certificate");
         return PROXY_ERROR_SSL;
     }
-    
+
     long verify_result = SSL_get_verify_result(query->ssl);
     if (verify_result != X509_V_OK) {
         print_error("[proxy-ssl] certificate verification failed");
-        X509_free(cert);
         return PROXY_ERROR_SSL;
     }
-    
-    X509_free(cert);
+
+    STATS_ADD(tls_handshakes, 1);
+    if (SSL_session_reused(query->ssl)) {
+        STATS_ADD(tls_resumed, 1);
+    }
+    if (BIO_get_ktls_send(SSL_get_wbio(query->ssl))) {
+        STATS_ADD(ktls_conns, 1);
+    }
     return EXIT_SUCCESS;
 }
 
@@ -175,37 +256,42 @@ int ProxySSL_read(void *sender, int sender_type)
     Query *q;
     Client *c;
     ssize_t n;
+    int ret;
     switch (sender_type) {
     case QUERY_TYPE:
         q = (Query *)sender;
-        n = SSL_read(q->ssl, q->buffer + q->buffer_l, q->buffer_sz - q->buffer_l);
+        q->ssl_want_write = false;
+        /* a record decrypted past the buffer stays inside OpenSSL where no
+         * readiness reports it, take all of it now */
+        do {
+            n = SSL_read(q->ssl, q->buffer + q->buffer_l, q->buffer_sz - q->buffer_l);
 #if DEBUG
-        print_debug("[proxyssl-read] reading from query ssl socket");
-        fprintf(stderr, "[proxyssl-read] query ssl bytes read: %ld\n", n);
-        print_ascii(q->buffer + q->buffer_l, n);
+            print_debug("[proxyssl-read] reading from query ssl socket");
+            fprintf(stderr, "[proxyssl-read] query ssl bytes read: %ld\n", n);
+            print_ascii(q->buffer + q->buffer_l, n);
 #endif
-        if (n <= 0) {
-            print_error("proxy: recv failed");
-            perror("recv");
-            return PROXY_ERROR_SSL;
-
-        } else if (n < (ssize_t)(q->buffer_sz - q->buffer_l)) {
-            q->buffer_l += n;
-            q->res =
-                Response_new(q->req->method, q->req->method_l, q->req->path, q->req->path_l, q->buffer, q->buffer_l);
-            if (q->res == NULL) {
-                print_error("proxy: failed to create response");
-                return INVALID_RESPONSE;
-            }
-            q->state = QRY_RECVD_RESPONSE;
-            return SERVER_RESP_RECVD;
-        } else {
-            q->buffer_l += n;
-            if (q->buffer_l == q->buffer_sz) {
-                expand_buffer(&q->buffer, &q->buffer_l, &q->buffer_sz);
+            if (n <= 0) {
+                switch (SSL_get_error(q->ssl, n)) {
+                    case SSL_ERROR_WANT_READ:
+                        return (int)q->buffer_l;
+                    case SSL_ERROR_WANT_WRITE:
+                        q->ssl_want_write = true;
+                        return (int)q->buffer_l;
+                    case SSL_ERROR_ZERO_RETURN:
+                        if (ResponseFrame_eof(&q->frame)) {
+                            return end_response(q);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                print_error("proxy: recv failed");
+                perror("recv");
+                return PROXY_ERROR_SSL;
             }
-        }
-        break;
+            ret = take_response(q, n);
+        } while (ret >= 0 && q->state == QRY_SENT_REQUEST && SSL_pending(q->ssl) > 0);
+        return ret;
     case CLIENT_TYPE:
         c = (Client *)sender;
         n = SSL_read(c->ssl, c->buffer + c->buffer_l, c->buffer_sz - c->buffer_l);
@@ -245,6 +331,10 @@ int ProxySSL_read(void *sender, int sender_type)
     return n;
 }
 
+/* ProxySSL_write
+ *    Purpose: Queues bytes for a TLS client, see Proxy_write.
+ *    Returns: len on success, ERROR_FAILURE on failure.
+ */
 int ProxySSL_write(Proxy *proxy, Client *client, char *buf, int len)
 {
     if (proxy == NULL || client == NULL || buf == NULL || len < 0) {
@@ -256,27 +346,23 @@ int ProxySSL_write(Proxy *proxy, Client *client, char *buf, int len)
     fprintf(stderr, "[proxyssl-write] bytes to write: %d\n", len);
     print_ascii(buf, len);
 #endif
-    ssize_t written  = 0;
-    ssize_t to_write = len;
-    int ret;
-    while (to_write > 0) {
-        fprintf(stderr, "[proxyssl-write] bytes written: %d\n", ret);
-        ret = SSL_write(client->ssl, buf + written, to_write);
-        if (ret <= 0) {
-            int err = SSL_get_error(client->ssl, ret);
-            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-                continue;
-            }
-            print_error("proxy_sslwrite: SSL_write failed");
-            return ERROR_FAILURE;
-        } else {
-            to_write -= ret;
-        }
+
+    if (Proxy_write(proxy, client, buf, len) != EXIT_SUCCESS) {
+        print_error("proxy_sslwrite: SSL_write failed");
+        return ERROR_FAILURE;
     }
 
-    return written;
+    return len;
 }
 
+/* ProxySSL_handshake
+ *    Purpose: Runs the TLS handshake with an intercepted client. The first
+ *             call mints the leaf on the offload pool, later ones advance
+ *             SSL_accept as far as the non-blocking socket allows and wait
+ *             for the readiness it asked for. SSL_TIMEOUT bounds the whole.
+ *    Returns: EXIT_SUCCESS while in progress or once established,
+ *             INVALID_REQUEST, ERROR_FAILURE or PROXY_ERROR_SSL.
+ */
 int ProxySSL_handshake(Proxy *proxy, Client *client)
 {
     if (proxy == NULL) {
@@ -284,137 +370,124 @@ int ProxySSL_handshake(Proxy *proxy, Client *client)
         return ERROR_FAILURE;
     }
 
-    /* configure context */
-    char *hostname = client->query->req->host;
-    if (hostname == NULL) {
-        return INVALID_REQUEST;
-    }
+    /* the leaf for the CONNECT host is minted on the offload pool the first
+     * time the host is seen, the handshake resumes once the SSL object has it */
+    if (client->ssl == NULL) {
+        if (client->task != NULL) {
+            return EXIT_SUCCESS;
+        }
 
-    /* update proxy ext file ad context if needed */
-    if (ProxySSL_updateExtFile(proxy, hostname) != EXIT_SUCCESS) {
-        return ERROR_FAILURE;
+        char *hostname = client->query->req->host;
+        if (hostname == NULL) {
+            return INVALID_REQUEST;
+        }
+
+        CertJob *job = calloc(1, sizeof(CertJob));
+        if (job == NULL) {
+            return ERROR_FAILURE;
+        }
+        gettimeofday(&client->ssl_start, NULL);
+        job->proxy    = proxy;
+        job->client   = client;
+        job->hostname = strdup(hostname);
+        if (job->hostname == NULL || offload(proxy, client, cert_work, cert_done, job) != EXIT_SUCCESS) {
+            free(job->hostname);
+            free(job);
+            return ERROR_FAILURE;
+        }
+
+        /* the handshake has SSL_TIMEOUT to complete, activity does not extend it */
+        arm_timeout(proxy, client);
+        return EXIT_SUCCESS;
     }
 
-    /* create new SSL object for client */
-#if DEBUG
-    print_debug("[proxyssl-handshake] creating new SSL object");
-#endif
-    client->ssl = SSL_new(proxy->ctx);
-    SSL_set_fd(client->ssl, client->socket);
+    /* accept, a step at a time as the socket is ready, the timer armed
+     * above bounds the whole handshake */
+    STATS_ADD(io_syscalls, 1);
+    int ret = SSL_accept(client->ssl);
+    client->ssl_want_write = false;
+    if (ret <= 0) {
+        switch (SSL_get_error(client->ssl, ret)) {
+            case SSL_ERROR_WANT_READ:
+                update_interest(proxy, client);
+                return EXIT_SUCCESS;
+            case SSL_ERROR_WANT_WRITE:
+                client->ssl_want_write = true;
+                update_interest(proxy, client);
+                return EXIT_SUCCESS;
+            default:
+                break;
+        }
 
-    /* accept */
-    if (SSL_accept(client->ssl) == -1) {
         ERR_print_errors_fp(stderr);
         print_error("proxyssl-handshake: ssl/tls handshake failed");
-        /* stop SSL */
-        SSL_shutdown(client->ssl);
+        /* stop SSL, no close_notify after a failed handshake */
         SSL_free(client->ssl);
         client->ssl   = NULL;
         client->isSSL = 0;
         return PROXY_ERROR_SSL;
     } else {
         print_success("proxyssl-handshake: ssl/tls connection established!");
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long usec = (now.tv_sec - client->ssl_start.tv_sec) * 1000000L + (now.tv_usec - client->ssl_start.tv_usec);
+        STATS_ADD(client_tls, 1);
+        STATS_ADD(client_tls_usec, (usec > 0) ? (unsigned long)usec : 0);
+        if (SSL_session_reused(client->ssl)) {
+            STATS_ADD(client_resumed, 1);
+        }
+        if (BIO_get_ktls_send(SSL_get_wbio(client->ssl))) {
+            STATS_ADD(ktls_conns, 1);
+        }
         client->isSSL = 1;
         client->state = CLI_QUERY;
         Query_free(client->query);
-        client->query = NULL;
+        client->query      = NULL;
+        client->hasRequest = false;
+        client->req_l      = 0;
         clear_buffer(client->buffer, &client->buffer_l);
     }
 
-    /* update last active time to now */
+    /* update last active time to now, back to the idle timeout */
     Client_timestamp(client);
+    arm_timeout(proxy, client);
+    update_interest(proxy, client);
 
     return EXIT_SUCCESS;
 }
 
-int ProxySSL_updateExtFile(Proxy *proxy, char *hostname)
-{
-    if (proxy == NULL || hostname == NULL) {
-        print_error("proxyssl: failed to update extension file - invalid args");
-        return ERROR_FAILURE;
-    }
-
-    int ret;
-    fprintf(stderr, "proxyssl: updating extension file for %s\n",
-            hostname); // TODO
-
-    /* update proxy ext file */
-    char command[BUFFER_SZ + 1];
-    zero(command, BUFFER_SZ + 1);
-    snprintf(command, BUFFER_SZ, "%s %s", UPDATE_PROXY_CERT, hostname);
-    if ((ret = system(command)) < 0) {
-        print_error("proxyssl: failed to update extension file - system call failed");
-        return ERROR_FAILURE;
-    } else if (ret > 0) {
-        /* update proxy context */
-        if (ProxySSL_updateContext(proxy) == ERROR_FAILURE) {
-            print_error("proxyssl: failed to update extension file - update "
-                        "ctx failed");
-            return ERROR_FAILURE;
-        }
-    }
-
-    return EXIT_SUCCESS;
-}
-
-int ProxySSL_updateContext(Proxy *proxy)
-{
-    if (proxy == NULL) {
-        return ERROR_FAILURE;
-    }
-
-    /* update proxy context */
-    SSL_CTX_free(proxy->ctx);
-    proxy->ctx = InitServerCTX();
-    if (proxy->ctx == NULL) {
-        print_error("proxy: failed to update context - InitServerCTX failed");
-        return ERROR_FAILURE;
-    }
-
-    if (LoadCertificates(proxy->ctx, PROXY_CERT, PROXY_KEY) == ERROR_FAILURE) {
-        print_error("proxy: failed to update context - LoadCertificates failed");
-        return ERROR_FAILURE;
-    }
-
-    return EXIT_SUCCESS;
-}
 #endif /* RUN_SSL */
 
-static short select_loop(Proxy *proxy) {
+static short event_loop(Proxy *proxy) {
     if (proxy == NULL) {
         return ERROR_FAILURE;
     }
 
-    int select_ret;
+    int nready, ret;
     while (1) {
-        /* Copy master set to read set */
-        proxy->readfds = proxy->master_set;
+        /* Wait for activity on registered sockets */
+        nready = EventLoop_wait(proxy->loop, proxy->timeout);
+        if (nready < 0) {
+            print_error("proxy: event wait failed");
+            return PROXY_ERROR_SELECT;
+        }
 
-        /* Check for timeouts and update timeout value */
+        /* Check for timeouts and update timeout value, this also brings the
+         * timer wheel's clock up to date for the handlers */
         if (Proxy_handleTimeout(proxy) == ERROR_FAILURE) {
             return ERROR_FAILURE;
         }
 
-        /* Wait for activity on sockets */
-        select_ret = select(proxy->fdmax + 1, &proxy->readfds, NULL, NULL, proxy->timeout);
-        if (select_ret == -1) {
-            if (errno == EINTR) {
-                continue;
-            }
-            print_error("proxy: select failed");
-            return PROXY_ERROR_SELECT;
-        }
-
-        /* Check for activity on listening socket */
-        if (FD_ISSET(proxy->listen_fd, &proxy->readfds)) {
-            if (Proxy_handleListener(proxy) < 0) {
-                print_error("proxy: failed to handle listener");
-                return ERROR_FAILURE;
-            }
+        if (dump_stats) {
+            dump_stats = 0;
+            Stats_print(stderr);
         }
 
-        /* Handle client activity */
-        if (Proxy_handle(proxy) < 0) {
+        /* Dispatch ready sockets */
+        ret = Proxy_handle(proxy);
+        if (ret == HALT) {
+            return HALT;
+        } else if (ret < 0) {
             print_error("proxy: failed to handle clients");
             return ERROR_FAILURE;
         }
@@ -423,9 +496,10 @@ static short select_loop(Proxy *proxy) {
     return EXIT_SUCCESS;
 }
 
-int Proxy_run(short port) {
-    struct Proxy proxy;
+int Proxy_run(short port, int backend, int workers) {
+    ProxyShared shared;
     signal(SIGPIPE, SIG_IGN); // ignore SIGPIPE (broken pipe error)
+    signal(SIGUSR1, handle_sigusr1); // print stats
 
     /* Initialize SSL */
 #if RUN_SSL
@@ -438,26 +512,61 @@ int Proxy_run(short port) {
     OpenSSL_add_all_algorithms();
 #endif
 
-    /* Initialize Proxy */
-    Proxy_init(&proxy, port);
-
-    /* Bind & Listen Proxy Socket */
-    if (Proxy_listen(&proxy) < 0) {
-        print_error("proxy: failed to listen");
+    /* Initialize state shared by the workers */
+    if (shared_init(&shared, workers) < 0) {
+        print_error("proxy: failed to initialize");
         return ERROR_FAILURE;
     }
 
-    /* Select Loop */
-    short ret = select_loop(&proxy);
+    /* Initialize each worker and its own listening socket, the kernel spreads
+     * incoming connections over the sockets bound with SO_REUSEPORT */
+    for (int i = 0; i < workers; i++) {
+        Proxy *worker = &shared.workers[i];
+        worker->id = i;
+        if (Proxy_init(worker, port, backend, &shared) < 0) {
+            print_error("proxy: failed to initialize");
+            shared_free(&shared);
+            return ERROR_FAILURE;
+        }
+
+        if (Proxy_listen(worker) < 0) {
+            print_error("proxy: failed to listen");
+            shared_free(&shared);
+            return ERROR_FAILURE;
+        }
+    }
+
+    /* Event Loops, worker 0 runs on this thread */
+    fprintf(stderr, "proxy: listening on port %d using %s with %d worker%s\n", port,
+            EventLoop_backendName(backend), workers, (workers == 1) ? "" : "s");
+    int started = 1;
+    for (int i = 1; i < workers; i++, started++) {
+        if (pthread_create(&shared.workers[i].thread, NULL, worker_main, &shared.workers[i]) != 0) {
+            print_error("proxy: failed to start worker");
+            break;
+        }
+    }
+
+    int ret = (started == workers) ? event_loop(&shared.workers[0]) : ERROR_FAILURE;
+    halt_workers(&shared);
+    for (int i = 1; i < started; i++) {
+        void *worker_ret = NULL;
+        pthread_join(shared.workers[i].thread, &worker_ret);
+        if ((intptr_t)worker_ret != HALT) {
+            ret = ERROR_FAILURE;
+        }
+    }
+
     if (ret == HALT) {
         print_info("proxy: shutting down");
-        Proxy_free(&proxy);
+        Stats_print(stderr);
+        shared_free(&shared);
         return EXIT_SUCCESS;
     }
 
     /* Shutdown Proxy */
     print_error("proxy: failed and cannot recover");
-    Proxy_free(&proxy);
+    shared_free(&shared);
 
     return EXIT_FAILURE;
 }
@@ -472,7 +581,11 @@ ssize_t Proxy_send(int socket, char *buffer, size_t buffer_l) {
     size_t to_write = buffer_l;
 
     while ((size_t)written < buffer_l) {
+        STATS_ADD(io_syscalls, 1);
         n = send(socket, buffer + written, to_write, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(socket) == 0) {
+            continue;
+        }
         if (n <= 0) {
             if (errno == EPIPE) {
                 print_error("proxy-send: broken pipe");
@@ -502,35 +615,27 @@ ssize_t Proxy_recv(void *sender, int sender_type) {
     switch (sender_type) {
         case QUERY_TYPE:
             q = (Query *)sender;
+            STATS_ADD(io_syscalls, 1);
             n = recv(q->socket, q->buffer + q->buffer_l, q->buffer_sz - q->buffer_l, 0);
-            if (n == 0) {
-                q->res = Response_new(q->req->method, q->req->method_l, q->req->path, q->req->path_l, q->buffer, q->buffer_l);
-                if (q->res == NULL) {
-                    return INVALID_RESPONSE;
-                }
-                q->state = QRY_RECVD_RESPONSE;
-                return SERVER_RESP_RECVD;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return (ssize_t)q->buffer_l;
+            } else if (n == 0) {
+                /* a close only ends a response delimited by it */
+                return ResponseFrame_eof(&q->frame) ? end_response(q) : INVALID_RESPONSE;
             } else if (n < 0) {
                 return PROXY_ERROR_RECV;
             }
-            q->buffer_l += n;
-            if (q->buffer_l == q->buffer_sz) {
-                if (expand_buffer(&q->buffer, &q->buffer_l, &q->buffer_sz) < 0) {
-                    return ERROR_FAILURE;
-                }
-            }
-            total_bytes = (ssize_t)q->buffer_l;
-            break;
+            return take_response(q, n);
 
         case CLIENT_TYPE:
             c = (Client *)sender;
+            STATS_ADD(io_syscalls, 1);
             n = recv(c->socket, c->buffer + c->buffer_l, c->buffer_sz - c->buffer_l, 0);
-            if (n == 0) {
-                if (errno == ECONNRESET) {
-                    c->state = CLI_CLOSE;
-                    return CLIENT_CLOSE;
-                }
-                return EXIT_SUCCESS;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return (ssize_t)c->buffer_l;
+            } else if (n == 0) {
+                c->state = CLI_CLOSE;
+                return CLIENT_CLOSE;
             } else if (n < 0) {
                 return PROXY_ERROR_RECV;
             }
@@ -571,64 +676,140 @@ int Proxy_serveFromCache(Proxy *proxy, Client *client, long age, char *key) {
         return ERROR_FAILURE;
     }
 
-    Response *response = Cache_get(proxy->cache, key);
+    /* The cached response is immutable, so it is queued by reference as
+     * header block, Age line, then blank line and body, and written with one
+     * writev. Each reference holds the response past a concurrent eviction */
+    pthread_mutex_lock(&proxy->shared->cache_lock);
+    Response *response = Cache_get(proxy->shared->cache, key);
     if (response == NULL) {
+        pthread_mutex_unlock(&proxy->shared->cache_lock);
+        return PROXY_CACHE_MISS;
+    }
+    if (response->head == NULL) {
+        pthread_mutex_unlock(&proxy->shared->cache_lock);
         return ERROR_FAILURE;
     }
+    Response_hold(response);
+    Response_hold(response);
+    pthread_mutex_unlock(&proxy->shared->cache_lock);
 
-    /* Add Age header to response */
-    char age_str[32];
-    snprintf(age_str, sizeof(age_str), "%ld", age);
-    
-    size_t response_size = Response_size(response);
-    char *response_buf = Response_get(response);
-    
-    if (HTTP_add_field(&response_buf, &response_size, "Age", age_str) < 0) {
+    char age_line[48];
+    int age_l = snprintf(age_line, sizeof(age_line), "Age: %ld\r\n", age);
+
+    if (OutQueue_pushRef(&client->out, response->head, response->head_l, release_response, response) < 0) {
+        Response_free(response);
+        Response_free(response);
         return ERROR_FAILURE;
     }
-
-    /* Send response to client */
-#if RUN_SSL
-    if (client->isSSL) {
-        if (ProxySSL_write(proxy, client, response_buf, response_size) <= 0) {
-            free(response_buf);
-            return PROXY_ERROR_SSL;
-        }
-    } else 
-#endif
-    {
-        if (Proxy_send(client->socket, response_buf, response_size) < 0) {
-            free(response_buf);
-            return PROXY_ERROR_SEND;
-        }
+    if (OutQueue_push(&client->out, age_line, age_l) < 0 ||
+        OutQueue_pushRef(&client->out, response->raw + response->tail_off,
+                         response->raw_l - response->tail_off, release_response, response) < 0) {
+        Response_free(response);
+        return ERROR_FAILURE;
     }
 
-    free(response_buf);
-    return EXIT_SUCCESS;
+    return flush_client(proxy, client);
 }
 
+/* Proxy_fetch
+ *    Purpose: Queues the request for the connected origin, it is written as
+ *             the upstream socket takes it.
+ *    Returns: Number of bytes queued, or PROXY_ERROR_FETCH.
+ */
 ssize_t Proxy_fetch(Proxy *proxy, Query *q) {
     if (proxy == NULL || q == NULL || q->req == NULL) {
         return ERROR_FAILURE;
     }
 
-    /* Connect to server */
-    if (connect(q->socket, (struct sockaddr *)&q->server_addr, sizeof(q->server_addr)) < 0) {
-        return PROXY_ERROR_BAD_GATEWAY;
+    /* Queue request for server */
+    if (OutQueue_push(&q->out, q->req->raw, q->req->raw_l) < 0) {
+        return PROXY_ERROR_FETCH;
     }
 
-    /* Add socket to master set */
-    FD_SET(q->socket, &proxy->master_set);
-    proxy->fdmax = (q->socket > proxy->fdmax) ? q->socket : proxy->fdmax;
+    return q->req->raw_l;
+}
 
-    /* Send request to server */
-    ssize_t bytes_sent = Proxy_send(q->socket, q->req->raw, q->req->raw_l);
-    if (bytes_sent < 0) {
-        return PROXY_ERROR_FETCH;
+/* take_response
+ *    Purpose: Frames n bytes just received at the end of the query buffer,
+ *             bytes past the end of the response are dropped.
+ *    Returns: The buffered length, SERVER_RESP_RECVD once the response is
+ *             complete, or INVALID_RESPONSE if its framing is invalid.
+ */
+static int take_response(Query *q, size_t n) {
+    ssize_t used = ResponseFrame_feed(&q->frame, q->buffer + q->buffer_l, n);
+    if (used < 0) {
+        return INVALID_RESPONSE;
+    }
+    q->buffer_l += used;
+    if ((size_t)used < n) {
+        q->frame.keep_alive = false; // the origin is out of step
+    }
+
+    if (ResponseFrame_done(&q->frame)) {
+        return end_response(q);
+    }
+    if (q->buffer_l == q->buffer_sz) {
+        if (expand_buffer(&q->buffer, &q->buffer_l, &q->buffer_sz) < 0) {
+            return ERROR_FAILURE;
+        }
+    }
+
+    return (int)q->buffer_l;
+}
+
+/* end_response
+ *    Purpose: Parses the response once the origin ended it. A streamed
+ *             response already went to the client as received, so it is only
+ *             parsed for the cache, and not at all once the cache skipped it.
+ *    Returns: SERVER_RESP_RECVD, or INVALID_RESPONSE if a buffered response
+ *             cannot be parsed.
+ */
+static int end_response(Query *q) {
+    q->state = QRY_RECVD_RESPONSE;
+    if (q->cache_skip) {
+        return SERVER_RESP_RECVD;
+    }
+
+    q->res = Response_new(q->req->method, q->req->method_l, q->req->path, q->req->path_l, q->buffer, q->buffer_l);
+#if RUN_COLOR
+    if (q->res == NULL) {
+        print_error("proxy: failed to create response");
+        return INVALID_RESPONSE;
+    }
+#endif
+
+    return SERVER_RESP_RECVD;
+}
+
+#if !RUN_COLOR
+/* stream_response
+ *    Purpose: Queues the bytes received since the last call for the client,
+ *             so the response is forwarded as it arrives. The buffer keeps the
+ *             whole response for the cache until it outgrows CACHE_OBJ_MAX,
+ *             then the copy is dropped and the buffer only bounces bytes.
+ */
+static int stream_response(Proxy *proxy, Client *client) {
+    Query *query = client->query;
+
+    if (query->buffer_l > query->fwd_l) {
+        if (OutQueue_push(&client->out, query->buffer + query->fwd_l, query->buffer_l - query->fwd_l) < 0) {
+            return ERROR_FAILURE;
+        }
+        query->fwd_l = query->buffer_l;
+    }
+
+    if (!query->cache_skip && query->buffer_l > CACHE_OBJ_MAX) {
+        query->cache_skip = true;
+        STATS_ADD(cache_skips, 1);
+    }
+    if (query->cache_skip) {
+        query->buffer_l = 0;
+        query->fwd_l    = 0;
     }
 
-    return bytes_sent;
+    return flush_client(proxy, client);
 }
+#endif
 
 int Proxy_handleQuery(Proxy *proxy, Query *query, int isSSL) {
     if (proxy == NULL || query == NULL) {
@@ -646,83 +827,87 @@ int Proxy_handleQuery(Proxy *proxy, Query *query, int isSSL) {
         bytes_received = Proxy_recv(query, QUERY_TYPE);
     }
 
+    /* the byte count cannot tell a complete response apart, end_response
+     * moved the query on in that case */
     if (bytes_received < 0) {
         return PROXY_ERROR_RECV;
     }
 
-    if (bytes_received == SERVER_RESP_RECVD) {
-        query->state = QRY_RECVD_RESPONSE;
-    }
-
     return EXIT_SUCCESS;
 }
 
 int Proxy_sendServerResp(Proxy *proxy, Client *client) {
-    if (proxy == NULL || client == NULL || client->query == NULL || client->query->res == NULL) {
+    if (proxy == NULL || client == NULL || client->query == NULL) {
         return ERROR_FAILURE;
     }
 
-    /* Get response from query */
-    char *response_buf = calloc(client->query->res->raw_l + 1, sizeof(char));
-    if (response_buf == NULL) {
+    Response *res = client->query->res;
+    int ret;
+
+    /* Color links if enabled, the colored copy is written once the pool
+     * scanned the whole response. Otherwise it was streamed as received and
+     * only the cache copy, if one was kept, is left to hand over */
+#if RUN_COLOR
+    if (res == NULL) {
         return ERROR_FAILURE;
     }
-    memcpy(response_buf, client->query->res->raw, client->query->res->raw_l);
 
-    /* Color links if enabled */
-#if RUN_COLOR
-    char **key_array = Cache_getKeyList(proxy->cache);
-    int num_keys = (int)proxy->cache->size;
-    if (color_links(&response_buf, &client->query->res->raw_l, key_array, num_keys) != 0) {
-        free(response_buf);
+    ColorJob *job = calloc(1, sizeof(ColorJob));
+    if (job == NULL) {
         return ERROR_FAILURE;
     }
-#endif
+    job->proxy  = proxy;
+    job->client = client;
+    job->len    = res->raw_l;
+    job->buf    = calloc(res->raw_l + 1, sizeof(char));
+    if (job->buf == NULL) {
+        free(job);
+        return ERROR_FAILURE;
+    }
+    memcpy(job->buf, res->raw, res->raw_l);
 
-    /* Send response to client */
-#if RUN_SSL
-    if (client->isSSL) {
-        if (ProxySSL_write(proxy, client, response_buf, client->query->res->raw_l) <= 0) {
-            free(response_buf);
-            return PROXY_ERROR_SSL;
-        }
-    } else
-#endif
-    {
-        if (Proxy_send(client->socket, response_buf, client->query->res->raw_l) < 0) {
-            free(response_buf);
-            return PROXY_ERROR_SEND;
-        }
+    ret = offload(proxy, client, color_work, color_done, job);
+    if (ret != EXIT_SUCCESS) {
+        free(job->buf);
+        free(job);
+        return ret;
+    }
+#else
+    ret = stream_response(proxy, client);
+    if (ret != EXIT_SUCCESS || res == NULL) {
+        return ret;
     }
+#endif
 
-    /* Cache the response */
+    /* Cache the response, it moves to the pool rather than being copied */
 #if RUN_CACHE
     char *key = get_key(client->query->req);
-    if (key != NULL) {
-        Response *cached_res = Response_copy(client->query->res);
-        if (cached_res != NULL) {
-            Cache_put(proxy->cache, key, cached_res, cached_res->max_age);
-        }
+    CacheJob *cache_job = (key != NULL) ? calloc(1, sizeof(CacheJob)) : NULL;
+    if (cache_job == NULL) {
         free(key);
+        return EXIT_SUCCESS;
+    }
+    cache_job->shared = proxy->shared;
+    cache_job->key    = key;
+    cache_job->res    = res;
+    client->query->res = NULL;
+
+    /* nothing waits on the insertion, it runs inline if the pool is full */
+    if (Pool_submit(proxy->shared->pool, &proxy->completions, cache_work, cache_done, cache_job) == NULL) {
+        cache_work(cache_job);
+        cache_done(cache_job, false);
     }
 #endif
 
-    free(response_buf);
     return EXIT_SUCCESS;
 }
 
-int Proxy_init(Proxy *proxy, short port) {
-    if (proxy == NULL) {
+int Proxy_init(Proxy *proxy, short port, int backend, ProxyShared *shared) {
+    if (proxy == NULL || shared == NULL) {
         return ERROR_FAILURE;
     }
 
-    /* Initialize cache if enabled */
-#if RUN_CACHE
-    proxy->cache = Cache_new(CACHE_SZ, Response_free, Response_print);
-    if (proxy->cache == NULL) {
-        return ERROR_FAILURE;
-    }
-#endif
+    proxy->shared = shared;
 
     /* Initialize filter list if enabled */
 #if RUN_FILTER
@@ -732,13 +917,25 @@ int Proxy_init(Proxy *proxy, short port) {
     /* Initialize socket structures */
     zero(&(proxy->addr), sizeof(proxy->addr));
     proxy->listen_fd = -1;
+    proxy->listen_paused = false;
+    proxy->wake_rd = -1;
+    proxy->wake_wr = -1;
     proxy->port = port;
 
-    /* Initialize fd sets */
-    FD_ZERO(&(proxy->master_set));
-    FD_ZERO(&(proxy->readfds));
-    proxy->fdmax = 0;
+    /* Initialize event loop */
+    proxy->backend = backend;
+    proxy->loop = EventLoop_new(backend);
+    if (proxy->loop == NULL) {
+        return ERROR_FAILURE;
+    }
     proxy->timeout = NULL;
+    TimerWheel_init(&proxy->timers);
+
+    /* Initialize fd to connection table */
+    proxy->conns = ConnTable_new(EV_INIT_FDS);
+    if (proxy->conns == NULL) {
+        return ERROR_FAILURE;
+    }
 
     /* Initialize client list */
     proxy->client_list = List_new(Client_free, Client_print, Client_compare);
@@ -746,17 +943,40 @@ int Proxy_init(Proxy *proxy, short port) {
         return ERROR_FAILURE;
     }
 
-    /* Initialize SSL context if enabled */
-#if RUN_SSL
-    proxy->ctx = InitServerCTX();
-    if (proxy->ctx == NULL) {
+    /* Initialize wake-up pipe, written to when another worker halts */
+    int wake[2];
+    if (pipe(wake) == -1) {
+        return ERROR_FAILURE;
+    }
+    proxy->wake_rd = wake[0];
+    proxy->wake_wr = wake[1];
+    fcntl(proxy->wake_rd, F_SETFL, O_NONBLOCK);
+    fcntl(proxy->wake_wr, F_SETFL, O_NONBLOCK);
+    if (watch_fd(proxy, proxy->wake_rd, EV_READ, NULL, CONN_WAKE) < 0) {
         return ERROR_FAILURE;
     }
-    LoadCertificates(proxy->ctx, PROXY_CERT, PROXY_KEY);
-#endif
 
-    return EXIT_SUCCESS;
-}
+    /* Initialize resolver, each worker caches answers for its own clients */
+    proxy->resolver = Resolver_new(resolved, proxy);
+    if (proxy->resolver == NULL) {
+        return ERROR_FAILURE;
+    }
+    if (proxy->resolver->fd != -1 && watch_fd(proxy, proxy->resolver->fd, EV_READ, NULL, CONN_DNS) < 0) {
+        return ERROR_FAILURE;
+    }
+
+    /* Initialize the queue the offload pool hands completed tasks back on */
+    if (PoolQueue_init(&proxy->completions) != EXIT_SUCCESS) {
+        return ERROR_FAILURE;
+    }
+    if (watch_fd(proxy, proxy->completions.efd, EV_READ, NULL, CONN_POOL) < 0) {
+        return ERROR_FAILURE;
+    }
+
+    UpstreamPool_init(&proxy->upstreams);
+
+    return EXIT_SUCCESS;
+}
 
 void Proxy_free(void *proxy) {
     if (proxy == NULL) {
@@ -765,31 +985,32 @@ void Proxy_free(void *proxy) {
 
     Proxy *p = (Proxy *)proxy;
 
-#if RUN_SSL
-    if (p->ctx != NULL) {
-        SSL_CTX_free(p->ctx);
-    }
-#endif
-
-#if RUN_CACHE
-    Cache_free(&p->cache);
-#endif
-
 #if RUN_FILTER
     Proxy_freeFilters(p);
 #endif
 
     List_free(&p->client_list);
-    
+    UpstreamPool_free(&p->upstreams);
+    PoolQueue_free(&p->completions);
+    Resolver_free(&p->resolver);
+    EventLoop_free(&p->loop);
+    ConnTable_free(&p->conns);
+
     if (p->listen_fd != -1) {
         close(p->listen_fd);
         p->listen_fd = -1;
     }
 
-    if (p->timeout != NULL) {
-        free(p->timeout);
-        p->timeout = NULL;
+    if (p->wake_rd != -1) {
+        close(p->wake_rd);
+        p->wake_rd = -1;
+    }
+    if (p->wake_wr != -1) {
+        close(p->wake_wr);
+        p->wake_wr = -1;
     }
+
+    p->timeout = NULL;
 }
 
 int Proxy_listen(Proxy *proxy) {
@@ -810,6 +1031,13 @@ int Proxy_listen(Proxy *proxy) {
         return ERROR_FAILURE;
     }
 
+    /* Every worker binds its own socket to the port */
+    if (proxy->shared->nworkers > 1 &&
+        setsockopt(proxy->listen_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+        close(proxy->listen_fd);
+        return ERROR_FAILURE;
+    }
+
     /* Set up server address structure */
     proxy->addr.sin_family = AF_INET;
     proxy->addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -827,15 +1055,40 @@ int Proxy_listen(Proxy *proxy) {
         return ERROR_FAILURE;
     }
 
-    /* Add listening socket to master set */
-    FD_SET(proxy->listen_fd, &proxy->master_set);
-    proxy->fdmax = proxy->listen_fd;
+    /* Non-blocking, so the accept loop stops when the backlog is empty */
+    if (fcntl(proxy->listen_fd, F_SETFL, fcntl(proxy->listen_fd, F_GETFL, 0) | O_NONBLOCK) == -1) {
+        close(proxy->listen_fd);
+        return ERROR_FAILURE;
+    }
+
+    /* Register listening socket with the event loop */
+    if (watch_fd(proxy, proxy->listen_fd, EV_READ | EV_ACCEPT, NULL, CONN_LISTEN) < 0) {
+        close(proxy->listen_fd);
+        return ERROR_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
+/* Proxy_handleListener
+ *    Purpose: Drains the listen backlog, accepting until it is empty or
+ *             ACCEPT_BUDGET connections were taken. The listener stays ready
+ *             while connections are pending, so the rest are accepted on the
+ *             next iteration after the established connections had a turn.
+ * Parameters: @proxy - Pointer to the Proxy
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if the listener failed.
+ */
 int Proxy_handleListener(Proxy *proxy) {
-    return Proxy_accept(proxy);
+    for (int i = 0; i < ACCEPT_BUDGET; i++) {
+        int ret = Proxy_accept(proxy);
+        if (ret == ACCEPT_DRAINED) {
+            break;
+        } else if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return EXIT_SUCCESS;
 }
 
 int Proxy_accept(Proxy *proxy) {
@@ -848,8 +1101,22 @@ int Proxy_accept(Proxy *proxy) {
     int client_fd;
 
     /* Accept new connection */
-    client_fd = accept(proxy->listen_fd, (struct sockaddr *)&client_addr, &client_len);
+    client_fd = EventLoop_accept(proxy->loop, proxy->listen_fd, (struct sockaddr *)&client_addr, &client_len);
     if (client_fd == -1) {
+        /* backlog empty, or the connection went away before it was taken */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR) {
+            return ACCEPT_DRAINED;
+        }
+        /* out of descriptors or memory, the pending connection stays ready
+         * and would spin the loop, stop watching the listener until a client
+         * is closed. Without clients nothing frees up, keep retrying */
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+            print_error("proxy: accept failed, out of resources");
+            if (List_size(proxy->client_list) > 0 && EventLoop_modify(proxy->loop, proxy->listen_fd, 0) == 0) {
+                proxy->listen_paused = true;
+            }
+            return ACCEPT_DRAINED;
+        }
         return ERROR_FAILURE;
     }
 
@@ -857,45 +1124,706 @@ int Proxy_accept(Proxy *proxy) {
     Client *client = Client_create(client_fd);
     if (client == NULL) {
         close(client_fd);
-        return ERROR_FAILURE;
+        return EXIT_SUCCESS; // drop the client, keep serving the others
     }
 
     /* Set client address */
     if (Client_setAddr(client, &client_addr) < 0) {
         Client_free(client);
-        return ERROR_FAILURE;
+        return EXIT_SUCCESS;
+    }
+    Client_timestamp(client);
+    arm_timeout(proxy, client);
+
+    /* Register client socket with the event loop */
+    if (watch_fd(proxy, client_fd, EV_READ, client, CONN_CLIENT) < 0) {
+        Client_free(client);
+        return EXIT_SUCCESS; // drop the client, keep serving the others
     }
 
     /* Add client to list */
-    Node *node = List_add(proxy->client_list, client);
-    if (node == NULL) {
+    if (List_push_back(proxy->client_list, client) < 0) {
+        unwatch_fd(proxy, client_fd);
         Client_free(client);
+        return EXIT_SUCCESS;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void Proxy_close(Proxy *proxy, Client *client) {
+    if (proxy == NULL || client == NULL) {
+        return;
+    }
+
+    /* Drop a lookup the client still waits on */
+    if (client->query != NULL && client->query->state == QRY_RESOLVING) {
+        Resolver_cancel(proxy->resolver, client);
+    }
+
+    /* Account the tunnel's lifetime for the throughput stat */
+    if (client->state == CLI_TUNNEL) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long usec = (now.tv_sec - client->opened.tv_sec) * 1000000L + (now.tv_usec - client->opened.tv_usec);
+        STATS_ADD(tunnels, 1);
+        STATS_ADD(tunnel_usec, (usec > 0) ? (unsigned long)usec : 0);
+    }
+
+    /* Stop watching the client and its upstream socket */
+    unwatch_fd(proxy, client->socket);
+    if (client->query != NULL && client->query->socket != -1) {
+        unwatch_fd(proxy, client->query->socket);
+    }
+
+    /* Remove client from list, this frees the client and closes its sockets */
+    List_remove(proxy->client_list, client);
+
+    /* A descriptor was freed, accept again */
+    if (proxy->listen_paused && EventLoop_modify(proxy->loop, proxy->listen_fd, EV_READ | EV_ACCEPT) == 0) {
+        proxy->listen_paused = false;
+    }
+}
+
+/* watch_fd
+ *    Purpose: Registers fd with the event loop and records which client owns
+ *             it and in what role, so a ready fd dispatches in O(1).
+ */
+static int watch_fd(Proxy *proxy, int fd, int events, Client *client, int role) {
+    if (ConnTable_set(proxy->conns, fd, client, role) < 0) {
+        return ERROR_FAILURE;
+    }
+
+    if (EventLoop_add(proxy->loop, fd, events) < 0) {
+        ConnTable_clear(proxy->conns, fd);
         return ERROR_FAILURE;
     }
 
-    /* Add client socket to master set */
-    FD_SET(client_fd, &proxy->master_set);
-    if (client_fd > proxy->fdmax) {
-        proxy->fdmax = client_fd;
+    return EXIT_SUCCESS;
+}
+
+static void unwatch_fd(Proxy *proxy, int fd) {
+    EventLoop_remove(proxy->loop, fd);
+    ConnTable_clear(proxy->conns, fd);
+}
+
+/* shared_init
+ *    Purpose: Creates the state shared by all workers, the cache and the SSL
+ *             context, and allocates the workers themselves.
+ */
+static int shared_init(ProxyShared *shared, int workers) {
+    zero(shared, sizeof(*shared));
+
+    shared->workers = calloc(workers, sizeof(Proxy));
+    if (shared->workers == NULL) {
+        return ERROR_FAILURE;
+    }
+    shared->nworkers = workers;
+    for (int i = 0; i < workers; i++) {
+        shared->workers[i].listen_fd = -1;
+        shared->workers[i].wake_rd = -1;
+        shared->workers[i].wake_wr = -1;
+        shared->workers[i].completions.efd = -1;
+        shared->workers[i].completions.wr_fd = -1;
+    }
+
+    /* Start the offload pool */
+    long threads = POOL_THREADS;
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    shared->pool = Pool_new((threads > 0) ? (int)threads : 1);
+    if (shared->pool == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    /* Initialize cache if enabled */
+#if RUN_CACHE
+    pthread_mutex_init(&shared->cache_lock, NULL);
+    shared->cache = Cache_new(CACHE_SZ, Response_free, Response_print);
+    if (shared->cache == NULL) {
+        return ERROR_FAILURE;
+    }
+#endif
+
+    /* Initialize SSL context if enabled */
+#if RUN_SSL
+    shared->ctx = InitServerCTX();
+    if (shared->ctx == NULL || CertCache_init(&shared->certs, shared->ctx) != EXIT_SUCCESS ||
+        TicketKeys_init(&shared->tickets, shared->ctx) != EXIT_SUCCESS) {
+        return ERROR_FAILURE;
+    }
+
+    /* origins are verified against the system trust store */
+    shared->upstream_ctx = InitCTX();
+    if (shared->upstream_ctx == NULL || SSL_CTX_set_default_verify_paths(shared->upstream_ctx) != 1 ||
+        SessionCache_init(&shared->sessions, shared->upstream_ctx) != EXIT_SUCCESS ||
+        VerifyCache_init(&shared->verified, shared->upstream_ctx) != EXIT_SUCCESS) {
+        return ERROR_FAILURE;
+    }
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+static void shared_free(ProxyShared *shared) {
+    /* the pool goes first, no task completes onto a freed worker */
+    Pool_free(&shared->pool);
+
+    if (shared->workers != NULL) {
+        for (int i = 0; i < shared->nworkers; i++) {
+            Proxy_free(&shared->workers[i]);
+        }
+        free(shared->workers);
+        shared->workers = NULL;
+    }
+
+#if RUN_CACHE
+    Cache_free(&shared->cache);
+    pthread_mutex_destroy(&shared->cache_lock);
+#endif
+
+#if RUN_SSL
+    if (shared->ctx != NULL) {
+        CertCache_free(&shared->certs);
+        TicketKeys_free(&shared->tickets);
+        SSL_CTX_free(shared->ctx);
+        shared->ctx = NULL;
+    }
+    if (shared->upstream_ctx != NULL) {
+        SessionCache_free(&shared->sessions);
+        VerifyCache_free(&shared->verified);
+        SSL_CTX_free(shared->upstream_ctx);
+        shared->upstream_ctx = NULL;
+    }
+#endif
+}
+
+static void *worker_main(void *arg) {
+    Proxy *proxy = (Proxy *)arg;
+
+    intptr_t ret = event_loop(proxy);
+    halt_workers(proxy->shared);
+
+    return (void *)ret;
+}
+
+/* halt_workers
+ *    Purpose: Tells every worker to stop, the write wakes workers blocked in
+ *             their event loop.
+ */
+static void halt_workers(ProxyShared *shared) {
+    __atomic_store_n(&shared->halt, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < shared->nworkers; i++) {
+        if (shared->workers[i].wake_wr != -1) {
+            ssize_t n = write(shared->workers[i].wake_wr, "h", 1);
+            (void)n;
+        }
+    }
+}
+
+/* wait_writable
+ *    Purpose: Waits up to SEND_WAIT_MS for a full non-blocking socket to
+ *             accept more data.
+ */
+static int wait_writable(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT, .revents = 0 };
+    STATS_ADD(io_syscalls, 1);
+
+    return (poll(&pfd, 1, SEND_WAIT_MS) == 1) ? 0 : -1;
+}
+
+/* flush_client
+ *    Purpose: Writes the client's queued output, then updates which sides of
+ *             the connection are watched.
+ */
+static int flush_client(Proxy *proxy, Client *client) {
+    ssize_t n;
+#if RUN_SSL
+    if (client->isSSL && client->ssl != NULL) {
+        n = OutQueue_flushSSL(&client->out, client->ssl);
+    } else
+#endif
+    {
+        n = OutQueue_flush(&client->out, client->socket);
+    }
+
+    if (n < 0) {
+        return PROXY_ERROR_SEND;
+    }
+
+    /* a response delimited by the origin closing ends the same way here, as
+     * does the last response of a client not keeping its connection */
+    Query *query = client->query;
+    if (query != NULL && query->state == QRY_DONE && client->task == NULL &&
+        (query->frame.state == FRAME_CLOSE || !query->req->keep_alive) && OutQueue_isEmpty(&client->out)) {
+        return CLIENT_CLOSE;
+    }
+
+    /* tunnel bytes follow whatever was queued before them */
+    int ret = drain_tunnel(proxy, client, true);
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    update_interest(proxy, client);
+    return EXIT_SUCCESS;
+}
+
+static int flush_query(Proxy *proxy, Client *client) {
+    if (client->query == NULL || client->query->socket == -1) {
+        return EXIT_SUCCESS;
+    }
+
+    ssize_t n;
+#if RUN_SSL
+    if (client->query->ssl != NULL) {
+        n = OutQueue_flushSSL(&client->query->out, client->query->ssl);
+    } else
+#endif
+    {
+        n = OutQueue_flush(&client->query->out, client->query->socket);
+    }
+    if (n < 0) {
+        return PROXY_ERROR_SEND;
+    }
+
+    int ret = drain_tunnel(proxy, client, false);
+    if (ret != EXIT_SUCCESS) {
+        return ret;
     }
 
+    update_interest(proxy, client);
     return EXIT_SUCCESS;
 }
 
-void Proxy_close(int socket, fd_set *master_set, List *client_list, Client *client) {
-    if (socket < 0 || master_set == NULL || client_list == NULL || client == NULL) {
+/* drain_tunnel
+ *    Purpose: Writes a tunnel direction's pending bytes once the receiver's
+ *             queued output went out, and shuts the receiver down for writing
+ *             once the sender's end of file got through.
+ *    Returns: EXIT_SUCCESS, CLIENT_CLOSE once both directions ended, or
+ *             PROXY_ERROR_SEND.
+ */
+static int drain_tunnel(Proxy *proxy, Client *client, bool to_client) {
+    Query *query = client->query;
+    if (query == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    TunnelBuf *tb = to_client ? &client->tunnel : &query->tunnel;
+    OutQueue *out = to_client ? &client->out : &query->out;
+    int receiver = to_client ? client->socket : query->socket;
+    if (!TunnelBuf_isOpen(tb) || !OutQueue_isEmpty(out)) {
+        return EXIT_SUCCESS;
+    }
+
+    if (TunnelBuf_drain(tb, receiver) < 0) {
+        return PROXY_ERROR_SEND;
+    }
+    if (tb->eof && tb->len == 0 && !tb->shut) {
+        shutdown(receiver, SHUT_WR);
+        tb->shut = true;
+    }
+
+    if (client->tunnel.shut && query->tunnel.shut) {
+        return CLIENT_CLOSE;
+    }
+
+    /* a socket finished both ways would keep reporting its hangup while the
+     * other direction drains, stop watching it */
+    if (query->tunnel.eof && client->tunnel.shut) {
+        EventLoop_remove(proxy->loop, client->socket);
+    }
+    if (client->tunnel.eof && query->tunnel.shut) {
+        EventLoop_remove(proxy->loop, query->socket);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* connect_upstream
+ *    Purpose: Drives the connection to the origin without blocking the loop.
+ *             The origin is resolved first, then the TCP connect completes
+ *             when the socket turns writable, then
+ *             for tls the handshake runs on whichever readiness OpenSSL asks
+ *             for. The query socket is watched in role from the first step.
+ *    Returns: EXIT_SUCCESS once connected, CONNECT_WANT_DNS, CONNECT_WANT_READ
+ *             or CONNECT_WANT_WRITE while in progress, or an error.
+ */
+static int connect_upstream(Proxy *proxy, Client *client, int role, bool tls) {
+    Query *query = client->query;
+    int ret;
+
+    /* A GET reuses an idle connection to the origin if there is one, it is
+     * connected and past any handshake already */
+    if (query->state == QRY_INIT && role == CONN_UPSTREAM && !query->no_pool &&
+        UpstreamPool_borrow(&proxy->upstreams, query, tls) == EXIT_SUCCESS) {
+        query->reused = true;
+        return (watch_fd(proxy, query->socket, EV_READ, client, role) < 0) ? PROXY_ERROR_CONNECT : EXIT_SUCCESS;
+    }
+
+    /* Resolve the origin, resolved() resumes the query once answered */
+    if (query->state == QRY_INIT) {
+        ret = Resolver_lookup(proxy->resolver, query->req->host, &query->server_addr.sin_addr, client);
+        if (ret == DNS_PENDING) {
+            query->state = QRY_RESOLVING;
+            return CONNECT_WANT_DNS;
+        } else if (ret != DNS_FOUND) {
+            return HOST_UNKNOWN;
+        }
+    }
+
+    /* Registered before connecting, the io_uring engine connects through
+     * the ring */
+    if (query->state == QRY_INIT || query->state == QRY_RESOLVING) {
+        /* opened only now, a borrowed connection needs none */
+        if (query->socket == -1) {
+            query->socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (query->socket < 0) {
+                return PROXY_ERROR_CONNECT;
+            }
+        }
+        if (watch_fd(proxy, query->socket, EV_WRITE, client, role) < 0) {
+            return PROXY_ERROR_CONNECT;
+        }
+        ret = Query_connect(proxy->loop, query);
+        if (ret < 0) {
+            return ret;
+        }
+        query->state = QRY_CONNECTING;
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+    } else if (query->state == QRY_CONNECTING) {
+        if (!EventLoop_isWritable(proxy->loop, query->socket)) {
+            return CONNECT_WANT_WRITE;
+        }
+        ret = Query_connect(proxy->loop, query);
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+    }
+
+#if RUN_SSL
+    if (tls) {
+        query->state = QRY_HANDSHAKE;
+        ret = ProxySSL_connect(proxy, query);
+        if (ret > 0) {
+            EventLoop_modify(proxy->loop, query->socket, (ret == CONNECT_WANT_READ) ? EV_READ : EV_WRITE);
+        }
+        return ret;
+    }
+#else
+    (void)tls;
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+/* retry_fresh
+ *    Purpose: Sends the request again on a new connection after a pooled
+ *             one failed before any of the response arrived.
+ */
+static int retry_fresh(Proxy *proxy, Client *client) {
+    Query *query = client->query;
+
+    unwatch_fd(proxy, query->socket);
+    close(query->socket);
+    query->socket = -1;
+#if RUN_SSL
+    Query_clearSSL(query);
+#endif
+
+    OutQueue_clear(&query->out);
+    ResponseFrame_init(&query->frame, query->frame.head);
+    query->reused  = false;
+    query->no_pool = true;
+    query->state   = QRY_INIT;
+
+    return Proxy_handleGET(proxy, client);
+}
+
+static bool is_connecting(Query *query) {
+    return query->state == QRY_INIT || query->state == QRY_RESOLVING || query->state == QRY_CONNECTING ||
+           query->state == QRY_HANDSHAKE;
+}
+
+/* query_ready
+ *    Purpose: Whether the response can be read on, the socket is readable or
+ *             a TLS read that asked for writability got it.
+ */
+static bool query_ready(Proxy *proxy, Query *query) {
+    if (EventLoop_isReadable(proxy->loop, query->socket)) {
+        return true;
+    }
+#if RUN_SSL
+    return query->ssl_want_write && EventLoop_isWritable(proxy->loop, query->socket);
+#else
+    return false;
+#endif
+}
+
+/* resolved
+ *    Purpose: Resolver callback, resumes the GET or CONNECT of a client whose
+ *             origin was looked up, or fails it with a 502.
+ */
+static void resolved(void *data, int status, struct in_addr addr, void *arg) {
+    Proxy *proxy = (Proxy *)arg;
+    Client *client = (Client *)data;
+    int ret = HOST_UNKNOWN;
+
+    if (status == DNS_FOUND) {
+        client->query->server_addr.sin_addr = addr;
+        ret = (client->state == CLI_CONNECT) ? Proxy_handleCONNECT(proxy, client) : Proxy_handleGET(proxy, client);
+    }
+
+    if (ret != EXIT_SUCCESS) {
+        Proxy_handleEvent(proxy, client, ret);
+    }
+}
+
+/* update_interest
+ *    Purpose: Watches a side for writability while it has queued output, and
+ *             stops reading a side while the other one is behind. Reading
+ *             pauses above OUTQ_HIGH_WATER and resumes below OUTQ_LOW_WATER.
+ */
+static void update_interest(Proxy *proxy, Client *client) {
+    Query *query = client->query;
+    size_t to_client = OutQueue_size(&client->out) + client->tunnel.len;
+    size_t to_upstream = (query != NULL) ? OutQueue_size(&query->out) + query->tunnel.len : 0;
+
+    if (!client->upstream_paused && to_client >= OUTQ_HIGH_WATER) {
+        client->upstream_paused = true;
+    } else if (client->upstream_paused && to_client <= OUTQ_LOW_WATER) {
+        client->upstream_paused = false;
+    }
+
+    if (!client->client_paused && to_upstream >= OUTQ_HIGH_WATER) {
+        client->client_paused = true;
+    } else if (client->client_paused && to_upstream <= OUTQ_LOW_WATER) {
+        client->client_paused = false;
+    }
+
+    /* client reads also wait for an offloaded stage to complete, a tunnel's
+     * sender while its direction is above the watermark or ended, and a
+     * client that pipelined PIPELINE_MAX bytes behind the request in flight */
+    bool tunnel_held = (query != NULL && (query->tunnel.paused || query->tunnel.eof));
+    bool pipeline_held = (client->hasRequest && client->buffer_l >= PIPELINE_MAX);
+    int events = (client->client_paused || client->task != NULL || tunnel_held || pipeline_held) ? 0 : EV_READ;
+    if (to_client > 0) {
+        events |= EV_WRITE;
+    }
+#if RUN_SSL
+    if (client->ssl_want_write) {
+        events |= EV_WRITE;
+    }
+#endif
+    EventLoop_modify(proxy->loop, client->socket, events);
+
+    /* a connect in progress sets its own interest */
+    if (query != NULL && query->socket != -1 && !is_connecting(query) &&
+        ConnTable_get(proxy->conns, query->socket) != NULL) {
+        events = (client->upstream_paused || client->tunnel.paused || client->tunnel.eof) ? 0 : EV_READ;
+        if (to_upstream > 0) {
+            events |= EV_WRITE;
+        }
+#if RUN_SSL
+        if (query->ssl_want_write) {
+            events |= EV_WRITE;
+        }
+#endif
+        EventLoop_modify(proxy->loop, query->socket, events);
+    }
+}
+
+static void handle_sigusr1(int sig) {
+    (void)sig;
+    dump_stats = 1;
+}
+
+/* arm_timeout
+ *    Purpose: (Re)schedules the client's timer for its current state: an SSL
+ *             handshake gets SSL_TIMEOUT, an idle tunnel TUNNEL_TIMEOUT, a
+ *             persistent connection between requests KEEPALIVE_TIMEOUT and
+ *             anything else TIMEOUT_THRESHOLD.
+ */
+static void arm_timeout(Proxy *proxy, Client *client) {
+    unsigned long timeout = TIMEOUT_THRESHOLD;
+    if (client->state == CLI_TUNNEL) {
+        timeout = TUNNEL_TIMEOUT;
+    } else if (client->state == CLI_QUERY) {
+        timeout = KEEPALIVE_TIMEOUT;
+    }
+#if RUN_SSL
+    if (client->state == CLI_SSL) {
+        timeout = SSL_TIMEOUT;
+    }
+#endif
+
+    Timer_schedule(&proxy->timers, &client->timer, timeout * 1000);
+}
+
+/* expire_client
+ *    Purpose: Timer wheel callback, closes a client that timed out. Tunnels
+ *             relayed by the io_uring engine never reach the handlers, so
+ *             their progress is checked here before closing.
+ */
+static void expire_client(void *data, void *arg) {
+    Client *client = (Client *)data;
+    Proxy *proxy = (Proxy *)arg;
+
+#if RUN_SSL
+    if (client->state == CLI_SSL) {
+        STATS_ADD(client_tls_timeouts, 1);
+    }
+#endif
+
+    if (client->state == CLI_TUNNEL && client->query != NULL) {
+        unsigned long relayed = EventLoop_relayed(proxy->loop, client->socket) +
+                                EventLoop_relayed(proxy->loop, client->query->socket);
+        if (relayed != client->relayed) {
+            client->relayed = relayed;
+            arm_timeout(proxy, client);
+            return;
+        }
+    }
+
+    Proxy_close(proxy, client);
+}
+
+/* offload
+ *    Purpose: Runs work(arg) on the offload pool for client. Its reads pause
+ *             until done(arg) ran on this worker, which must clear
+ *             client->task unless the task was cancelled.
+ */
+static int offload(Proxy *proxy, Client *client, void (*work)(void *), void (*done)(void *, bool), void *arg) {
+    client->task = Pool_submit(proxy->shared->pool, &proxy->completions, work, done, arg);
+    if (client->task == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    update_interest(proxy, client);
+    return EXIT_SUCCESS;
+}
+
+#if RUN_CACHE
+/* cache_work
+ *    Purpose: Inserts a fetched response, concurrent misses for one key all
+ *             complete and the first one wins.
+ */
+static void cache_work(void *arg) {
+    CacheJob *job = (CacheJob *)arg;
+
+    /* serialize the header once, before hits share the response */
+    if (Response_freeze(job->res) < 0) {
         return;
     }
 
-    /* Remove socket from master set */
-    FD_CLR(socket, master_set);
+    pthread_mutex_lock(&job->shared->cache_lock);
+    if (Cache_find(job->shared->cache, job->key) == NULL &&
+        Cache_put(job->shared->cache, job->key, job->res, job->res->max_age) == EXIT_SUCCESS) {
+        job->res = NULL;
+    }
+    pthread_mutex_unlock(&job->shared->cache_lock);
+}
 
-    /* Close socket */
-    close(socket);
+static void cache_done(void *arg, bool cancelled) {
+    CacheJob *job = (CacheJob *)arg;
+    (void)cancelled;
 
-    /* Remove client from list */
-    List_remove(client_list, client);
+    Response_free(job->res);
+    free(job->key);
+    free(job);
 }
+#endif
+
+/* release_response
+ *    Purpose: Drops a hold on a cached response once a client sent it.
+ */
+static void release_response(void *arg) {
+    Response_free((Response *)arg);
+}
+
+#if RUN_COLOR
+/* color_work
+ *    Purpose: Colors the links of a response that point at cached pages, the
+ *             key list is only valid while the cache lock is held.
+ */
+static void color_work(void *arg) {
+    ColorJob *job = (ColorJob *)arg;
+    ProxyShared *shared = job->proxy->shared;
+
+    pthread_mutex_lock(&shared->cache_lock);
+    char **key_array = Cache_getKeyList(shared->cache);
+    int num_keys = (int)shared->cache->size;
+    job->ret = color_links(&job->buf, &job->len, key_array, num_keys);
+    pthread_mutex_unlock(&shared->cache_lock);
+}
+
+static void color_done(void *arg, bool cancelled) {
+    ColorJob *job = (ColorJob *)arg;
+
+    if (!cancelled) {
+        Client *client = job->client;
+        client->task = NULL;
+
+        int ret = (job->ret == 0) ? Proxy_write(job->proxy, client, job->buf, job->len) : ERROR_FAILURE;
+        if (ret == EXIT_SUCCESS) {
+            ret = next_request(job->proxy, client);
+        }
+        if (ret != EXIT_SUCCESS) {
+            Proxy_handleEvent(job->proxy, client, ret);
+        } else {
+            update_interest(job->proxy, client);
+        }
+    }
+
+    free(job->buf);
+    free(job);
+}
+#endif
+
+#if RUN_SSL
+/* cert_work
+ *    Purpose: Creates the client's SSL object with the leaf for the CONNECT
+ *             host, minting it if the host has none cached. A different name
+ *             sent as SNI is switched to during the handshake.
+ */
+static void cert_work(void *arg) {
+    CertJob *job = (CertJob *)arg;
+    ProxyShared *shared = job->proxy->shared;
+
+    job->ssl = SSL_new(shared->ctx);
+    job->ret = (job->ssl != NULL) ? CertCache_use(&shared->certs, job->ssl, job->hostname) : ERROR_FAILURE;
+}
+
+static void cert_done(void *arg, bool cancelled) {
+    CertJob *job = (CertJob *)arg;
+
+    if (cancelled) {
+        SSL_free(job->ssl);
+    } else {
+        Client *client = job->client;
+        client->task = NULL;
+
+        int ret = job->ret;
+        if (ret == EXIT_SUCCESS) {
+            client->ssl = job->ssl;
+            SSL_set_fd(client->ssl, client->socket);
+            update_interest(job->proxy, client);
+            ret = ProxySSL_handshake(job->proxy, client);
+        } else {
+            SSL_free(job->ssl);
+        }
+        if (ret != EXIT_SUCCESS) {
+            Proxy_handleEvent(job->proxy, client, ret);
+        }
+    }
+
+    free(job->hostname);
+    free(job);
+}
+#endif
 
 #if RUN_FILTER
 void Proxy_freeFilters(Proxy *proxy) {
@@ -1015,22 +1943,32 @@ int Proxy_handleCONNECT(Proxy *proxy, Client *client) {
 #endif
 
     /* Connect to server if not already connected */
-    if (query->state == 0) {  // Initial state
-        ret = Query_connect(query);
-        if (ret < 0) {
-            return ret;
+    if (is_connecting(query)) {
+        ret = connect_upstream(proxy, client, CONN_TUNNEL, false);
+        if (ret != EXIT_SUCCESS) {
+            return (ret > 0) ? EXIT_SUCCESS : ret;
         }
-        query->state = 1;  // Connected state
-    }
 
-    /* Send 200 OK to client */
-    if (query->state == 1) {  // Connected state
-        ret = Proxy_send(client->socket, "HTTP/1.1 200 Connection established\r\n\r\n", 39);
+        /* Send 200 OK to client */
+        query->state = QRY_TUNNEL;
+        client->state = CLI_TUNNEL;
+        ret = Proxy_write(proxy, client, "HTTP/1.1 200 Connection established\r\n\r\n", 39);
         if (ret < 0) {
             return ret;
         }
-        query->state = 2;  // Tunnel state
-        client->state = CLI_TUNNEL;
+        arm_timeout(proxy, client);
+        gettimeofday(&client->opened, NULL);
+
+        /* let the io_uring engine relay the tunnel, other backends return
+         * ERROR_EVENT and the tunnel is relayed by Proxy_handleTunnel,
+         * spliced through a pipe per direction where splice is available */
+        if (!OutQueue_isEmpty(&client->out) ||
+            EventLoop_relay(proxy->loop, client->socket, query->socket) != EXIT_SUCCESS) {
+            if (TunnelBuf_open(&client->tunnel) != EXIT_SUCCESS ||
+                TunnelBuf_open(&query->tunnel) != EXIT_SUCCESS) {
+                return ERROR_FAILURE;
+            }
+        }
     }
 
     return EXIT_SUCCESS;
@@ -1041,30 +1979,58 @@ int Proxy_handleClient(Proxy *proxy, Client *client) {
         return ERROR_FAILURE;
     }
 
-    int ret;
     ssize_t n;
 
     /* Receive data from client */
     n = Proxy_recv(client, CLIENT_TYPE);
     if (n < 0) {
         return n;
+    } else if (client->state == CLI_CLOSE) {
+        return CLIENT_CLOSE;
     }
 
-    /* Parse request if no request exists */
+    return start_request(proxy, client);
+}
+
+/* start_request
+ *    Purpose: Parses the request at the front of the client's buffer once it
+ *             arrived whole and handles it by method. Requests pipelined
+ *             behind it stay in the buffer until its response is queued.
+ *    Returns: EXIT_SUCCESS, also while the request is incomplete, HALT, or an
+ *             error.
+ */
+static int start_request(Proxy *proxy, Client *client) {
+    int ret;
+
+    /* Parse request if no request exists, once it is complete */
     if (!client->hasRequest) {
-        Request *req;
-        if (Query_new(&client->query, client->buffer, client->buffer_l) < 0) {
+        ssize_t req_l = HTTP_request_length(client->buffer, client->buffer_l);
+        if (req_l == 0) {
+            return EXIT_SUCCESS;
+        } else if (req_l < 0) {
             return ERROR_FAILURE;
         }
+
+        ret = Query_new(&client->query, client->buffer, req_l);
+        if (ret == HALT) {
+            return HALT;
+        } else if (ret < 0) {
+            return ERROR_FAILURE;
+        }
+        if (client->state == CLI_QUERY) {
+            STATS_ADD(client_reuses, 1);
+        }
+        client->req_l      = req_l;
         client->hasRequest = true;
     }
 
     /* Handle request based on method */
-    if (strcmp(client->query->req->method, "CONNECT") == 0) {
+    if (strcasecmp(client->query->req->method, CONNECT_METHOD) == 0) {
         client->state = CLI_CONNECT;
         ret = Proxy_handleCONNECT(proxy, client);
-    } else if (strcmp(client->query->req->method, "GET") == 0) {
+    } else if (strcasecmp(client->query->req->method, GET_METHOD) == 0) {
         client->state = CLI_GET;
+        arm_timeout(proxy, client);
         ret = Proxy_handleGET(proxy, client);
     } else {
         ret = ERROR_FAILURE;  // Invalid method
@@ -1073,6 +2039,40 @@ int Proxy_handleClient(Proxy *proxy, Client *client) {
     return ret;
 }
 
+/* next_request
+ *    Purpose: Moves a persistent client on to its next request once the
+ *             response to the current one is queued. The request is dropped
+ *             from the front of the buffer and the query is reset rather than
+ *             freed, then a pipelined request behind it is handled right
+ *             away, so responses are queued in the order asked. A client that
+ *             did not ask to keep the connection, or a response delimited by
+ *             closing, ends it once written instead.
+ *    Returns: EXIT_SUCCESS, CLIENT_CLOSE, HALT, or an error.
+ */
+static int next_request(Proxy *proxy, Client *client) {
+    while (client->hasRequest && client->query->state == QRY_DONE && client->task == NULL) {
+        if (!client->query->req->keep_alive || client->query->frame.state == FRAME_CLOSE) {
+            return flush_client(proxy, client);
+        }
+
+        client->buffer_l -= client->req_l;
+        memmove(client->buffer, client->buffer + client->req_l, client->buffer_l);
+        zero(client->buffer + client->buffer_l, client->req_l);
+        client->req_l      = 0;
+        client->hasRequest = false;
+        client->state      = CLI_QUERY;
+        arm_timeout(proxy, client);
+        update_interest(proxy, client);
+
+        int ret = start_request(proxy, client);
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int Proxy_handleEvent(Proxy *proxy, Client *client, int error_code) {
     if (proxy == NULL || client == NULL) {
         return ERROR_FAILURE;
@@ -1083,90 +2083,255 @@ int Proxy_handleEvent(Proxy *proxy, Client *client, int error_code) {
         case PROXY_ERROR_CLOSE:
         case PROXY_ERROR_SEND:
         case PROXY_ERROR_RECV:
-            Proxy_close(client->socket, &proxy->master_set, proxy->client_list, client);
+            Proxy_close(proxy, client);
             break;
         case ERROR_FAILURE:
             Proxy_sendError(client, error_code);
-            Proxy_close(client->socket, &proxy->master_set, proxy->client_list, client);
+            Proxy_close(proxy, client);
+            break;
+        case HALT:
+            return HALT;
+        case HOST_UNKNOWN:
+        case PROXY_ERROR_BAD_GATEWAY:
+        case PROXY_ERROR_CONNECT:
+        case PROXY_ERROR_FETCH:
+            Proxy_sendError(client, BAD_GATEWAY_502);
+            Proxy_close(proxy, client);
+            break;
+#if RUN_FILTER
+        case PROXY_ERROR_FILTERED:
+            Proxy_sendError(client, FORBIDDEN_403);
+            Proxy_close(proxy, client);
             break;
+#endif
         default:
-            return error_code;
+            /* a failure on one connection must not take the proxy down */
+            Proxy_close(proxy, client);
+            break;
     }
 
     return EXIT_SUCCESS;
 }
 
-int Proxy_handleTunnel(int sender, int receiver) {
-    char buffer[BUFFER_SIZE];
-    ssize_t n;
-
-    /* Read from sender */
-    n = recv(sender, buffer, sizeof(buffer), 0);
-    if (n <= 0) {
-        return (n == 0) ? CLIENT_CLOSE : PROXY_ERROR_RECV;
+/* Proxy_handleTunnel
+ *    Purpose: Relays what one side of a CONNECT tunnel sent. Each direction
+ *             has its own buffer, a pipe the bytes are spliced through or a
+ *             ring, so a slow receiver never blocks the proxy. The sender
+ *             stops being read while its direction is above the high
+ *             watermark, and its end of file is passed on as a shutdown
+ *             once everything before it was written.
+ * Parameters: @proxy - Pointer to the Proxy
+ *             @client - Client owning the tunnel
+ *             @from_client - true to relay client to origin, false for the
+ *                            origin to client direction
+ *    Returns: EXIT_SUCCESS, CLIENT_CLOSE once both directions ended, or an
+ *             error.
+ */
+int Proxy_handleTunnel(Proxy *proxy, Client *client, bool from_client) {
+    Query *query = client->query;
+    int sender = from_client ? client->socket : query->socket;
+    TunnelBuf *tb = from_client ? &query->tunnel : &client->tunnel;
+
+    /* Move what the sender has into the direction's buffer */
+    ssize_t n = TunnelBuf_fill(tb, sender);
+    if (n < 0 && errno == EINVAL && TunnelBuf_isSpliced(tb) && tb->len == 0) {
+        /* the sender cannot be spliced, copy this direction instead */
+        if (TunnelBuf_openRing(tb) != EXIT_SUCCESS) {
+            return ERROR_FAILURE;
+        }
+        n = TunnelBuf_fill(tb, sender);
     }
-
-    /* Send to receiver */
-    ssize_t written = 0;
-    while (written < n) {
-        ssize_t bytes = send(receiver, buffer + written, n - written, MSG_NOSIGNAL);
-        if (bytes <= 0) {
-            return PROXY_ERROR_SEND;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return PROXY_ERROR_RECV;
+    }
+    if (n > 0) {
+        STATS_ADD(tunnel_bytes, n);
+        if (TunnelBuf_isSpliced(tb)) {
+            STATS_ADD(splice_bytes, n);
         }
-        written += bytes;
     }
 
+    /* Write what the receiver takes now, the rest once it is writable */
+    int ret = drain_tunnel(proxy, client, !from_client);
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    update_interest(proxy, client);
     return EXIT_SUCCESS;
 }
 
+/* Proxy_write
+ *    Purpose: Queues bytes for the client and writes as much as the socket
+ *             takes right away. The rest is flushed when the client socket
+ *             becomes writable, the caller never waits on a slow client.
+ * Parameters: @proxy - Pointer to the Proxy
+ *             @client - Client to write to, over TLS if it is an SSL client
+ *             @buf - Bytes to write
+ *             @len - Number of bytes
+ *    Returns: EXIT_SUCCESS, PROXY_ERROR_SEND if the write failed, or
+ *             ERROR_FAILURE if the bytes could not be queued.
+ */
+int Proxy_write(Proxy *proxy, Client *client, char *buf, size_t len) {
+    if (proxy == NULL || client == NULL || buf == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    if (OutQueue_push(&client->out, buf, len) < 0) {
+        return ERROR_FAILURE;
+    }
+
+    return flush_client(proxy, client);
+}
+
 int Proxy_handle(Proxy *proxy) {
     if (proxy == NULL) {
         return ERROR_FAILURE;
     }
 
-    int ret = EXIT_SUCCESS;
+    int fd, ret, role;
+    Conn *conn = NULL;
     Client *client = NULL;
-    Node *curr = NULL, *next = NULL;
+    EventLoop *loop = proxy->loop;
 
-    for (curr = proxy->client_list->head; curr != NULL; curr = next) {
-        next = curr->next;
-        client = (Client *)curr->data;
+    for (int i = 0; i < loop->nready; i++) {
+        fd = loop->ready[i].fd;
 
-        /* Handle client in query or init state */
-        if ((client->state == CLI_QUERY || client->state == CLI_INIT) && 
-            FD_ISSET(client->socket, &proxy->readfds)) {
-            ret = Proxy_handleClient(proxy, client);
-            if (ret < 0) {
-                goto event_handler;
+        /* skip fds closed earlier in this iteration */
+        conn = ConnTable_get(proxy->conns, fd);
+        if (conn == NULL) {
+            continue;
+        }
+
+        /* an upstream connect or handshake in progress advances on either
+         * readiness, the handler then sends the request or the 200 reply */
+        if ((conn->role == CONN_UPSTREAM || conn->role == CONN_TUNNEL) && is_connecting(conn->client->query)) {
+            client = conn->client;
+            ret = (conn->role == CONN_UPSTREAM) ? Proxy_handleGET(proxy, client) : Proxy_handleCONNECT(proxy, client);
+            if (ret != EXIT_SUCCESS) {
+                ret = Proxy_handleEvent(proxy, client, ret);
+                if (ret != EXIT_SUCCESS) {
+                    return ret;
+                }
             }
+            continue;
         }
 
-        /* Handle client based on state */
-        switch (client->state) {
-            case CLI_GET:
-                ret = Proxy_handleGET(proxy, client);
-                break;
-            case CLI_CONNECT:
-                ret = Proxy_handleCONNECT(proxy, client);
-                break;
 #if RUN_SSL
-            case CLI_SSL:
-                if (FD_ISSET(client->socket, &proxy->readfds)) {
-                    ret = ProxySSL_handshake(proxy, client);
+        /* so does an intercept handshake waiting on the client socket */
+        if (conn->role == CONN_CLIENT && conn->client->state == CLI_SSL && conn->client->ssl != NULL) {
+            client = conn->client;
+            ret = ProxySSL_handshake(proxy, client);
+            if (ret != EXIT_SUCCESS) {
+                ret = Proxy_handleEvent(proxy, client, ret);
+                if (ret != EXIT_SUCCESS) {
+                    return ret;
                 }
-                break;
+            }
+            continue;
+        }
+#endif
+
+        /* flush queued output first, this may resume reading the other side */
+        if (EventLoop_isWritable(loop, fd) && conn->client != NULL) {
+            client = conn->client;
+            ret = (conn->role == CONN_CLIENT) ? flush_client(proxy, client) : flush_query(proxy, client);
+            if (ret != EXIT_SUCCESS) {
+                ret = Proxy_handleEvent(proxy, client, ret);
+                if (ret != EXIT_SUCCESS) {
+                    return ret;
+                }
+                continue;
+            }
+        }
+
+        if (!EventLoop_isReadable(loop, fd)) {
+            continue;
+        }
+
+        if (conn->role == CONN_WAKE) {
+            char drain[64];
+            while (read(fd, drain, sizeof(drain)) > 0) {
+            }
+            if (__atomic_load_n(&proxy->shared->halt, __ATOMIC_ACQUIRE)) {
+                return HALT;
+            }
+            continue;
+        }
+
+        if (conn->role == CONN_DNS) {
+            Resolver_handle(proxy->resolver);
+            continue;
+        }
+
+        if (conn->role == CONN_POOL) {
+            PoolQueue_drain(&proxy->completions);
+            continue;
+        }
+
+        if (conn->role == CONN_LISTEN) {
+            if (Proxy_handleListener(proxy) < 0) {
+                print_error("proxy: failed to handle listener");
+                return ERROR_FAILURE;
+            }
+            continue;
+        }
+
+        client = conn->client;
+        role   = conn->role;
+        ret    = EXIT_SUCCESS;
+
+        /* a tunnel relayed by the io_uring engine has ended */
+        if (EventLoop_isClosed(loop, fd)) {
+            ret = Proxy_handleEvent(proxy, client, CLIENT_CLOSE);
+            if (ret != EXIT_SUCCESS) {
+                return ret;
+            }
+            continue;
+        }
+
+        switch (conn->role) {
+            case CONN_CLIENT:
+                switch (client->state) {
+                    case CLI_INIT:
+                    case CLI_QUERY:
+                        ret = Proxy_handleClient(proxy, client);
+                        break;
+#if RUN_SSL
+                    case CLI_SSL:
+                        ret = ProxySSL_handshake(proxy, client);
+                        break;
 #endif
-            case CLI_TUNNEL:
-                if (FD_ISSET(client->socket, &proxy->readfds)) {
-                    ret = Proxy_handleTunnel(client->socket, client->query->socket);
+                    case CLI_TUNNEL:
+                        ret = Proxy_handleTunnel(proxy, client, true);
+                        Client_timestamp(client);
+                        break;
+                    default:
+                        /* request in flight, only a close is of interest here */
+                        ret = Proxy_recv(client, CLIENT_TYPE);
+                        if (ret >= 0) {
+                            ret = (client->state == CLI_CLOSE) ? CLIENT_CLOSE : EXIT_SUCCESS;
+                        }
+                        break;
                 }
-                if (FD_ISSET(client->query->socket, &proxy->readfds)) {
-                    ret = Proxy_handleTunnel(client->query->socket, client->socket);
+                break;
+            case CONN_UPSTREAM:
+                ret = Proxy_handleGET(proxy, client);
+                if (ret == EXIT_SUCCESS && client->query->state == QRY_RECVD_RESPONSE) {
+                    ret = Proxy_handleGET(proxy, client);
                 }
                 break;
+            case CONN_TUNNEL:
+                ret = Proxy_handleTunnel(proxy, client, false);
+                Client_timestamp(client);
+                break;
+        }
+
+        /* a response just queued in full lets the next request start */
+        if (ret == EXIT_SUCCESS && role != CONN_TUNNEL) {
+            ret = next_request(proxy, client);
         }
 
-event_handler:
         if (ret != EXIT_SUCCESS) {
             ret = Proxy_handleEvent(proxy, client, ret);
             if (ret != EXIT_SUCCESS) {
@@ -1176,7 +2341,9 @@ event_handler:
     }
 
 #if RUN_CACHE
-    Cache_refresh(proxy->cache);
+    pthread_mutex_lock(&proxy->shared->cache_lock);
+    Cache_refresh(proxy->shared->cache);
+    pthread_mutex_unlock(&proxy->shared->cache_lock);
 #endif
 
     return EXIT_SUCCESS;
@@ -1187,42 +2354,32 @@ int Proxy_handleTimeout(Proxy *proxy) {
         return ERROR_FAILURE;
     }
 
-    double now = get_current_time();
-    double timeout = TIMEOUT_THRESHOLD;
-    Node *curr = proxy->client_list->head;
-
-    while (curr != NULL) {
-        Client *client = (Client *)curr->data;
-        Node *next = curr->next;
-
-        double age = now - timeval_to_double(client->last_active);
-        if (age > TIMEOUT_THRESHOLD) {
-            Proxy_close(client->socket, &proxy->master_set, proxy->client_list, client);
-        } else {
-            double time_til_timeout = TIMEOUT_THRESHOLD - age;
-            if (time_til_timeout < timeout) {
-                timeout = time_til_timeout;
-            }
-        }
-        curr = next;
-    }
-
-    if (timeout == TIMEOUT_THRESHOLD) {
-        if (proxy->timeout != NULL) {
-            free(proxy->timeout);
-            proxy->timeout = NULL;
-        }
+    /* Close the clients whose timers expired since the last call, retransmit
+     * or fail the DNS queries that went unanswered, and close the origin
+     * connections left idle */
+    TimerWheel_advance(&proxy->timers, expire_client, proxy);
+    Resolver_tick(proxy->resolver);
+    UpstreamPool_tick(&proxy->upstreams);
+
+    /* Sleep until one of the wheels needs to turn again */
+    struct timeval dns_tv, idle_tv;
+    bool armed = TimerWheel_nextTimeout(&proxy->timers, &proxy->timeout_tv);
+    if (Resolver_nextTimeout(proxy->resolver, &dns_tv) &&
+        (!armed || timercmp(&dns_tv, &proxy->timeout_tv, <))) {
+        proxy->timeout_tv = dns_tv;
+        armed = true;
+    }
+    if (UpstreamPool_nextTimeout(&proxy->upstreams, &idle_tv) &&
+        (!armed || timercmp(&idle_tv, &proxy->timeout_tv, <))) {
+        proxy->timeout_tv = idle_tv;
+        armed = true;
+    }
+    if (!armed) {
+        proxy->timeout = NULL;
         return TIMEOUT_FALSE;
     }
+    proxy->timeout = &proxy->timeout_tv;
 
-    if (proxy->timeout == NULL) {
-        proxy->timeout = calloc(1, sizeof(struct timeval));
-        if (proxy->timeout == NULL) {
-            return ERROR_FAILURE;
-        }
-    }
-
-    double_to_timeval(proxy->timeout, timeout);
     return TIMEOUT_TRUE;
 }
 
@@ -1233,30 +2390,41 @@ int Proxy_handleGET(Proxy *proxy, Client *client)
 #if RUN_CACHE
         char *key = get_key(client->query->req);
         if (key != NULL) {
-            Response *cache_res = Cache_get(proxy->cache, key);
-            if (cache_res != NULL) {
-                long cache_res_age = Cache_get_age(proxy->cache, key);
-                ret = Proxy_serveFromCache(proxy, client, cache_res_age, key);
+            pthread_mutex_lock(&proxy->shared->cache_lock);
+            Response *cache_res = Cache_get(proxy->shared->cache, key);
+            long cache_res_age = (cache_res != NULL) ? Cache_get_age(proxy->shared->cache, key) : -1;
+            pthread_mutex_unlock(&proxy->shared->cache_lock);
+
+            /* another worker may evict the entry in between, then fetch it */
+            ret = (cache_res != NULL) ? Proxy_serveFromCache(proxy, client, cache_res_age, key) : PROXY_CACHE_MISS;
+            if (ret != PROXY_CACHE_MISS) {
                 if (ret < 0) {
                     print_error("proxy: failed to serve from cache");
                     free(key);
                     return ret;
                 }
                 free(key);
+                client->query->state = QRY_DONE;
                 return EXIT_SUCCESS;
             }
             free(key);
         }
 #endif
-        /* make connection to server */
-        client->query->socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (client->query->socket < 0) {
-            print_error("proxy: failed to create socket");
-            return ERROR_SOCKET;
-        }
+    }
 
-        /* connect to server */
-        ret = (client->isSSL) ? ProxySSL_connect(proxy, client->query) : Proxy_fetch(proxy, client->query);
+    if (is_connecting(client->query)) {
+        /* connect to server, borrowing an idle connection if there is one */
+        ret = connect_upstream(proxy, client, CONN_UPSTREAM, client->isSSL);
+        if (ret > 0) {
+            return EXIT_SUCCESS;
+        }
+        if (ret == EXIT_SUCCESS) {
+            client->query->state = QRY_SENT_REQUEST;
+            ret = Proxy_fetch(proxy, client->query);
+            if (ret >= 0) {
+                ret = flush_query(proxy, client);
+            }
+        }
 
 #if DEBUG
         fprintf(stderr, "[proxy-handle-get] connect returned %d\n", ret);
@@ -1264,22 +2432,35 @@ int Proxy_handleGET(Proxy *proxy, Client *client)
         if (ret < 0) {
             print_error("proxy: failed to connect to server");
             if (client->query->socket != -1) {
+                unwatch_fd(proxy, client->query->socket);
                 close(client->query->socket);
                 client->query->socket = -1;
             }
             return ret;
         }
-        client->query->state = QRY_SENT_REQUEST;
     } else if (client->query->state == QRY_SENT_REQUEST) {
-        if (FD_ISSET(client->query->socket, &proxy->readfds)) {
+        if (query_ready(proxy, client->query)) {
             ret = Proxy_handleQuery(proxy, client->query, client->isSSL);
 #if DEBUG
             fprintf(stderr, "[proxy-handle-get] handle query returned %d\n", ret);
 #endif
+            if (ret < 0 && client->query->reused && client->query->buffer_l == 0 && !client->query->cache_skip &&
+                client->query->frame.state == FRAME_STATUS && client->query->frame.line_l == 0) {
+                /* the origin closed the pooled connection just as it was
+                 * reused, nothing reached the client so ask again */
+                return retry_fresh(proxy, client);
+            }
             if (ret < 0) {
                 print_error("proxy: failed to handle query");
                 return ret;
             }
+#if !RUN_COLOR
+            /* coloring rewrites the whole body, anything else is forwarded
+             * as it arrives */
+            if (client->query->state == QRY_SENT_REQUEST) {
+                ret = stream_response(proxy, client);
+            }
+#endif
         }
     } else if (client->query->state == QRY_RECVD_RESPONSE) {
 #if DEBUG
@@ -1290,6 +2471,18 @@ int Proxy_handleGET(Proxy *proxy, Client *client)
             print_error("proxy: failed to send server response to client");
             return ret;
         }
+        client->query->state = QRY_DONE;
+
+        /* the response is complete, stop watching the origin and keep the
+         * connection for its next request unless either side ends it */
+        unwatch_fd(proxy, client->query->socket);
+        if (!ResponseFrame_done(&client->query->frame) || !client->query->frame.keep_alive ||
+            UpstreamPool_return(&proxy->upstreams, client->query, client->isSSL) != EXIT_SUCCESS) {
+            close(client->query->socket);
+        }
+        client->query->socket = -1;
+
+        ret = flush_client(proxy, client);
 #if DEBUG
         print_success("[proxy-handle-get] sent server response to client");
 #endif
@@ -1298,40 +2491,26 @@ int Proxy_handleGET(Proxy *proxy, Client *client)
     return ret;
 }
 
-Node *List_add(List *list, void *data) {
-    if (list == NULL || data == NULL) {
-        return NULL;
-    }
-
-    Node *node = (Node *)malloc(sizeof(Node));
-    if (node == NULL) {
-        return NULL;
-    }
-
-    node->data = data;
-    node->next = NULL;
-
-    if (list->head == NULL) {
-        list->head = node;
-    } else {
-        Node *curr = list->head;
-        while (curr->next != NULL) {
-            curr = curr->next;
-        }
-        curr->next = node;
-    }
-
-    return node;
-}
-
-int Query_connect(Query *query) {
+/* Query_connect
+ *    Purpose: Starts a non-blocking connect to the origin on the registered
+ *             query socket, or once the socket turned writable, collects its
+ *             outcome.
+ *    Returns: EXIT_SUCCESS when connected, CONNECT_WANT_WRITE while the
+ *             connect is in progress, or PROXY_ERROR_BAD_GATEWAY.
+ */
+static int Query_connect(EventLoop *loop, Query *query) {
     if (query == NULL) {
         return ERROR_FAILURE;
     }
 
+    /* Collect the result of the connect in progress */
+    if (query->state == QRY_CONNECTING) {
+        return (EventLoop_connectError(loop, query->socket) != 0) ? PROXY_ERROR_BAD_GATEWAY : EXIT_SUCCESS;
+    }
+
     /* Connect to server */
-    if (connect(query->socket, (struct sockaddr *)&query->server_addr, sizeof(query->server_addr)) < 0) {
-        return PROXY_ERROR_BAD_GATEWAY;
+    if (EventLoop_connect(loop, query->socket, (struct sockaddr *)&query->server_addr, sizeof(query->server_addr)) < 0) {
+        return (errno == EINPROGRESS) ? CONNECT_WANT_WRITE : PROXY_ERROR_BAD_GATEWAY;
     }
 
     return EXIT_SUCCESS;
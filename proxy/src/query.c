@@ -1,16 +1,34 @@
 #include "query.h"
 
+static void query_reset(Query *query);
+
+/* Query_new
+ *    Purpose: Creates the query for a request, or resets the client's current
+ *             one for its next request. A reset query keeps its buffer, and
+ *             its socket if no connection was made on it. The socket is
+ *             opened by the proxy when it connects, not here.
+ * Parameters: @q - Pointer to the query pointer, NULL to create one
+ *             @buffer - Buffer holding the request
+ *             @buffer_l - Length of the request in the buffer
+ *    Returns: EXIT_SUCCESS, HALT for a halt request, HOST_UNKNOWN, or
+ *             ERROR_FAILURE.
+ */
 int Query_new(Query **q, char *buffer, size_t buffer_l)
 {
     if (q == NULL || buffer == NULL) {
         return ERROR_FAILURE;
     } 
 
-    /* allocate memory for the query */
-    if (*q != NULL) { Query_free(*q); }
-    *q = calloc(1, sizeof(Query));
-    if (*q == NULL) {
-        return ERROR_FAILURE;
+    /* allocate memory for the query, unless the client reuses it */
+    if (*q != NULL) {
+        query_reset(*q);
+    } else {
+        *q = calloc(1, sizeof(Query));
+        if (*q == NULL) {
+            return ERROR_FAILURE;
+        }
+        (*q)->socket = -1;
+        TunnelBuf_init(&(*q)->tunnel);
     }
 
     /* create new request from buffer */
@@ -22,6 +40,9 @@ int Query_new(Query **q, char *buffer, size_t buffer_l)
         return ERROR_FAILURE;
     }
 
+    ResponseFrame_init(&(*q)->frame, (*q)->req->method_l == HEAD_METHOD_L &&
+                                     strncmp((*q)->req->method, HEAD_METHOD, HEAD_METHOD_L) == 0);
+
     /* check if the request is a halt request */
     if (strncmp((*q)->req->method, PROXY_HALT, (*q)->req->method_l) == 0) {
         Query_free(*q);
@@ -30,38 +51,25 @@ int Query_new(Query **q, char *buffer, size_t buffer_l)
     }
 
     /* initialize query buffer */
-    (*q)->buffer = calloc(QUERY_BUFFER_SZ + 1, sizeof(char));
     if ((*q)->buffer == NULL) {
-        Query_free(*q);
-        *q = NULL;
-        return ERROR_FAILURE;
+        (*q)->buffer = calloc(QUERY_BUFFER_SZ + 1, sizeof(char));
+        if ((*q)->buffer == NULL) {
+            Query_free(*q);
+            *q = NULL;
+            return ERROR_FAILURE;
+        }
+        (*q)->buffer_sz = QUERY_BUFFER_SZ;
     }
     (*q)->buffer_l = 0;
-    (*q)->buffer_sz = QUERY_BUFFER_SZ;
-
-    /* open query socket */
-    (*q)->socket = socket(AF_INET, SOCK_STREAM, 0);
-    if ((*q)->socket < 0) {
-        print_error("client socket call failed");
-        Query_free(*q);
-        *q = NULL;
-        return ERROR_FAILURE;
-    }
 
     if ((*q)->req->host_l == 0) {
         print_warning("query_new: host is empty");
         return HOST_UNKNOWN;
     }
-    
-    (*q)->host_info = gethostbyname((*q)->req->host);
-    if ((*q)->host_info == NULL) {
-        print_error("query_new: host not found");
-        return HOST_UNKNOWN;
-    }
 
+    /* the address is filled in by the proxy's resolver */
     bzero(&(*q)->server_addr, sizeof((*q)->server_addr));
     (*q)->server_addr.sin_family = AF_INET;
-    memcpy((char *)&(*q)->server_addr.sin_addr.s_addr, (*q)->host_info->h_addr_list[0], ((*q)->host_info->h_length));
     (*q)->server_addr.sin_port = htons(atoi((*q)->req->port)); // ! - caller needs to change port 443 for HTTPS
 
     (*q)->res = NULL;
@@ -71,7 +79,6 @@ int Query_new(Query **q, char *buffer, size_t buffer_l)
     return EXIT_SUCCESS;
 }
 
-
 void Query_free(Query *query)
 {
     if (query == NULL) {
@@ -87,6 +94,8 @@ void Query_free(Query *query)
 
     close(query->socket);
     query->socket = -1;
+    OutQueue_clear(&query->out);
+    TunnelBuf_close(&query->tunnel);
 
     #if RUN_SSL
     Query_clearSSLCtx(query);
@@ -127,6 +136,11 @@ void Query_clearSSL(Query *query)
         return;
     }
 
+    /* OpenSSL stops resuming the session of a connection freed without a
+     * close_notify */
+    if (query->ssl != NULL && SSL_is_init_finished(query->ssl)) {
+        SSL_shutdown(query->ssl);
+    }
     SSL_free(query->ssl);
     query->ssl = NULL;
 }
@@ -141,3 +155,28 @@ void Query_clearSSLCtx(Query *query)
     query->ctx = NULL;
 }
 #endif 
+
+/* query_reset
+ *    Purpose: Drops what the last request left in a query. Its upstream
+ *             connection was returned or closed when the response completed,
+ *             a socket still open was never connected.
+ */
+static void query_reset(Query *query)
+{
+    Request_free(query->req);
+    Response_free(query->res);
+    query->req = NULL;
+    query->res = NULL;
+    OutQueue_clear(&query->out);
+
+    query->buffer_l   = 0;
+    query->fwd_l      = 0;
+    query->cache_skip = false;
+    query->reused     = false;
+    query->no_pool    = false;
+#if RUN_SSL
+    query->ssl_want_write = false;
+#endif
+    query->gotHeader  = 0;
+    query->bytes_left = 0;
+}
@@ -0,0 +1,314 @@
+#include "session.h"
+
+#if RUN_SSL
+static int new_session(SSL *ssl, SSL_SESSION *session);
+static void free_key(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+static SessionSlot *find_slot(SessionCache *cache, const char *key);
+static bool expired(SSL_SESSION *session);
+static int ticket_key(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx,
+                      int enc);
+static int rotate(TicketKeys *keys, time_t now);
+static TicketKey *find_key(TicketKeys *keys, const unsigned char *name, time_t now);
+
+/* SSL ex_data index of the cache key an upstream connection stores its
+ * sessions under, freed with the SSL object */
+static int key_index = -1;
+
+/* session ID context of the intercepted connections, sessions are only
+ * resumed by the context that created them */
+static const unsigned char sid_ctx[] = "http-proxy";
+
+/* SessionCache_init
+ *    Purpose: Has the client side context hand every session it establishes,
+ *             TLS 1.3 tickets included, to the cache instead of keeping them
+ *             in OpenSSL's internal store.
+ * Parameters: @cache - Pointer to the SessionCache
+ *             @ctx - Context the upstream connections are created from
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE.
+ */
+int SessionCache_init(SessionCache *cache, SSL_CTX *ctx)
+{
+    if (cache == NULL || ctx == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(cache->slots, sizeof(cache->slots));
+    pthread_mutex_init(&cache->lock, NULL);
+
+    if (key_index < 0) {
+        key_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, free_key);
+        if (key_index < 0) {
+            return ERROR_FAILURE;
+        }
+    }
+
+    SSL_CTX_set_app_data(ctx, cache);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, new_session);
+
+    return EXIT_SUCCESS;
+}
+
+/* SessionCache_free
+ *    Purpose: Drops the cached sessions.
+ */
+void SessionCache_free(SessionCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < SESSION_CACHE_SZ; i++) {
+        SSL_SESSION_free(cache->slots[i].session);
+        cache->slots[i].session = NULL;
+    }
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/* SessionCache_prepare
+ *    Purpose: Sets up an upstream connection before its handshake: sessions
+ *             it establishes are cached under its host and port, and the one
+ *             cached from an earlier connection, if any, is offered for
+ *             resumption. A TLS 1.3 ticket is taken out of the cache as it
+ *             should not be used twice, the origin sends fresh ones.
+ * Parameters: @cache - Pointer to the SessionCache
+ *             @ssl - Upstream connection, not yet connected
+ *             @host - Origin host
+ *             @port - Origin port
+ *    Returns: true if a session was offered, false otherwise.
+ */
+bool SessionCache_prepare(SessionCache *cache, SSL *ssl, const char *host, const char *port)
+{
+    if (cache == NULL || ssl == NULL || host == NULL || port == NULL) {
+        return false;
+    }
+
+    char *key = calloc(UPSTREAM_KEY_MAX, sizeof(char));
+    if (key == NULL) {
+        return false;
+    }
+    snprintf(key, UPSTREAM_KEY_MAX, "%s:%s", host, port);
+    if (!SSL_set_ex_data(ssl, key_index, key)) {
+        free(key);
+        return false;
+    }
+
+    bool offered = false;
+    pthread_mutex_lock(&cache->lock);
+    SessionSlot *slot = find_slot(cache, key);
+    if (slot->session != NULL && strcmp(slot->key, key) == 0) {
+        bool stale = expired(slot->session);
+        if (!stale) {
+            offered = (SSL_set_session(ssl, slot->session) == 1);
+        }
+        if (stale || SSL_SESSION_get_protocol_version(slot->session) == TLS1_3_VERSION) {
+            SSL_SESSION_free(slot->session);
+            slot->session = NULL;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (offered) {
+        STATS_ADD(tls_offered, 1);
+    }
+
+    return offered;
+}
+
+/* new_session
+ *    Purpose: OpenSSL callback for a session established on an upstream
+ *             connection, after the handshake for TLS 1.2 or with each
+ *             ticket the origin sends for TLS 1.3.
+ *    Returns: 1 if the cache kept the reference passed in, 0 if not.
+ */
+static int new_session(SSL *ssl, SSL_SESSION *session)
+{
+    SessionCache *cache = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    char *key = SSL_get_ex_data(ssl, key_index);
+    if (cache == NULL || key == NULL || !SSL_SESSION_is_resumable(session)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    SessionSlot *slot = find_slot(cache, key);
+    SSL_SESSION_free(slot->session);
+    slot->session = session;
+    memcpy(slot->key, key, UPSTREAM_KEY_MAX);
+    pthread_mutex_unlock(&cache->lock);
+
+    return 1;
+}
+
+static void free_key(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+    (void)parent;
+    (void)ad;
+    (void)idx;
+    (void)argl;
+    (void)argp;
+    free(ptr);
+}
+
+static SessionSlot *find_slot(SessionCache *cache, const char *key)
+{
+    return &cache->slots[hash_foo((unsigned char *)key) % SESSION_CACHE_SZ];
+}
+
+static bool expired(SSL_SESSION *session)
+{
+    return (time_t)(SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)) <= time(NULL);
+}
+
+/* TicketKeys_init
+ *    Purpose: Has the server side context keep sessions of the intercepted
+ *             clients, resumable by session ID for TLS 1.2 clients without
+ *             ticket support, and encrypt session tickets with keys rotated
+ *             every TICKET_KEY_ROTATE seconds.
+ * Parameters: @keys - Pointer to the TicketKeys
+ *             @ctx - Context the intercepted connections are created from
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE.
+ */
+int TicketKeys_init(TicketKeys *keys, SSL_CTX *ctx)
+{
+    if (keys == NULL || ctx == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(keys, sizeof(*keys));
+    pthread_mutex_init(&keys->lock, NULL);
+    if (rotate(keys, time(NULL)) != EXIT_SUCCESS) {
+        return ERROR_FAILURE;
+    }
+
+    SSL_CTX_set_app_data(ctx, keys);
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, TLS_SESSION_CACHE_SZ);
+    SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+    if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key) != 1) {
+        return ERROR_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* TicketKeys_free
+ *    Purpose: Wipes the ticket keys.
+ */
+void TicketKeys_free(TicketKeys *keys)
+{
+    if (keys == NULL) {
+        return;
+    }
+
+    OPENSSL_cleanse(keys->keys, sizeof(keys->keys));
+    pthread_mutex_destroy(&keys->lock);
+}
+
+/* ticket_key
+ *    Purpose: OpenSSL callback setting up the cipher and HMAC of a ticket,
+ *             with the current key when enc is set, else with the key the
+ *             ticket names.
+ *    Returns: 1 to go on, 2 if the ticket is good but should be reissued
+ *             under the current key, 0 if its key is unknown or expired and
+ *             the client gets a full handshake, -1 on error.
+ */
+static int ticket_key(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx,
+                      int enc)
+{
+    TicketKeys *keys = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (keys == NULL) {
+        return -1;
+    }
+
+    TicketKey key;
+    int ret = 1;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&keys->lock);
+    if (rotate(keys, now) != EXIT_SUCCESS) {
+        pthread_mutex_unlock(&keys->lock);
+        return -1;
+    }
+    if (enc) {
+        key = keys->keys[keys->current];
+    } else {
+        TicketKey *found = find_key(keys, name, now);
+        if (found == NULL) {
+            pthread_mutex_unlock(&keys->lock);
+            return 0;
+        }
+        key = *found;
+        ret = (found == &keys->keys[keys->current]) ? 1 : 2;
+    }
+    pthread_mutex_unlock(&keys->lock);
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+        OSSL_PARAM_construct_end(),
+    };
+    const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+    if (enc) {
+        memcpy(name, key.name, sizeof(key.name));
+        if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(cipher)) != 1 ||
+            EVP_EncryptInit_ex(cctx, cipher, NULL, key.aes_key, iv) != 1) {
+            ret = -1;
+        }
+    } else if (EVP_DecryptInit_ex(cctx, cipher, NULL, key.aes_key, iv) != 1) {
+        ret = -1;
+    }
+    if (ret > 0 && EVP_MAC_CTX_set_params(hctx, params) != 1) {
+        ret = -1;
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+
+    return ret;
+}
+
+/* rotate
+ *    Purpose: Replaces the oldest key with a new current one once the current
+ *             key is TICKET_KEY_ROTATE seconds old. Should the new key fail,
+ *             the current one keeps encrypting. Caller holds the lock.
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if there is no key at all.
+ */
+static int rotate(TicketKeys *keys, time_t now)
+{
+    TicketKey *current = &keys->keys[keys->current];
+    if (current->created != 0 && now - current->created < TICKET_KEY_ROTATE) {
+        return EXIT_SUCCESS;
+    }
+
+    TicketKey key;
+    if (RAND_bytes(key.name, sizeof(key.name)) != 1 || RAND_priv_bytes(key.aes_key, sizeof(key.aes_key)) != 1 ||
+        RAND_priv_bytes(key.hmac_key, sizeof(key.hmac_key)) != 1) {
+        OPENSSL_cleanse(&key, sizeof(key));
+        return (current->created != 0) ? EXIT_SUCCESS : ERROR_FAILURE;
+    }
+    key.created = now;
+
+    int next = (current->created != 0) ? (keys->current + 1) % TICKET_KEYS : keys->current;
+    keys->keys[next] = key;
+    keys->current    = next;
+    OPENSSL_cleanse(&key, sizeof(key));
+    STATS_ADD(ticket_rotations, 1);
+
+    return EXIT_SUCCESS;
+}
+
+/* find_key
+ *    Purpose: Finds the key a ticket names, unless it is older than the
+ *             TICKET_KEYS rotations it is kept for. Caller holds the lock.
+ */
+static TicketKey *find_key(TicketKeys *keys, const unsigned char *name, time_t now)
+{
+    for (int i = 0; i < TICKET_KEYS; i++) {
+        TicketKey *key = &keys->keys[i];
+        if (key->created != 0 && now - key->created < (time_t)TICKET_KEY_ROTATE * TICKET_KEYS &&
+            memcmp(key->name, name, sizeof(key->name)) == 0) {
+            return key;
+        }
+    }
+
+    return NULL;
+}
+#endif
@@ -0,0 +1,68 @@
+#include "stats.h"
+
+Stats proxy_stats;
+
+/* Stats_print
+ *    Purpose: Prints the process-wide counters.
+ * Parameters: @fp - Stream to print to
+ *    Returns: None
+ */
+void Stats_print(FILE *fp)
+{
+    if (fp == NULL) {
+        return;
+    }
+
+    fprintf(fp, "%s[Stats]%s\n", CYN, CRESET);
+    fprintf(fp, "  loop syscalls = %lu\n", STATS_GET(loop_syscalls));
+    fprintf(fp, "  io syscalls   = %lu\n", STATS_GET(io_syscalls));
+    fprintf(fp, "  events        = %lu\n", STATS_GET(events));
+    fprintf(fp, "  uring sqes    = %lu\n", STATS_GET(uring_sqes));
+    fprintf(fp, "  uring cqes    = %lu\n", STATS_GET(uring_cqes));
+    fprintf(fp, "  tunnel bytes  = %lu\n", STATS_GET(tunnel_bytes));
+    fprintf(fp, "  tunnel splice = %lu\n", STATS_GET(splice_bytes));
+
+    /* bytes over summed lifetime, the mean throughput of one tunnel */
+    unsigned long usec = STATS_GET(tunnel_usec);
+    double rate = (usec > 0) ? (double)STATS_GET(tunnel_bytes) / usec * 1e6 / 1024 : 0;
+    fprintf(fp, "  tunnels       = %lu\n", STATS_GET(tunnels));
+    fprintf(fp, "  tunnel rate   = %.1f KB/s\n", rate);
+    fprintf(fp, "  ktls conns    = %lu\n", STATS_GET(ktls_conns));
+    fprintf(fp, "  dns queries   = %lu\n", STATS_GET(dns_queries));
+    fprintf(fp, "  dns hits      = %lu\n", STATS_GET(dns_hits));
+    fprintf(fp, "  dns joined    = %lu\n", STATS_GET(dns_joined));
+    fprintf(fp, "  pool tasks    = %lu\n", STATS_GET(pool_tasks));
+    fprintf(fp, "  pool steals   = %lu\n", STATS_GET(pool_steals));
+    fprintf(fp, "  cache skips   = %lu\n", STATS_GET(cache_skips));
+    fprintf(fp, "  origin reuses = %lu\n", STATS_GET(upstream_reuses));
+    fprintf(fp, "  origin stale  = %lu\n", STATS_GET(upstream_stale));
+    fprintf(fp, "  client reuses = %lu\n", STATS_GET(client_reuses));
+
+    /* resumed over completed handshakes, the session cache hit rate */
+    unsigned long handshakes = STATS_GET(tls_handshakes);
+    double resumed = (handshakes > 0) ? (double)STATS_GET(tls_resumed) / handshakes * 100 : 0;
+    fprintf(fp, "  origin tls    = %lu\n", handshakes);
+    fprintf(fp, "  tls offered   = %lu\n", STATS_GET(tls_offered));
+    fprintf(fp, "  tls resumed   = %lu (%.1f%%)\n", STATS_GET(tls_resumed), resumed);
+    fprintf(fp, "  verify hits   = %lu\n", STATS_GET(verify_hits));
+    fprintf(fp, "  verify fails  = %lu\n", STATS_GET(verify_fails));
+
+    unsigned long accepted = STATS_GET(client_tls);
+    double reused = (accepted > 0) ? (double)STATS_GET(client_resumed) / accepted * 100 : 0;
+    fprintf(fp, "  client tls    = %lu\n", accepted);
+    fprintf(fp, "  tls reused    = %lu (%.1f%%)\n", STATS_GET(client_resumed), reused);
+    double accept_ms = (accepted > 0) ? (double)STATS_GET(client_tls_usec) / accepted / 1000 : 0;
+    fprintf(fp, "  tls accept    = %.2f ms\n", accept_ms);
+    fprintf(fp, "  tls timeouts  = %lu\n", STATS_GET(client_tls_timeouts));
+    fprintf(fp, "  ticket keys   = %lu\n", STATS_GET(ticket_rotations));
+    fprintf(fp, "  certs minted  = %lu\n", STATS_GET(certs_minted));
+    fprintf(fp, "  cert hits     = %lu\n", STATS_GET(cert_hits));
+    fprintf(fp, "  cert loads    = %lu\n", STATS_GET(cert_loads));
+
+    /* keys over time spent generating them, the refill thread's rate */
+    unsigned long keygen = STATS_GET(keygen_usec);
+    double refill = (keygen > 0) ? (double)STATS_GET(keys_pooled) / keygen * 1e6 : 0;
+    fprintf(fp, "  key pool      = %lu\n", STATS_GET(key_pool_depth));
+    fprintf(fp, "  key refill    = %.1f keys/s\n", refill);
+    fprintf(fp, "  key misses    = %lu\n", STATS_GET(key_pool_misses));
+}
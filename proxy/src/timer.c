@@ -0,0 +1,293 @@
+#include "timer.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+
+static unsigned long now_ticks(void);
+static void link_timer(Timer *head, Timer *timer);
+static void unlink_timer(Timer *timer);
+static void insert(TimerWheel *wheel, Timer *timer);
+static void cascade(TimerWheel *wheel, int level);
+
+/* TimerWheel_init
+ *    Purpose: Initializes an empty wheel starting at the current tick.
+ * Parameters: @wheel - Pointer to the TimerWheel to initialize
+ *    Returns: None
+ */
+void TimerWheel_init(TimerWheel *wheel)
+{
+    if (wheel == NULL) {
+        return;
+    }
+
+    for (int l = 0; l < TIMER_LEVELS; l++) {
+        for (int s = 0; s < TIMER_SLOTS; s++) {
+            wheel->slots[l][s].next = &wheel->slots[l][s];
+            wheel->slots[l][s].prev = &wheel->slots[l][s];
+        }
+    }
+    wheel->now   = now_ticks();
+    wheel->count = 0;
+}
+
+/* TimerWheel_advance
+ *    Purpose: Turns the wheel up to the current time and fires the timers
+ *             that expired in one batch. Timers whose deadline was pushed back
+ *             by Timer_touch are re-slotted instead of fired. The callback may
+ *             cancel or reschedule any timer, including the one firing.
+ * Parameters: @wheel - Pointer to the TimerWheel
+ *             @expire - Called with the data of each expired timer and arg
+ *             @arg - Passed through to expire
+ *    Returns: Number of timers that expired.
+ */
+int TimerWheel_advance(TimerWheel *wheel, void (*expire)(void *data, void *arg), void *arg)
+{
+    if (wheel == NULL) {
+        return 0;
+    }
+
+    unsigned long target = now_ticks();
+    if (wheel->count == 0) {
+        wheel->now = target;
+        return 0;
+    }
+
+    Timer expired;
+    expired.next = &expired;
+    expired.prev = &expired;
+
+    while (wheel->now < target) {
+        wheel->now++;
+
+        /* level l turns over when the lower bits roll back to zero, upper
+         * levels cascade first so their timers can fall through */
+        int top       = 0;
+        unsigned long t = wheel->now;
+        while (top + 1 < TIMER_LEVELS && (t & SLOT_MASK) == 0) {
+            t >>= TIMER_SLOT_BITS;
+            top++;
+        }
+        for (int l = top; l >= 1; l--) {
+            cascade(wheel, l);
+        }
+
+        Timer *head = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (head->next != head) {
+            Timer *timer = head->next;
+            unlink_timer(timer);
+            if (timer->expires > wheel->now) {
+                insert(wheel, timer);
+            } else {
+                link_timer(&expired, timer);
+            }
+        }
+    }
+
+    int n = 0;
+    while (expired.next != &expired) {
+        Timer *timer = expired.next;
+        unlink_timer(timer);
+        timer->wheel = NULL;
+        wheel->count--;
+        n++;
+        if (expire != NULL) {
+            expire(timer->data, arg);
+        }
+    }
+
+    return n;
+}
+
+/* TimerWheel_nextTimeout
+ *    Purpose: Computes how long the event loop may sleep before the wheel
+ *             needs to turn, either to fire a level 0 slot or to cascade an
+ *             upper level. Touched timers may cause an early, harmless wakeup.
+ * Parameters: @wheel - Pointer to the TimerWheel
+ *             @timeout - Set to the time until the next turn
+ *    Returns: false if no timer is scheduled and the loop may sleep forever.
+ */
+bool TimerWheel_nextTimeout(TimerWheel *wheel, struct timeval *timeout)
+{
+    if (wheel == NULL || timeout == NULL || wheel->count == 0) {
+        return false;
+    }
+
+    /* next level 0 roll-over, where upper levels cascade */
+    unsigned long ticks = TIMER_SLOTS - (wheel->now & SLOT_MASK);
+    for (unsigned long i = 1; i < ticks; i++) {
+        Timer *head = &wheel->slots[0][(wheel->now + i) & SLOT_MASK];
+        if (head->next != head) {
+            ticks = i;
+            break;
+        }
+    }
+
+    /* account for the part of the current tick already elapsed */
+    unsigned long ms = ticks * TIMER_TICK_MS;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long elapsed = (ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL) % TIMER_TICK_MS;
+    ms = (ms > elapsed) ? ms - elapsed : 0;
+
+    timeout->tv_sec  = ms / 1000;
+    timeout->tv_usec = (ms % 1000) * 1000;
+
+    return true;
+}
+
+/* Timer_init
+ *    Purpose: Initializes an idle timer owned by data.
+ * Parameters: @timer - Pointer to the Timer to initialize
+ *             @data - Owner passed to the expiry callback
+ *    Returns: None
+ */
+void Timer_init(Timer *timer, void *data)
+{
+    if (timer == NULL) {
+        return;
+    }
+
+    timer->next    = NULL;
+    timer->prev    = NULL;
+    timer->wheel   = NULL;
+    timer->expires = 0;
+    timer->timeout = 0;
+    timer->data    = data;
+}
+
+/* Timer_schedule
+ *    Purpose: Schedules a timer to expire timeout_ms from now, moving it if it
+ *             was already scheduled. The timeout is kept for Timer_touch.
+ * Parameters: @wheel - Pointer to the TimerWheel
+ *             @timer - Pointer to the Timer to schedule
+ *             @timeout_ms - Time until expiry in milliseconds
+ *    Returns: None
+ */
+void Timer_schedule(TimerWheel *wheel, Timer *timer, unsigned long timeout_ms)
+{
+    if (wheel == NULL || timer == NULL) {
+        return;
+    }
+
+    Timer_cancel(timer);
+
+    timer->timeout = (timeout_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->expires = wheel->now + timer->timeout;
+    timer->wheel   = wheel;
+    wheel->count++;
+    insert(wheel, timer);
+}
+
+/* Timer_touch
+ *    Purpose: Pushes the deadline of a scheduled timer back by its timeout.
+ *             The timer stays in its slot and is re-slotted only if it reaches
+ *             level 0 before the new deadline, so a touch is O(1) and costs no
+ *             list operations or clock reads.
+ * Parameters: @timer - Pointer to the Timer to touch
+ *    Returns: None
+ */
+void Timer_touch(Timer *timer)
+{
+    if (timer == NULL || timer->wheel == NULL) {
+        return;
+    }
+
+    timer->expires = timer->wheel->now + timer->timeout;
+}
+
+void Timer_cancel(Timer *timer)
+{
+    if (timer == NULL || timer->wheel == NULL) {
+        return;
+    }
+
+    unlink_timer(timer);
+    timer->wheel->count--;
+    timer->wheel = NULL;
+}
+
+bool Timer_isScheduled(Timer *timer)
+{
+    return timer != NULL && timer->wheel != NULL;
+}
+
+/* Static Functions --------------------------------------------------------- */
+
+static unsigned long now_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL) / TIMER_TICK_MS;
+}
+
+static void link_timer(Timer *head, Timer *timer)
+{
+    timer->next       = head;
+    timer->prev       = head->prev;
+    head->prev->next  = timer;
+    head->prev        = timer;
+}
+
+static void unlink_timer(Timer *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next       = NULL;
+    timer->prev       = NULL;
+}
+
+/* insert
+ *    Purpose: Places a timer in the level whose span covers its deadline.
+ *             Deadlines in the past fire on the next tick, deadlines beyond
+ *             the last level are clamped to it.
+ */
+static void insert(TimerWheel *wheel, Timer *timer)
+{
+    if (timer->expires <= wheel->now) {
+        timer->expires = wheel->now + 1;
+    }
+
+    unsigned long delta = timer->expires - wheel->now;
+    for (int l = 0; l < TIMER_LEVELS; l++) {
+        unsigned long span = 1UL << (TIMER_SLOT_BITS * (l + 1));
+        if (delta < span || l == TIMER_LEVELS - 1) {
+            unsigned long expires = timer->expires;
+            if (delta >= span) {
+                expires = wheel->now + span - 1;
+            }
+            int slot = (expires >> (TIMER_SLOT_BITS * l)) & SLOT_MASK;
+            link_timer(&wheel->slots[l][slot], timer);
+            return;
+        }
+    }
+}
+
+/* cascade
+ *    Purpose: Redistributes the timers of the current slot of an upper level
+ *             into the lower levels now that the wheel has reached it.
+ */
+static void cascade(TimerWheel *wheel, int level)
+{
+    int slot   = (wheel->now >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+    Timer *head = &wheel->slots[level][slot];
+
+    Timer pending;
+    pending.next = &pending;
+    pending.prev = &pending;
+    while (head->next != head) {
+        Timer *timer = head->next;
+        unlink_timer(timer);
+        link_timer(&pending, timer);
+    }
+
+    /* timers due this very tick go to the level 0 slot about to be processed */
+    while (pending.next != &pending) {
+        Timer *timer = pending.next;
+        unlink_timer(timer);
+        if (timer->expires <= wheel->now) {
+            link_timer(&wheel->slots[0][wheel->now & SLOT_MASK], timer);
+        } else {
+            insert(wheel, timer);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ
+#endif
+
+#include "tunnel.h"
+
+static void consumed(TunnelBuf *tb, size_t n);
+
+void TunnelBuf_init(TunnelBuf *tb)
+{
+    if (tb == NULL) {
+        return;
+    }
+
+    tb->rd     = -1;
+    tb->wr     = -1;
+    tb->ring   = NULL;
+    tb->head   = 0;
+    tb->len    = 0;
+    tb->paused = false;
+    tb->eof    = false;
+    tb->shut   = false;
+}
+
+/* TunnelBuf_open
+ *    Purpose: Sets up a tunnel direction, spliced through a pipe where splice
+ *             is available and the pipe can be created, else with a ring.
+ * Parameters: @tb - Pointer to the TunnelBuf
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE if neither could be set up.
+ */
+int TunnelBuf_open(TunnelBuf *tb)
+{
+    if (tb == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    TunnelBuf_init(tb);
+#if HAVE_SPLICE
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0) {
+        tb->rd = fds[0];
+        tb->wr = fds[1];
+
+        /* best effort, the default capacity works as well */
+        fcntl(tb->wr, F_SETPIPE_SZ, TUNNEL_PIPE_SZ);
+        return EXIT_SUCCESS;
+    }
+#endif
+
+    return TunnelBuf_openRing(tb);
+}
+
+/* TunnelBuf_openRing
+ *    Purpose: Switches an empty direction to the ring, for a socket that
+ *             cannot be spliced.
+ */
+int TunnelBuf_openRing(TunnelBuf *tb)
+{
+    if (tb == NULL || tb->len > 0) {
+        return ERROR_FAILURE;
+    }
+
+    if (tb->rd != -1) {
+        close(tb->rd);
+        close(tb->wr);
+        tb->rd = tb->wr = -1;
+    }
+
+    if (tb->ring == NULL) {
+        tb->ring = malloc(TUNNEL_RING_SZ);
+        if (tb->ring == NULL) {
+            return ERROR_FAILURE;
+        }
+    }
+    tb->head = 0;
+
+    return EXIT_SUCCESS;
+}
+
+void TunnelBuf_close(TunnelBuf *tb)
+{
+    if (tb == NULL) {
+        return;
+    }
+
+    if (tb->rd != -1) {
+        close(tb->rd);
+    }
+    if (tb->wr != -1) {
+        close(tb->wr);
+    }
+    free(tb->ring);
+    TunnelBuf_init(tb);
+}
+
+bool TunnelBuf_isOpen(TunnelBuf *tb)
+{
+    return tb != NULL && (tb->rd != -1 || tb->ring != NULL);
+}
+
+bool TunnelBuf_isSpliced(TunnelBuf *tb)
+{
+    return tb != NULL && tb->rd != -1;
+}
+
+/* TunnelBuf_fill
+ *    Purpose: Moves what the sender has into the direction's pipe or ring,
+ *             pausing the sender once the high watermark is reached.
+ * Parameters: @tb - Pointer to an open TunnelBuf
+ *             @fd - Readable sender socket
+ *    Returns: Bytes moved, 0 once the sender reached end of file which also
+ *             sets tb->eof, or -1 with errno set. EAGAIN with bytes pending
+ *             means no room is left. EINVAL from an empty pipe means the
+ *             sender cannot be spliced.
+ */
+ssize_t TunnelBuf_fill(TunnelBuf *tb, int fd)
+{
+    ssize_t n;
+
+    if (TunnelBuf_isSpliced(tb)) {
+#if HAVE_SPLICE
+        STATS_ADD(io_syscalls, 1);
+        n = splice(fd, NULL, tb->wr, NULL, TUNNEL_PIPE_SZ, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        errno = ENOSYS;
+        n     = -1;
+#endif
+    } else {
+        size_t space = TUNNEL_RING_SZ - tb->len;
+        if (space == 0) {
+            tb->paused = true;
+            errno      = EAGAIN;
+            return -1;
+        }
+
+        /* the free space wraps around the end of the ring at most once */
+        size_t tail = (tb->head + tb->len) % TUNNEL_RING_SZ;
+        struct iovec iov[2];
+        iov[0].iov_base = tb->ring + tail;
+        iov[0].iov_len  = (tail + space > TUNNEL_RING_SZ) ? TUNNEL_RING_SZ - tail : space;
+        iov[1].iov_base = tb->ring;
+        iov[1].iov_len  = space - iov[0].iov_len;
+
+        STATS_ADD(io_syscalls, 1);
+        n = readv(fd, iov, (iov[1].iov_len > 0) ? 2 : 1);
+    }
+
+    if (n > 0) {
+        tb->len += n;
+        if (tb->len >= TUNNEL_HIGH_WATER) {
+            tb->paused = true;
+        }
+    } else if (n == 0) {
+        tb->eof = true;
+    } else if ((errno == EAGAIN || errno == EWOULDBLOCK) && tb->len > 0) {
+        tb->paused = true;
+    }
+
+    return n;
+}
+
+/* TunnelBuf_drain
+ *    Purpose: Writes the direction's pending bytes to the receiver, resuming
+ *             the sender once below the low watermark.
+ * Parameters: @tb - Pointer to an open TunnelBuf
+ *             @fd - Receiving socket
+ *    Returns: Bytes moved, 0 if the receiver took none, or -1 on error.
+ */
+ssize_t TunnelBuf_drain(TunnelBuf *tb, int fd)
+{
+    if (tb->len == 0) {
+        return 0;
+    }
+
+    ssize_t n;
+    if (TunnelBuf_isSpliced(tb)) {
+#if HAVE_SPLICE
+        STATS_ADD(io_syscalls, 1);
+        n = splice(tb->rd, NULL, fd, NULL, tb->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        errno = ENOSYS;
+        n     = -1;
+#endif
+    } else {
+        struct iovec iov[2];
+        iov[0].iov_base = tb->ring + tb->head;
+        iov[0].iov_len  = (tb->head + tb->len > TUNNEL_RING_SZ) ? TUNNEL_RING_SZ - tb->head : tb->len;
+        iov[1].iov_base = tb->ring;
+        iov[1].iov_len  = tb->len - iov[0].iov_len;
+
+        struct msghdr msg;
+        zero(&msg, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = (iov[1].iov_len > 0) ? 2 : 1;
+
+        STATS_ADD(io_syscalls, 1);
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    }
+
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    consumed(tb, n);
+
+    return n;
+}
+
+static void consumed(TunnelBuf *tb, size_t n)
+{
+    tb->len -= n;
+    tb->head = (tb->len == 0) ? 0 : (tb->head + n) % TUNNEL_RING_SZ;
+    if (tb->paused && tb->len <= TUNNEL_LOW_WATER) {
+        tb->paused = false;
+    }
+}
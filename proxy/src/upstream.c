@@ -0,0 +1,227 @@
+#include "upstream.h"
+
+static void make_key(char *key, Query *query, bool tls);
+static bool healthy(Upstream *up);
+static void link_head(UpstreamPool *pool, Upstream *up);
+static void unlink_up(UpstreamPool *pool, Upstream *up);
+static void close_up(UpstreamPool *pool, Upstream *up);
+static void expire_idle(void *data, void *arg);
+
+void UpstreamPool_init(UpstreamPool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    zero(pool, sizeof(*pool));
+    pool->head.next = &pool->head;
+    pool->head.prev = &pool->head;
+    TimerWheel_init(&pool->timers);
+}
+
+/* UpstreamPool_free
+ *    Purpose: Closes every idle connection.
+ */
+void UpstreamPool_free(UpstreamPool *pool)
+{
+    if (pool == NULL || pool->head.next == NULL) {
+        return;
+    }
+
+    while (pool->head.next != &pool->head) {
+        close_up(pool, pool->head.next);
+    }
+}
+
+/* UpstreamPool_borrow
+ *    Purpose: Hands the query an idle connection to its origin, the most
+ *             recently returned one first.
+ *             Each candidate is checked with a one byte MSG_PEEK first: end
+ *             of file means the origin closed it, and bytes it sent while
+ *             idle mean the connection is out of step, both are dropped.
+ * Parameters: @pool - Pointer to the UpstreamPool
+ *             @query - Query about to connect, a socket it holds is closed on
+ *                      success
+ *             @tls - Whether the query talks TLS to the origin
+ *    Returns: EXIT_SUCCESS if the query now has a connection, or
+ *             ERROR_FAILURE if none is idle.
+ */
+int UpstreamPool_borrow(UpstreamPool *pool, Query *query, bool tls)
+{
+    if (pool == NULL || query == NULL || query->req == NULL || pool->count == 0) {
+        return ERROR_FAILURE;
+    }
+
+    char key[UPSTREAM_KEY_MAX];
+    make_key(key, query, tls);
+
+    Upstream *up = pool->head.next;
+    while (up != &pool->head) {
+        Upstream *next = up->next;
+        if (strcmp(up->key, key) != 0) {
+            up = next;
+            continue;
+        }
+
+        if (!healthy(up)) {
+            STATS_ADD(upstream_stale, 1);
+            close_up(pool, up);
+            up = next;
+            continue;
+        }
+
+        unlink_up(pool, up);
+        if (query->socket != -1) {
+            close(query->socket);
+        }
+        query->socket = up->socket;
+#if RUN_SSL
+        SSL_free(query->ssl);
+        query->ssl = up->ssl;
+#endif
+        free(up);
+
+        STATS_ADD(upstream_reuses, 1);
+        return EXIT_SUCCESS;
+    }
+
+    return ERROR_FAILURE;
+}
+
+/* UpstreamPool_return
+ *    Purpose: Takes the query's connection once its response completed,
+ *             closing it after UPSTREAM_IDLE_TIMEOUT unless borrowed again.
+ *             At UPSTREAM_MAX_IDLE the oldest idle connection makes room.
+ * Parameters: @pool - Pointer to the UpstreamPool
+ *             @query - Query whose socket is idle and unwatched
+ *             @tls - Whether the query talks TLS to the origin
+ *    Returns: EXIT_SUCCESS with the query's socket set to -1, or
+ *             ERROR_FAILURE if the origin already has UPSTREAM_MAX_PER_HOST
+ *             idle connections, the caller then closes it.
+ */
+int UpstreamPool_return(UpstreamPool *pool, Query *query, bool tls)
+{
+    if (pool == NULL || query == NULL || query->req == NULL || query->socket == -1) {
+        return ERROR_FAILURE;
+    }
+
+    char key[UPSTREAM_KEY_MAX];
+    make_key(key, query, tls);
+
+    int per_host = 0;
+    for (Upstream *up = pool->head.next; up != &pool->head; up = up->next) {
+        if (strcmp(up->key, key) == 0 && ++per_host >= UPSTREAM_MAX_PER_HOST) {
+            return ERROR_FAILURE;
+        }
+    }
+
+    Upstream *up = calloc(1, sizeof(Upstream));
+    if (up == NULL) {
+        return ERROR_FAILURE;
+    }
+    memcpy(up->key, key, sizeof(key));
+    up->socket = query->socket;
+#if RUN_SSL
+    up->ssl    = query->ssl;
+    query->ssl = NULL;
+#endif
+    query->socket = -1;
+
+    if (pool->count >= UPSTREAM_MAX_IDLE) {
+        close_up(pool, pool->head.prev);
+    }
+    link_head(pool, up);
+    Timer_init(&up->timer, up);
+    Timer_schedule(&pool->timers, &up->timer, UPSTREAM_IDLE_TIMEOUT * 1000);
+
+    return EXIT_SUCCESS;
+}
+
+/* UpstreamPool_tick
+ *    Purpose: Closes the connections idle for UPSTREAM_IDLE_TIMEOUT.
+ */
+void UpstreamPool_tick(UpstreamPool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    TimerWheel_advance(&pool->timers, expire_idle, pool);
+}
+
+/* UpstreamPool_nextTimeout
+ *    Purpose: Time until the next idle connection times out, see
+ *             TimerWheel_nextTimeout.
+ */
+bool UpstreamPool_nextTimeout(UpstreamPool *pool, struct timeval *timeout)
+{
+    if (pool == NULL) {
+        return false;
+    }
+
+    return TimerWheel_nextTimeout(&pool->timers, timeout);
+}
+
+/* make_key
+ *    Purpose: Formats the pool key of the query's origin, the host lower
+ *             cased as names are case-insensitive. Overlong hosts are cut,
+ *             their keys still differ by port or are simply not shared.
+ */
+static void make_key(char *key, Query *query, bool tls)
+{
+    int n = snprintf(key, UPSTREAM_KEY_MAX, "%s:%s%s", query->req->host, query->req->port, tls ? "+tls" : "");
+    if (n < 0) {
+        key[0] = '\0';
+    }
+
+    for (char *c = key; *c != '\0' && *c != ':'; c++) {
+        *c = tolower((unsigned char)*c);
+    }
+}
+
+static bool healthy(Upstream *up)
+{
+    char c;
+
+    STATS_ADD(io_syscalls, 1);
+    ssize_t n = recv(up->socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void link_head(UpstreamPool *pool, Upstream *up)
+{
+    up->prev             = &pool->head;
+    up->next             = pool->head.next;
+    pool->head.next->prev = up;
+    pool->head.next      = up;
+    pool->count++;
+}
+
+static void unlink_up(UpstreamPool *pool, Upstream *up)
+{
+    up->prev->next = up->next;
+    up->next->prev = up->prev;
+    up->next = up->prev = NULL;
+    pool->count--;
+
+    Timer_cancel(&up->timer);
+}
+
+static void close_up(UpstreamPool *pool, Upstream *up)
+{
+    unlink_up(pool, up);
+#if RUN_SSL
+    if (up->ssl != NULL) {
+        SSL_shutdown(up->ssl); // keeps its session resumable
+    }
+    SSL_free(up->ssl);
+#endif
+    close(up->socket);
+    free(up);
+}
+
+static void expire_idle(void *data, void *arg)
+{
+    close_up((UpstreamPool *)arg, (Upstream *)data);
+}
@@ -0,0 +1,360 @@
+#include "uring.h"
+
+#if HAVE_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static int uring_enter(Uring *ring, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+                       void *arg, size_t arg_sz);
+static unsigned int flush_sq(Uring *ring);
+
+/* Uring_init
+ *    Purpose: Sets up an io_uring instance and maps its submission queue,
+ *             completion queue and SQE array into the process.
+ * Parameters: @ring - Pointer to the Uring to initialize
+ *             @entries - Number of submission queue entries
+ *             @cq_entries - Number of completion queue entries, 0 for default
+ *    Returns: 0 on success, -1 on failure.
+ */
+int Uring_init(Uring *ring, unsigned int entries, unsigned int cq_entries)
+{
+    if (ring == NULL) {
+        return -1;
+    }
+
+    zero(ring, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params p;
+    zero(&p, sizeof(p));
+    if (cq_entries > 0) {
+        p.flags      = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        print_error("uring: io_uring_setup failed");
+        return -1;
+    }
+    ring->features = p.features;
+
+    /* timed waits without a timeout SQE need IORING_FEAT_EXT_ARG (5.11) */
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        print_error("uring: kernel does not support IORING_FEAT_EXT_ARG");
+        Uring_free(ring);
+        return -1;
+    }
+
+    ring->sq_map_sz   = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_map_sz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_map_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ptr = mmap(NULL, ring->sq_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        Uring_free(ring);
+        return -1;
+    }
+
+    ring->cq_ptr = mmap(NULL, ring->cq_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+        ring->cq_ptr = NULL;
+        Uring_free(ring);
+        return -1;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        Uring_free(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ptr;
+    ring->sq_head    = (unsigned int *)(sq + p.sq_off.head);
+    ring->sq_tail    = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask    = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_array   = (unsigned int *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail   = *ring->sq_tail;
+
+    char *cq = ring->cq_ptr;
+    ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+/* Uring_free
+ *    Purpose: Unmaps the rings and closes the io_uring descriptor. Requests
+ *             still in flight are cancelled by the kernel.
+ * Parameters: @ring - Pointer to the Uring to free
+ *    Returns: None
+ */
+void Uring_free(Uring *ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_map_sz);
+    }
+    if (ring->cq_ptr != NULL) {
+        munmap(ring->cq_ptr, ring->cq_map_sz);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_map_sz);
+    }
+    if (ring->fd != -1) {
+        close(ring->fd);
+    }
+
+    ring->sqes   = NULL;
+    ring->cq_ptr = NULL;
+    ring->sq_ptr = NULL;
+    ring->fd     = -1;
+}
+
+/* Uring_getSqe
+ *    Purpose: Returns the next free submission queue entry, zeroed. When the
+ *             queue is full the pending entries are submitted first.
+ * Parameters: @ring - Pointer to the Uring
+ *    Returns: Pointer to an SQE, or NULL if the queue could not be drained.
+ */
+struct io_uring_sqe *Uring_getSqe(Uring *ring)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        if (Uring_submit(ring) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ring->sqe_tail++;
+    zero(sqe, sizeof(*sqe));
+
+    return sqe;
+}
+
+/* Uring_reserve
+ *    Purpose: Makes room for n consecutive SQEs, submitting the pending ones
+ *             if needed, so a linked chain is never split across submissions.
+ * Parameters: @ring - Pointer to the Uring
+ *             @n - Number of SQEs the caller is about to prepare
+ *    Returns: 0 on success, -1 if the room could not be made.
+ */
+int Uring_reserve(Uring *ring, unsigned int n)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head + n <= ring->sq_entries) {
+        return 0;
+    }
+
+    if (Uring_submit(ring) < 0) {
+        return -1;
+    }
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    return (ring->sqe_tail - head + n <= ring->sq_entries) ? 0 : -1;
+}
+
+/* Uring_submit
+ *    Purpose: Hands all prepared SQEs to the kernel without waiting.
+ * Parameters: @ring - Pointer to the Uring
+ *    Returns: Number of SQEs submitted, or -1 on failure.
+ */
+int Uring_submit(Uring *ring)
+{
+    unsigned int to_submit = flush_sq(ring);
+    if (to_submit == 0) {
+        return 0;
+    }
+
+    return uring_enter(ring, to_submit, 0, 0, NULL, 0);
+}
+
+/* Uring_wait
+ *    Purpose: Submits the prepared SQEs and waits for at least one completion
+ *             in a single io_uring_enter call.
+ * Parameters: @ring - Pointer to the Uring
+ *             @timeout - Maximum time to wait, NULL waits indefinitely
+ *    Returns: 0 on success, timeout or interrupt, -1 on failure.
+ */
+int Uring_wait(Uring *ring, struct timeval *timeout)
+{
+    unsigned int to_submit = flush_sq(ring);
+
+    /* completions already queued, only submit */
+    if (Uring_peekCqe(ring) != NULL) {
+        if (to_submit > 0 && uring_enter(ring, to_submit, 0, 0, NULL, 0) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    zero(&arg, sizeof(arg));
+    if (timeout != NULL) {
+        ts.tv_sec  = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_usec * 1000;
+        arg.ts     = (unsigned long long)(uintptr_t)&ts;
+    }
+
+    int ret = uring_enter(ring, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (ret < 0 && (errno == ETIME || errno == EINTR)) {
+        return 0;
+    }
+
+    return (ret < 0) ? -1 : 0;
+}
+
+struct io_uring_cqe *Uring_peekCqe(Uring *ring)
+{
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL;
+    }
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void Uring_seenCqe(Uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* SQE Preparation ---------------------------------------------------------- */
+
+/* Uring_prepPollAdd
+ *    Purpose: One-shot poll, re-armed by the caller after it fires, which
+ *             keeps the level-triggered behaviour of select and epoll.
+ */
+void Uring_prepPollAdd(struct io_uring_sqe *sqe, int fd, unsigned int mask, unsigned long long data)
+{
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = mask;
+    sqe->user_data     = data;
+}
+
+/* Uring_prepCancel
+ *    Purpose: Cancels the request submitted with user_data target. This also
+ *             removes armed polls, and works after the fd has been closed.
+ */
+void Uring_prepCancel(struct io_uring_sqe *sqe, unsigned long long target, unsigned long long data)
+{
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = target;
+    sqe->user_data = data;
+}
+
+/* Uring_prepAccept
+ *    Purpose: Multishot accept, one SQE keeps producing a CQE per accepted
+ *             connection until it fails or is cancelled.
+ */
+void Uring_prepAccept(struct io_uring_sqe *sqe, int fd, int flags, unsigned long long data)
+{
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->fd           = fd;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = flags;
+    sqe->user_data    = data;
+}
+
+/* Uring_prepRecv
+ *    Purpose: Receive into a buffer picked by the kernel from group bgid at
+ *             completion time, so no memory is pinned while the socket idles.
+ */
+void Uring_prepRecv(struct io_uring_sqe *sqe, int fd, size_t len, int bgid, unsigned long long data)
+{
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = fd;
+    sqe->len       = len;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->user_data = data;
+}
+
+void Uring_prepSend(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, unsigned long long data)
+{
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long long)(uintptr_t)buf;
+    sqe->len       = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = data;
+}
+
+/* Uring_prepConnect
+ *    Purpose: Connect fd to addr. The kernel copies addr when the SQE is
+ *             submitted, so it must stay valid until then.
+ */
+void Uring_prepConnect(struct io_uring_sqe *sqe, int fd, const void *addr, unsigned int addr_l,
+                       unsigned long long data)
+{
+    sqe->opcode    = IORING_OP_CONNECT;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long long)(uintptr_t)addr;
+    sqe->off       = addr_l;
+    sqe->user_data = data;
+}
+
+void Uring_prepProvide(struct io_uring_sqe *sqe, void *addr, size_t len, int nbufs, int bgid, int bid,
+                       unsigned long long data)
+{
+    sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd        = nbufs;
+    sqe->addr      = (unsigned long long)(uintptr_t)addr;
+    sqe->len       = len;
+    sqe->off       = bid;
+    sqe->buf_group = bgid;
+    sqe->user_data = data;
+}
+
+/* Static Functions --------------------------------------------------------- */
+
+static int uring_enter(Uring *ring, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+                       void *arg, size_t arg_sz)
+{
+    ring->enters++;
+    int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, arg, arg_sz);
+    if (ret >= 0) {
+        ring->sqes_submitted += ret;
+    }
+
+    return ret;
+}
+
+/* flush_sq
+ *    Purpose: Publishes the locally prepared SQEs to the kernel's tail.
+ */
+static unsigned int flush_sq(Uring *ring)
+{
+    unsigned int tail = *ring->sq_tail;
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    while (tail != ring->sqe_tail) {
+        ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    return tail - head;
+}
+#endif /* HAVE_URING */
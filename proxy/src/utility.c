@@ -1,4 +1,5 @@
 #include "utility.h"
+#include "config.h"
 
 
 int get_char(int fd)
@@ -187,8 +188,9 @@ int expand_buffer(char **buffer, size_t *buffer_l, size_t *buffer_sz)
         return -1;
     }
 
-    /* expand the buffer */
-   *buffer_sz += BUFFER_SZ;
+    /* expand the buffer, doubling past the first step so a large response
+     * is not copied once per BUFFER_SZ received */
+    *buffer_sz += (*buffer_sz > BUFFER_SZ) ? *buffer_sz : BUFFER_SZ;
     char *new_buffer = calloc(*buffer_sz + 1, sizeof(char));
     if (new_buffer == NULL) {
         return -1;
@@ -274,6 +276,7 @@ SSL_CTX *InitServerCTX()
         ERR_print_errors_fp(stderr);
         return NULL;
     }
+    EnableKTLS(ctx);
     return ctx;
 }
 
@@ -290,10 +293,30 @@ SSL_CTX *InitCTX()
         ERR_print_errors_fp(stderr);
         return NULL; /* should close the client since we can't connect to server */
     }
+    EnableKTLS(ctx);
 
     return ctx;
 }
 
+/* EnableKTLS
+ *    Purpose: Has OpenSSL hand record encryption to the kernel after each
+ *             handshake, when the kernel tls module is loaded. A connection
+ *             whose cipher the kernel does not support stays in user space,
+ *             so callers never need to know which one they got.
+ * Parameters: @ctx - Context the intercepted or upstream connections use
+ *    Returns: None
+ */
+void EnableKTLS(SSL_CTX *ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ctx != NULL && access(KTLS_MODULE, F_OK) == 0) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#else
+    (void)ctx;
+#endif
+}
+
 void ShowCerts(SSL *ssl)
 {
     X509 *cert;
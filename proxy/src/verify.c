@@ -0,0 +1,133 @@
+#include "verify.h"
+
+#if RUN_SSL
+static int verify(X509_STORE_CTX *xctx, void *arg);
+static VerifySlot *find_slot(VerifyCache *cache, const unsigned char *fingerprint, const char *host);
+static time_t chain_expiry(X509_STORE_CTX *xctx, time_t now);
+
+/* VerifyCache_init
+ *    Purpose: Has the client side context look up the outcome of verifying
+ *             an origin's certificate before building and checking its
+ *             chain, and record the outcome when it has to.
+ * Parameters: @cache - Pointer to the VerifyCache
+ *             @ctx - Context the upstream connections are created from
+ *    Returns: EXIT_SUCCESS, or ERROR_FAILURE.
+ */
+int VerifyCache_init(VerifyCache *cache, SSL_CTX *ctx)
+{
+    if (cache == NULL || ctx == NULL) {
+        return ERROR_FAILURE;
+    }
+
+    zero(cache->slots, sizeof(cache->slots));
+    pthread_mutex_init(&cache->lock, NULL);
+    SSL_CTX_set_cert_verify_callback(ctx, verify, cache);
+
+    return EXIT_SUCCESS;
+}
+
+/* VerifyCache_free
+ *    Purpose: Drops the cached outcomes and destroys the lock. The slots are
+ *             held in place and own no OpenSSL objects.
+ */
+void VerifyCache_free(VerifyCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    zero(cache->slots, sizeof(cache->slots));
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/* verify
+ *    Purpose: OpenSSL callback in place of X509_verify_cert for the chain an
+ *             origin sent. A cached outcome for its leaf and the SNI name is
+ *             returned as is, anything else is verified in full, hostname
+ *             included, and cached.
+ *    Returns: 1 if the chain is trusted, 0 if not, with the verify error set.
+ */
+static int verify(X509_STORE_CTX *xctx, void *arg)
+{
+    VerifyCache *cache = (VerifyCache *)arg;
+    SSL *ssl = X509_STORE_CTX_get_ex_data(xctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+    const char *host = (ssl != NULL) ? SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name) : NULL;
+    X509 *leaf = X509_STORE_CTX_get0_cert(xctx);
+
+    unsigned char fingerprint[32];
+    unsigned int fingerprint_l = 0;
+    if (host == NULL || strlen(host) > MAX_HOST_LENGTH || leaf == NULL ||
+        X509_digest(leaf, EVP_sha256(), fingerprint, &fingerprint_l) != 1 || fingerprint_l != sizeof(fingerprint)) {
+        return X509_verify_cert(xctx);
+    }
+
+    time_t now = time(NULL);
+    pthread_mutex_lock(&cache->lock);
+    VerifySlot *slot = find_slot(cache, fingerprint, host);
+    bool hit = (slot->expires > now && memcmp(slot->fingerprint, fingerprint, sizeof(fingerprint)) == 0 &&
+                strcmp(slot->host, host) == 0);
+    int error = slot->error;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (hit) {
+        X509_STORE_CTX_set_error(xctx, error);
+        if (error != X509_V_OK) {
+            STATS_ADD(verify_fails, 1);
+            return 0;
+        }
+        STATS_ADD(verify_hits, 1);
+        return 1;
+    }
+
+    int ret = X509_verify_cert(xctx);
+    error = X509_STORE_CTX_get_error(xctx);
+    if (ret < 0) {
+        /* an internal error says nothing about the certificate */
+        return ret;
+    }
+    time_t expires = (ret == 1) ? chain_expiry(xctx, now) : now + VERIFY_NEG_TTL;
+
+    pthread_mutex_lock(&cache->lock);
+    slot = find_slot(cache, fingerprint, host);
+    memcpy(slot->fingerprint, fingerprint, sizeof(fingerprint));
+    snprintf(slot->host, sizeof(slot->host), "%s", host);
+    slot->error   = (ret == 1) ? X509_V_OK : error;
+    slot->expires = expires;
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
+
+static VerifySlot *find_slot(VerifyCache *cache, const unsigned char *fingerprint, const char *host)
+{
+    unsigned long hash;
+    memcpy(&hash, fingerprint, sizeof(hash));
+    hash ^= hash_foo((unsigned char *)host);
+
+    return &cache->slots[hash % VERIFY_CACHE_SZ];
+}
+
+/* chain_expiry
+ *    Purpose: Time the verified chain stops being valid, the earliest
+ *             notAfter in it, and no later than VERIFY_CACHE_TTL from now so
+ *             changes to the trust store are picked up.
+ */
+static time_t chain_expiry(X509_STORE_CTX *xctx, time_t now)
+{
+    time_t expires = now + VERIFY_CACHE_TTL;
+    STACK_OF(X509) *chain = X509_STORE_CTX_get0_chain(xctx);
+
+    for (int i = 0; i < sk_X509_num(chain); i++) {
+        int days, secs;
+        if (ASN1_TIME_diff(&days, &secs, NULL, X509_get0_notAfter(sk_X509_value(chain, i))) != 1) {
+            return now;
+        }
+        time_t left = now + (time_t)days * 24 * 60 * 60 + secs;
+        if (left < expires) {
+            expires = left;
+        }
+    }
+
+    return expires;
+}
+#endif
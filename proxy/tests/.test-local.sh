@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Setup shared by the tests against local origins, sourced by each of them.
+# Everything started through it is stopped when the test exits.
+
+WORKDIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+TESTDIR="${WORKDIR}/tests"
+PROXY="${WORKDIR}/bin/proxy"
+
+TMPDIR=$(mktemp -d)
+PIDS=""
+
+cleanup() {
+    kill ${PIDS} 2> /dev/null
+    rm -rf ${TMPDIR}
+}
+trap cleanup EXIT
+
+FAILED=0
+check() {
+    if [ "$2" == "$3" ]; then
+        printf "[+] PASS: $1\n"
+    else
+        printf "[!] FAIL: $1 (expected $3, got $2)\n"
+        FAILED=1
+    fi
+}
+
+# start_origin <port> <mode>
+#   Runs origin-stub.py, its accepted connections are logged to
+#   ${TMPDIR}/origin-<port>.log
+start_origin() {
+    python3 ${TESTDIR}/origin-stub.py $1 $2 > ${TMPDIR}/origin-$1.log 2> /dev/null &
+    PIDS="${PIDS} $!"
+}
+
+# connections <port>
+#   Number of connections the origin on port accepted
+connections() {
+    grep -c accepted ${TMPDIR}/origin-$1.log
+}
+
+# start_proxy <port>
+#   Runs the proxy, logged to ${TMPDIR}/proxy.log, and gives it time to listen
+start_proxy() {
+    ${PROXY} $1 > ${TMPDIR}/proxy.log 2>&1 &
+    PIDS="${PIDS} $!"
+    sleep 1
+}
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+# Stub DNS server for the resolver tests.
+#
+# usage: dns-stub.py <port> <ttl> <delay_ms> <name=addr>...
+#
+# Answers A queries for the listed names with the given TTL after delay_ms,
+# and NXDOMAIN with an SOA (negative TTL = ttl) for any other name. Every
+# query received is appended to stdout as "<name>", one per line, so a test
+# can count how many reached the server.
+
+import socket
+import struct
+import sys
+import threading
+import time
+
+
+def read_name(msg, off):
+    labels = []
+    while msg[off] != 0:
+        n = msg[off]
+        labels.append(msg[off + 1:off + 1 + n].decode())
+        off += 1 + n
+    return ".".join(labels).lower(), off + 1
+
+
+def answer(msg, names, ttl):
+    qid, = struct.unpack("!H", msg[:2])
+    name, off = read_name(msg, 12)
+    question = msg[12:off + 4]
+
+    if name in names:
+        header = struct.pack("!HHHHHH", qid, 0x8180, 1, 1, 0, 0)
+        rr = b"\xc0\x0c" + struct.pack("!HHIH", 1, 1, ttl, 4) + socket.inet_aton(names[name])
+        return name, header + question + rr
+
+    header = struct.pack("!HHHHHH", qid, 0x8183, 1, 0, 1, 0)
+    soa = b"\x00\x00" + struct.pack("!IIIII", 1, 60, 60, 60, ttl)  # root mname/rname
+    rr = b"\x00" + struct.pack("!HHIH", 6, 1, ttl, len(soa)) + soa
+    return name, header + question + rr
+
+
+def main():
+    port, ttl, delay = int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]) / 1000.0
+    names = dict(arg.lower().split("=", 1) for arg in sys.argv[4:])
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", port))
+
+    def reply(msg, addr):
+        name, resp = answer(msg, names, ttl)
+        print(name, flush=True)
+        time.sleep(delay)
+        sock.sendto(resp, addr)
+
+    while True:
+        msg, addr = sock.recvfrom(512)
+        threading.Thread(target=reply, args=(msg, addr), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
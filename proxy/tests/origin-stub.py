@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# Stub keep-alive origin for the tests against local origins.
+#
+# usage: origin-stub.py <port> <mode>
+#
+# Serves every request on a connection in turn, the proxy sends absolute-form
+# request lines. Every connection accepted is appended to stdout as
+# "accepted", one per line, so a test can count the connections it got.
+#
+# Modes:
+#   echo     answers with the request path, /slow after 300ms
+#   keep     answers "ok"
+#   close    answers "ok" and closes the connection
+#   once     answers "ok" and drops the connection on its second request
+#   framing  answers the canned response of the path, 7 bytes at a time
+
+import socket
+import sys
+import threading
+import time
+
+FRAMING = {
+    b"/length":  (b"HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world", False),
+    b"/chunked": (b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                  b"5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n", False),
+    b"/empty":   (b"HTTP/1.1 204 No Content\r\n\r\n", False),
+    b"/interim": (b"HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world", False),
+    b"/close":   (b"HTTP/1.1 200 OK\r\n\r\nhello world", True),
+    b"/short":   (b"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\nhello world", True),
+}
+
+
+def ok(body, close=False):
+    header = b"Connection: close\r\n" if close else b""
+    return b"HTTP/1.1 200 OK\r\n%sContent-Length: %d\r\n\r\n%s" % (header, len(body), body), close
+
+
+def respond(mode, path, served):
+    """Returns the response to send and whether to close after it, or None
+    to drop the connection without an answer."""
+    if mode == "echo":
+        if path == b"/slow":
+            time.sleep(0.3)
+        return ok(path + b"\n")
+    if mode == "once" and served == 1:
+        return None
+    if mode == "framing":
+        return FRAMING[path]
+    return ok(b"ok\n", mode == "close")
+
+
+def serve(conn, mode):
+    buffered, served = b"", 0
+    while True:
+        while b"\r\n\r\n" not in buffered:
+            data = conn.recv(4096)
+            if not data:
+                conn.close()
+                return
+            buffered += data
+        request, buffered = buffered.split(b"\r\n\r\n", 1)
+        path = b"/" + request.split(b" ")[1].split(b"/", 3)[-1]
+
+        answer = respond(mode, path, served)
+        if answer is None:
+            conn.close()
+            return
+        served += 1
+        response, close = answer
+        if mode == "framing":
+            for i in range(0, len(response), 7):
+                conn.sendall(response[i:i + 7])
+        else:
+            conn.sendall(response)
+        if close:
+            conn.close()
+            return
+
+
+def main():
+    port, mode = int(sys.argv[1]), sys.argv[2]
+
+    server = socket.create_server(("127.0.0.1", port), backlog=128)
+    while True:
+        conn, _ = server.accept()
+        print("accepted", flush=True)
+        threading.Thread(target=serve, args=(conn, mode), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()